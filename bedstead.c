@@ -92,16 +92,40 @@
  * the same 5x9 matrix as the originals, and processed in the same way.
  */
 
+#define _POSIX_C_SOURCE 200809L
+#ifdef __linux__
+#define _DEFAULT_SOURCE /* For syscall() */
+#endif
+
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#ifndef BEDSTEAD_LIBRARY
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#endif
 
-#define XSIZE 6
-#define YSIZE 10
+#include "bedstead.h"
+#include "font.h"
 
 /*
  * Design parameters.  These can vary between fonts in the Bedstead family.
@@ -124,48 +148,30 @@
  * pixels, which will work better on modern displays.  We round 122.9
  * to 124 so that XQTR will be precisely an integer.
  */
+#define DEFAULT_XPIX 100
+#define EXTENDED_XPIX 124
 
-struct param {
-	char const * fontname;
-	char const * fullname;
-	int xpix;
-	int ttfwidth;
-};
-
-struct param default_param = {
+struct param const default_param = {
 	"Bedstead", "Bedstead",
-	100,		/* xpix */
+	DEFAULT_XPIX,	/* xpix */
 	5,		/* ttfwidth */
 };
 
-struct param extended_param = {
+struct param const extended_param = {
 	"Bedstead-Extended", "Bedstead Extended",
-	124,		/* xpix */
+	EXTENDED_XPIX,	/* xpix */
 	7,		/* ttfwidth */
 };
 
-struct param *param = &default_param;
-
 /* Size of pixels in font design units (usually 1000/em) */
-#define XPIX (param->xpix)
+#define XPIX (ctx->param->xpix)
 #define YPIX 100
 
 /* Position of diagonal lines within pixels */
 #define XQTR (XPIX/4)
 #define YQTR (YPIX/4)
 
-void doprologue(void);
-void dochar(char const data[YSIZE], unsigned flags);
-static void domosaic(unsigned code, bool sep);
-
-struct glyph {
-	char data[YSIZE];
-	int unicode;
-	char const *name;
-	unsigned int flags;
-#define SC  0x01 /* Character has a small-caps variant. */
-#define MOS 0x02 /* Mosaic graphics character */
-} const glyphs[] = {
+struct glyph const glyphs[] = {
  /*
   * The first batch of glyphs comes from the code tables at the end of
   * the Mullard SAA5050 series datasheet, dated July 1982.
@@ -1057,30 +1063,333 @@ struct glyph {
  {{000,000,037,001,016,020,037,000,000}, -1, "z.sc" },
 };
 
-static void dolookups(struct glyph const *);
+int const nglyphs = sizeof(glyphs) / sizeof(glyphs[0]);
 
-static inline int
-getpix(char const data[YSIZE], int x, int y, unsigned flags)
-{
+/* The characters that vary between national options. */
+static unsigned char const national_codes[13] = {
+	0x23, 0x24, 0x40, 0x5b, 0x5c, 0x5d, 0x5e, 0x5f, 0x60,
+	0x7b, 0x7c, 0x7d, 0x7e,
+};
 
-	if (x < 0 || x >= XSIZE || y < 0 || y >= YSIZE)
-		return 0;
-	else
-		return (data[y] >> (XSIZE - x - 1)) & 1;
+static struct {
+	int unicode[13];
+	char const *suffix;	/* For glyphs peculiar to one chip */
+} const national_options[NNATIONAL] = {
+	[NATIONAL_ENGLISH] = {{ 0x00a3, 0x0024, 0x0040, 0x2190, 0x00bd,
+	    0x2192, 0x2191, 0x0023, 0x2014, 0x00bc, 0x2016, 0x00be,
+	    0x00f7 }, NULL },
+	[NATIONAL_GERMAN] = {{ 0x0023, 0x0024, 0x00a7, 0x00c4, 0x00d6,
+	    0x00dc, 0x005e, 0x005f, 0x00b0, 0x00e4, 0x00f6, 0x00fc,
+	    0x00df }, "saa5051" },
+	[NATIONAL_SWEDISH] = {{ 0x0023, 0x00a4, 0x00c9, 0x00c4, 0x00d6,
+	    0x00c5, 0x00dc, 0x005f, 0x00e9, 0x00e4, 0x00f6, 0x00e5,
+	    0x00fc }, "saa5052" },
+	[NATIONAL_ITALIAN] = {{ 0x00a3, 0x0024, 0x00e9, 0x00b0, 0x00e7,
+	    0x2192, 0x2191, 0x0023, 0x00f9, 0x00e0, 0x00f2, 0x00e8,
+	    0x00ec }, NULL },
+	[NATIONAL_FRENCH] = {{ 0x00e9, 0x00ef, 0x00e0, 0x00eb, 0x00ea,
+	    0x00f9, 0x00ee, 0x0023, 0x00e8, 0x00e2, 0x00f4, 0x00fb,
+	    0x00e7 }, "saa5054" },
+	[NATIONAL_SPANISH] = {{ 0x00e7, 0x0024, 0x00a1, 0x00e1, 0x00e9,
+	    0x00ed, 0x00f3, 0x00fa, 0x00bf, 0x00fc, 0x00f1, 0x00e8,
+	    0x00e0 }, NULL },
+	[NATIONAL_CZECH] = {{ 0x0023, 0x016f, 0x010d, 0x0165, 0x017e,
+	    0x00fd, 0x00ed, 0x0159, 0x00e9, 0x00e1, 0x011b, 0x00fa,
+	    0x0161 }, NULL },
+};
+
+typedef struct bedstead_vec vec;
+
+typedef struct point {
+	struct point *next, *prev;
+	vec v;
+} point;
+
+/*
+ * A pixel makes at most 16 points: a white pixel with all four corners
+ * filled has four triangles of four points each.  A context starts with
+ * room for a character cell's worth, and grows as bigger bitmaps need.
+ */
+#define PIXELPOINTS 16
+#define MAXPOINTS (XSIZE * YSIZE * PIXELPOINTS)
+
+/*
+ * The pieces that blackpixel() and whitepixel() draw, relative to the
+ * bottom-left corner of the pixel.  A black pixel is one contour made
+ * of a piece for each corner: the corner itself, or [1] the two ends
+ * of the diagonal that cuts it off.  A white pixel has a triangle for
+ * each filled corner, which [1] meets the triangle in the next corner
+ * round if that's filled too.  FRAGMENTS() works these out for a given
+ * pixel size, so that for the standard sizes they're constant tables.
+ */
+struct fragment {
+	int n;
+	vec v[4];
+};
+
+struct fragments {
+	struct fragment black[4][2], white[4][2];
+};
+
+#define FRAGMENTS(xp, yp) { \
+	{ /* black: bl, tl, tr, br */ \
+		{ { 1, { { 0, 0 } } }, \
+		  { 2, { { (xp)/4, 0 }, { 0, (yp)/4 } } } }, \
+		{ { 1, { { 0, yp } } }, \
+		  { 2, { { 0, (yp)-(yp)/4 }, { (xp)/4, yp } } } }, \
+		{ { 1, { { xp, yp } } }, \
+		  { 2, { { (xp)-(xp)/4, yp }, { xp, (yp)-(yp)/4 } } } }, \
+		{ { 1, { { xp, 0 } } }, \
+		  { 2, { { xp, (yp)/4 }, { (xp)-(xp)/4, 0 } } } }, \
+	}, \
+	{ /* white: bl (then br), tl (bl), tr (tl), br (tr) */ \
+		{ { 3, { { 0, 0 }, { 0, (yp)-(yp)/4 }, \
+			 { (xp)-(xp)/4, 0 } } }, \
+		  { 4, { { 0, 0 }, { 0, (yp)-(yp)/4 }, \
+			 { (xp)/2, (yp)/2-(yp)/4 }, { (xp)/4, 0 } } } }, \
+		{ { 3, { { 0, yp }, { (xp)-(xp)/4, yp }, \
+			 { 0, (yp)/4 } } }, \
+		  { 4, { { 0, yp }, { (xp)-(xp)/4, yp }, \
+			 { (xp)/2-(xp)/4, (yp)/2 }, { 0, (yp)-(yp)/4 } } } }, \
+		{ { 3, { { xp, yp }, { xp, (yp)/4 }, \
+			 { (xp)/4, yp } } }, \
+		  { 4, { { xp, yp }, { xp, (yp)/4 }, \
+			 { (xp)/2, (yp)/2+(yp)/4 }, { (xp)-(xp)/4, yp } } } }, \
+		{ { 3, { { xp, 0 }, { (xp)/4, 0 }, \
+			 { xp, (yp)-(yp)/4 } } }, \
+		  { 4, { { xp, 0 }, { (xp)/4, 0 }, \
+			 { (xp)/2+(xp)/4, (yp)/2 }, { xp, (yp)/4 } } } }, \
+	}, \
 }
 
+static struct fragments const default_fragments =
+    FRAGMENTS(DEFAULT_XPIX, YPIX);
+static struct fragments const extended_fragments =
+    FRAGMENTS(EXTENDED_XPIX, YPIX);
+
+enum { BL, TL, TR, BR };
+
+/*
+ * The line that an edge lies on, as the shortest vector along it
+ * (pointing rightwards or upwards) and its distance from the origin
+ * in units of that vector, and where along the line the edge starts.
+ * The edge in question starts at point i.
+ */
+struct edgeline {
+	int bx, by, c;
+	int s;
+	int i;
+};
+
+/*
+ * The edges on a long line are kept in a tree ordered by where they
+ * start along it, so that clean_path() can find those that an edge
+ * meets without looking at all the others.  Shorter lines are quicker
+ * to search from end to end.  Each node is the edge at the same place
+ * in lines[], so that nodes near each other in a tree are usually near
+ * each other in memory too.
+ */
+#define TREELINE 16
+
+struct edgenode {
+	int i;				/* The point the edge starts at */
+	int line;			/* Where its line starts in lines[] */
+	int s, e;			/* Its extent along the line */
+	bool rising;			/* Whether it runs from s to e */
+	bool intree;
+	int maxe;			/* Greatest e in its subtree */
+	int left, right;		/* Subtrees, or -1 */
+};
+
+/*
+ * Counters for one glyph, which the engine fills in if a context's
+ * stats pointer is set.  Otherwise they cost one test per phase.
+ * Times are in nanoseconds.
+ */
+struct glyphstats {
+	bool cached;			/* Copied from the glyph cache */
+	int blackpoints, whitepoints, tilepoints;	/* Points drawn */
+	int rounds;			/* Passes made by clean_path() */
+	int contours, points;		/* In the finished outline */
+	int emitted;			/* Points written to the SFD */
+	double drawtime, cleantime, finishtime, emittime, totaltime;
+};
+
+/*
+ * Everything the outline engine needs while working on a glyph.  The
+ * finished outline is copied out of points[] into opoints[] and
+ * contours[] so that it survives until the next glyph.
+ */
+struct bedstead_ctx {
+	struct param const *param;
+	struct fragments const *frag;
+	struct fragments ownfrag;	/* For non-standard sizes */
+	struct glyphstats *stats;
+	int size;			/* Room in each of the arrays below */
+	point *points;
+	int nextpoint;
+	int done_anything;
+	struct edgeline *lines;
+	int *rank;
+	struct edgenode *nodes;
+	int *roots;			/* Of each line's tree */
+	struct bedstead_outline outline;
+	vec *opoints;
+	int *contours;			/* size + 1 of these */
+	uint64_t *scratch;		/* For bedstead_image() */
+	size_t scratchsize;
+};
+
+#ifndef BEDSTEAD_LIBRARY
+
+static void fontinfo(struct font *, struct param const *);
+static int build_relations(void);
+static char const *glyphname(int);
+static int dootf(struct bedstead_ctx *, struct font *);
+static int buildstrike(struct strike *, struct font const *, int);
+static int dobitmap(struct font const *, char const *, int);
+static int dotilesets(struct bedstead_ctx *, struct font *, int, int,
+    char **);
+static int dosubsets(struct bedstead_ctx *, struct font *,
+    struct param const *);
+static void dolookups(struct buf *, struct bedstead_ctx *,
+    struct glyph const *);
+static void scname(char *, size_t, char const *);
+static void emit_path(struct buf *, struct bedstead_outline const *);
+static void doglyph(struct buf *, struct bedstead_ctx *, int, int);
+static int doglyphs_parallel(int, struct param const *, int const *);
+static int update_manifest(struct param const *, char const *,
+    unsigned long long const *);
+static int dovariants(int, int, char **);
+static int parse_bitmap(int, char **, char [YSIZE], char *, size_t);
+static int dobatch(struct bedstead_ctx *, FILE *, char const *);
+static int dobench(struct bedstead_ctx *, struct font *, int, char **);
+static int doimport(struct param const *, int, char const *, bool);
+static int ncpus(void);
+static int dot42(char const *, int, char **);
+static int doselftest(void);
+static void sfdheader(struct buf *, struct font const *, char const *, bool);
+static void draw_char(struct bedstead_ctx *, char const [YSIZE]);
+static void clean_path(struct bedstead_ctx *);
+static struct bedstead_outline const *finish_path(struct bedstead_ctx *,
+    int);
+static void clearpath(struct bedstead_ctx *);
+static void moveto(struct bedstead_ctx *, unsigned, unsigned);
+static void lineto(struct bedstead_ctx *, unsigned, unsigned);
+static void closepath(struct bedstead_ctx *);
+static void fix_edges(struct bedstead_ctx *, point *, point *);
+static int dohashes(struct bedstead_ctx *, int, char **);
+static int dodifferential(struct param const *, int, int, char **);
+static int dominimal(struct bedstead_ctx *, int);
+static double stats_now(void);
+static double stats_lap(double *);
+static int write_stats(char const *, struct font const *, int, double);
+static void serve_stream(FILE *, FILE *, struct param const *);
+static int serve_socket(char const *, struct param const *);
+
+/* Buffered output is written out whenever this much has built up. */
+#define OUTBUFSIZE 65536
+
+/* The glyph cache directory, if any, and the hash of each glyph's key. */
+static char const *cachedir;
+static unsigned long long *glyphhash;
+
+/* Counters for each glyph, if they're wanted. */
+static struct glyphstats *runstats;
+
 int
 main(int argc, char **argv)
 {
 	int i;
-	int const nglyphs = sizeof(glyphs) / sizeof(glyphs[0]);
 	int extraglyphs = 0;
+	struct param const *param = &default_param;
+	struct bedstead_ctx *ctx;
+	bool serve = false, otf = false, tileset = false, batch = false;
+	bool bench = false, hashes = false, differential = false;
+	bool minimal = false, subsets = false, variants = false;
+	bool selftest = false;
+	char const *sockpath = NULL;
+	char const *bitmapformat = NULL;
+	char const *changedfile = NULL;
+	char const *statsfile = NULL;
+	char const *importfile = NULL;
+	char const *t42file = NULL;
+	double starttime = 0;
+	int bitmapsize = 0;
+	struct font font;
+	int nthreads = 0;
+	int *encodings;
 	char *endptr;
+	struct buf out;
+	int ret;
 
 	while (argc > 1) {
 		if (strcmp(argv[1], "--extended") == 0) {
 			param = &extended_param;
+		} else if (strcmp(argv[1], "--otf") == 0) {
+			otf = true;
+		} else if ((strcmp(argv[1], "--bdf") == 0 ||
+			    strcmp(argv[1], "--pcf") == 0 ||
+			    strcmp(argv[1], "--psf") == 0) && argc > 2) {
+			bitmapformat = argv[1] + 2;
+			bitmapsize = strtol(argv[2], &endptr, 10);
+			if ((bitmapsize != 10 && bitmapsize != 20) || *endptr) {
+				fprintf(stderr, "bitmap size must be 10 or 20\n");
+				return 1;
+			}
+			argv++; argc--;
+		} else if (strcmp(argv[1], "--cache") == 0 && argc > 2) {
+			cachedir = argv[2];
+			argv++; argc--;
+		} else if (strcmp(argv[1], "--changed") == 0 && argc > 2) {
+			changedfile = argv[2];
+			argv++; argc--;
+		} else if (strcmp(argv[1], "--stats") == 0 && argc > 2) {
+			statsfile = argv[2];
+			argv++; argc--;
+		} else if (strcmp(argv[1], "--import") == 0 && argc > 2) {
+			importfile = argv[2];
 			argv++; argc--;
+		} else if (strcmp(argv[1], "--t42") == 0 && argc > 2) {
+			t42file = argv[2];
+			argv++; argc--;
+		} else if (strcmp(argv[1], "--batch") == 0) {
+			batch = true;
+		} else if (strcmp(argv[1], "--tileset") == 0) {
+			tileset = true;
+		} else if (strcmp(argv[1], "--selftest") == 0) {
+			selftest = true;
+		} else if (strcmp(argv[1], "--variants") == 0) {
+			variants = true;
+		} else if (strcmp(argv[1], "--subsets") == 0) {
+			subsets = true;
+		} else if (strcmp(argv[1], "--bench") == 0) {
+			bench = true;
+		} else if (strcmp(argv[1], "--hashes") == 0) {
+			hashes = true;
+		} else if (strcmp(argv[1], "--differential") == 0) {
+			differential = true;
+		} else if (strcmp(argv[1], "--minimal") == 0) {
+			minimal = true;
+		} else if (strcmp(argv[1], "--serve") == 0) {
+			serve = true;
+		} else if (strcmp(argv[1], "--socket") == 0 && argc > 2) {
+			serve = true;
+			sockpath = argv[2];
+			argv++; argc--;
+		} else if (strncmp(argv[1], "-j", 2) == 0) {
+			char const *arg = argv[1] + 2;
+
+			if (*arg == '\0' && argc > 2) {
+				arg = argv[2];
+				argv++; argc--;
+			}
+			nthreads = strtol(arg, &endptr, 10);
+			if (nthreads < 1 || *endptr) {
+				fprintf(stderr, "invalid thread count '%s'\n",
+				    arg);
+				return 1;
+			}
 		} else if (strcmp(argv[1], "--") == 0) {
 			argv++; argc--;
 			break;
@@ -1090,128 +1399,471 @@ main(int argc, char **argv)
 		} else break;
 		argv++; argc--;
 	}
+	/* Importing a whole font is worth all the processors we have. */
+	if (nthreads == 0)
+		nthreads = importfile ? ncpus() : 1;
+
+	if (serve) {
+		if (sockpath)
+			return serve_socket(sockpath, param);
+		serve_stream(stdin, stdout, param);
+		return 0;
+	}
+
+	if (importfile)
+		return doimport(param, nthreads, importfile, otf);
+
+	if (t42file)
+		return dot42(t42file, argc - 1, argv + 1);
+
+	if (selftest)
+		return doselftest();
+
+	if (variants) {
+		if (changedfile != NULL || statsfile != NULL) {
+			fprintf(stderr, "--variants can't take --changed "
+			    "or --stats\n");
+			return 1;
+		}
+		if (build_relations() != 0) {
+			fprintf(stderr, "%s\n", strerror(errno));
+			return 1;
+		}
+		return dovariants(nthreads, argc - 1, argv + 1);
+	}
+
+	ctx = bedstead_new(param);
+	if (ctx == NULL) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		return 1;
+	}
+
+	if (batch) {
+		FILE *in = stdin;
+		char const *fname = "<stdin>";
+
+		if (argc > 2) {
+			fprintf(stderr, "too many arguments\n");
+			return 1;
+		}
+		if (argc > 1 && strcmp(argv[1], "-") != 0) {
+			fname = argv[1];
+			in = fopen(fname, "r");
+			if (in == NULL) {
+				fprintf(stderr, "%s: %s\n", fname,
+				    strerror(errno));
+				return 1;
+			}
+		}
+		ret = dobatch(ctx, in, fname);
+		if (in != stdin) fclose(in);
+		bedstead_free(ctx);
+		return ret;
+	}
+
+	if (differential) {
+		bedstead_free(ctx);
+		return dodifferential(param, nthreads, argc - 1, argv + 1);
+	}
+
+	if (minimal) {
+		if (build_relations() != 0) {
+			fprintf(stderr, "%s\n", strerror(errno));
+			return 1;
+		}
+		return dominimal(ctx, argc - 1);
+	}
+
+	if (hashes) {
+		if (build_relations() != 0) {
+			fprintf(stderr, "%s\n", strerror(errno));
+			return 1;
+		}
+		return dohashes(ctx, argc - 1, argv + 1);
+	}
+
+	if (bench) {
+		fontinfo(&font, param);
+		if (build_relations() != 0) {
+			fprintf(stderr, "%s\n", strerror(errno));
+			return 1;
+		}
+		return dobench(ctx, &font, argc - 1, argv + 1);
+	}
+
+	if (tileset) {
+		if (param != &default_param) {
+			fprintf(stderr, "tilesets are only made from the "
+			    "default font\n");
+			return 1;
+		}
+		fontinfo(&font, param);
+		if (build_relations() != 0) {
+			fprintf(stderr, "%s\n", strerror(errno));
+			return 1;
+		}
+		return dotilesets(ctx, &font, nthreads, argc - 1, argv + 1);
+	}
+
+	if (subsets) {
+		fontinfo(&font, param);
+		if (build_relations() != 0) {
+			fprintf(stderr, "%s\n", strerror(errno));
+			return 1;
+		}
+		return dosubsets(ctx, &font, param);
+	}
 
         if (argc > 1) {
                 char data[YSIZE];
-                int i, y;
-                unsigned long u;
-
-                for (y = 0; y < YSIZE; y++)
-                        data[y] = 0;
-
-                y = 0;
-                for (i = 1; i < argc; i++) {
-                        if (y >= YSIZE) {
-                                fprintf(stderr, "too many arguments\n");
-                                return 1;
-                        }
-                        u = strtoul(argv[i], &endptr, 0);
-                        if (u > 077 || !argv[i] || *endptr) {
-                                fprintf(stderr, "invalid argument \"%s\"\n",
-                                        argv[i]);
-                                return 1;
-                        }
-                        data[y++] = u;
-                }
-		dochar(data, 0);
+		char err[80];
+
+		if (parse_bitmap(argc - 1, argv + 1, data, err, sizeof(err))) {
+			fprintf(stderr, "%s\n", err);
+			return 1;
+		}
+		buf_init(&out);
+		emit_path(&out, bedstead_char(ctx, data, 0));
+		ret = buf_write(&out, STDOUT_FILENO);
+		buf_free(&out);
+		if (ret != 0) {
+			fprintf(stderr, "%s\n", strerror(errno));
+			return 1;
+		}
                 return 0;
         }
 
+	fontinfo(&font, param);
+	if (build_relations() != 0) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		return 1;
+	}
+	if (otf)
+		return dootf(ctx, &font);
+	if (bitmapformat) {
+		bedstead_free(ctx);
+		if (param != &default_param) {
+			fprintf(stderr, "bitmaps need square pixels\n");
+			return 1;
+		}
+		return dobitmap(&font, bitmapformat, bitmapsize);
+	}
+
+	/*
+	 * Glyphs with no Unicode mapping are encoded after the BMP in
+	 * table order.  Work out where now so that the glyphs
+	 * themselves can be produced in any order.
+	 */
+	encodings = malloc(nglyphs * sizeof(encodings[0]));
+	if (encodings == NULL) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		return 1;
+	}
 	for (i = 0; i < nglyphs; i++)
-		if (glyphs[i].unicode == -1)
-			extraglyphs++;
-	printf("SplineFontDB: 3.0\n");
-	printf("FontName: %s\n", param->fontname);
-	printf("FullName: %s\n", param->fullname);
-	printf("FamilyName: Bedstead\n");
-	printf("Weight: Medium\n");
-	printf("OS2_WeightWidthSlopeOnly: 1\n");
-	printf("Copyright: Dedicated to the public domain\n");
-	printf("Version: 001.002\n");
-	printf("ItalicAngle: 0\n");
-	printf("UnderlinePosition: %d\n", -YPIX / 2);
-	printf("UnderlineWidth: %d\n", YPIX);
-	printf("OS2StrikeYPos: %d\n", 3 * YPIX);
-	printf("OS2StrikeYSize: %d\n", YPIX);
-	printf("Ascent: %d\n", 8 * YPIX);
-	printf("Descent: %d\n", 2 * YPIX);
+		encodings[i] = glyphs[i].unicode != -1 ? glyphs[i].unicode :
+		    65536 + extraglyphs++;
+	if (cachedir != NULL) {
+		if (mkdir(cachedir, 0777) != 0 && errno != EEXIST) {
+			fprintf(stderr, "%s: %s\n", cachedir, strerror(errno));
+			return 1;
+		}
+		glyphhash = calloc(nglyphs, sizeof(glyphhash[0]));
+		if (glyphhash == NULL) {
+			fprintf(stderr, "%s\n", strerror(errno));
+			return 1;
+		}
+	} else if (changedfile != NULL) {
+		fprintf(stderr, "--changed needs --cache\n");
+		return 1;
+	}
+	if (statsfile != NULL) {
+		runstats = calloc(nglyphs, sizeof(runstats[0]));
+		if (runstats == NULL) {
+			fprintf(stderr, "%s\n", strerror(errno));
+			return 1;
+		}
+		starttime = stats_now();
+	}
+	buf_init(&out);
+	sfdheader(&out, &font, "UnicodeBmp", true);
+	buf_printf(&out, "BeginChars: %d %d\n", 65536 + extraglyphs, nglyphs);
+	ret = 0;
+	if (nthreads > 1) {
+		ret = buf_write(&out, STDOUT_FILENO);
+		if (ret == 0 &&
+		    doglyphs_parallel(nthreads, param, encodings) != 0)
+			return 1;
+	} else
+		for (i = 0; i < nglyphs && ret == 0; i++) {
+			doglyph(&out, ctx, i, encodings[i]);
+			if (out.len >= OUTBUFSIZE)
+				ret = buf_write(&out, STDOUT_FILENO);
+		}
+	buf_printf(&out, "EndChars\n");
+	buf_printf(&out, "EndSplineFont\n");
+	if (ret != 0 || buf_write(&out, STDOUT_FILENO) != 0) {
+		fprintf(stderr, "error writing font: %s\n", strerror(errno));
+		return 1;
+	}
+	buf_free(&out);
+	if (cachedir != NULL && update_manifest(param, changedfile,
+	    glyphhash) != 0)
+		return 1;
+	if (statsfile != NULL && write_stats(statsfile, &font, nthreads,
+	    stats_now() - starttime) != 0)
+		return 1;
+	free(encodings);
+	bedstead_free(ctx);
+	return 0;
+}
+
+/* Fill in the font-wide parts of a font description. */
+static void
+fontinfo(struct font *font, struct param const *param)
+{
+	static struct { int ppem, flags; } const gasp[] = {
+		/* Force monochrome at 10 and 20 pixels, and greyscale elsewhere. */
+		{ 9, 2 }, { 10, 0 }, { 19, 3 }, { 20, 0 }, { 65535, 3 },
+	};
+	int i;
+
+	memset(font, 0, sizeof(*font));
+	font->fontname = param->fontname;
+	font->fullname = param->fullname;
+	font->familyname = "Bedstead";
+	font->weight = "Medium";
+	font->weightclass = 500;
+	font->widthclass = param->ttfwidth;
+	font->copyright = "Dedicated to the public domain";
+	font->version = "001.002";
+	font->ascent = 8 * YPIX;
+	font->descent = 2 * YPIX;
+	font->underlinepos = -YPIX / 2;
+	font->underlinewidth = YPIX;
+	font->strikepos = 3 * YPIX;
+	font->strikesize = YPIX;
 	/* Sub/Superscript are three by five pixels */
-	printf("OS2SubXSize: %d\n", YSIZE * YPIX * 3 / (XSIZE - 1));
-	printf("OS2SupXSize: %d\n", YSIZE * YPIX * 3 / (XSIZE - 1));
-	printf("OS2SubYSize: %d\n", YSIZE * YPIX * 5 / (YSIZE - 3));
-	printf("OS2SupYSize: %d\n", YSIZE * YPIX * 5 / (YSIZE - 3));
-	printf("OS2SubXOff: 0\n");
-	printf("OS2SupXOff: 0\n");
-	printf("OS2SubYOff: %d\n", 2 * YPIX);
-	printf("OS2SupYOff: %d\n", 2 * YPIX);
-	printf("TTFWidth: %d\n", param->ttfwidth);
-	printf("LayerCount: 2\n");
-	printf("Layer: 0 0 \"Back\" 1\n");
-	printf("Layer: 1 0 \"Fore\" 0\n");
-	printf("Encoding: UnicodeBmp\n");
-	printf("NameList: Adobe Glyph List\n");
-	printf("DisplaySize: -24\n");
-	printf("AntiAlias: 1\n");
-	printf("FitToEm: 1\n");
-	printf("BeginPrivate: 2\n");
-	printf(" StdHW 5 [%d]\n", YPIX);
-	printf(" StdVW 5 [%d]\n", XPIX);
-	printf("EndPrivate\n");
-	/* Force monochrome at 10 and 20 pixels, and greyscale elsewhere. */
-	printf("GaspTable: 5 9 2 10 0 19 3 20 0 65535 3\n");
-	printf("Lookup: 1 0 0 \"salt: stylistic alternates\" {\"salt\"} "
+	font->subxsize = font->supxsize = YSIZE * YPIX * 3 / (XSIZE - 1);
+	font->subysize = font->supysize = YSIZE * YPIX * 5 / (YSIZE - 3);
+	font->subxoff = font->supxoff = 0;
+	font->subyoff = font->supyoff = 2 * YPIX;
+	font->stdhw = YPIX;
+	font->stdvw = param->xpix;
+	font->ngasp = sizeof(gasp) / sizeof(gasp[0]);
+	for (i = 0; i < font->ngasp; i++) {
+		font->gasp[i].ppem = gasp[i].ppem;
+		font->gasp[i].flags = gasp[i].flags;
+	}
+}
+
+/*
+ * The SFD header, up to BeginChars.  Imported fonts have none of
+ * Bedstead's lookups.
+ */
+static void
+sfdheader(struct buf *out, struct font const *font, char const *encoding,
+    bool lookups)
+{
+	int i;
+
+	buf_printf(out, "SplineFontDB: 3.0\n");
+	buf_printf(out, "FontName: %s\n", font->fontname);
+	buf_printf(out, "FullName: %s\n", font->fullname);
+	buf_printf(out, "FamilyName: %s\n", font->familyname);
+	buf_printf(out, "Weight: %s\n", font->weight);
+	buf_printf(out, "OS2_WeightWidthSlopeOnly: 1\n");
+	buf_printf(out, "Copyright: %s\n", font->copyright);
+	buf_printf(out, "Version: %s\n", font->version);
+	buf_printf(out, "ItalicAngle: 0\n");
+	buf_printf(out, "UnderlinePosition: %d\n", font->underlinepos);
+	buf_printf(out, "UnderlineWidth: %d\n", font->underlinewidth);
+	buf_printf(out, "OS2StrikeYPos: %d\n", font->strikepos);
+	buf_printf(out, "OS2StrikeYSize: %d\n", font->strikesize);
+	buf_printf(out, "Ascent: %d\n", font->ascent);
+	buf_printf(out, "Descent: %d\n", font->descent);
+	buf_printf(out, "OS2SubXSize: %d\n", font->subxsize);
+	buf_printf(out, "OS2SupXSize: %d\n", font->supxsize);
+	buf_printf(out, "OS2SubYSize: %d\n", font->subysize);
+	buf_printf(out, "OS2SupYSize: %d\n", font->supysize);
+	buf_printf(out, "OS2SubXOff: %d\n", font->subxoff);
+	buf_printf(out, "OS2SupXOff: %d\n", font->supxoff);
+	buf_printf(out, "OS2SubYOff: %d\n", font->subyoff);
+	buf_printf(out, "OS2SupYOff: %d\n", font->supyoff);
+	buf_printf(out, "TTFWidth: %d\n", font->widthclass);
+	buf_printf(out, "LayerCount: 2\n");
+	buf_printf(out, "Layer: 0 0 \"Back\" 1\n");
+	buf_printf(out, "Layer: 1 0 \"Fore\" 0\n");
+	buf_printf(out, "Encoding: %s\n", encoding);
+	buf_printf(out, "NameList: Adobe Glyph List\n");
+	buf_printf(out, "DisplaySize: -24\n");
+	buf_printf(out, "AntiAlias: 1\n");
+	buf_printf(out, "FitToEm: 1\n");
+	buf_printf(out, "BeginPrivate: 2\n");
+	buf_printf(out, " StdHW 5 [%d]\n", font->stdhw);
+	buf_printf(out, " StdVW 5 [%d]\n", font->stdvw);
+	buf_printf(out, "EndPrivate\n");
+	buf_printf(out, "GaspTable: %d", font->ngasp);
+	for (i = 0; i < font->ngasp; i++)
+		buf_printf(out, " %d %d", font->gasp[i].ppem,
+		    font->gasp[i].flags);
+	buf_printf(out, "\n");
+	if (!lookups) return;
+	buf_printf(out,
+	    "Lookup: 1 0 0 \"salt: stylistic alternates\" {\"salt\"} "
 	    "['salt' ('DFLT' <'dflt'> 'latn' <'dflt'>)]\n");
-	printf("Lookup: 1 0 0 \"ss01: SAA5051 forms\" {\"ss01\"} "
+	buf_printf(out, "Lookup: 1 0 0 \"ss01: SAA5051 forms\" {\"ss01\"} "
 	    "['ss01' ('DFLT' <'dflt'> 'latn' <'dflt'>)]\n");
-	printf("OtfFeatName: 'ss01' 1033 \"SAA5051\"\n");
-	printf("Lookup: 1 0 0 \"ss02: SAA5052 forms\" {\"ss02\"} "
+	buf_printf(out, "OtfFeatName: 'ss01' 1033 \"SAA5051\"\n");
+	buf_printf(out, "Lookup: 1 0 0 \"ss02: SAA5052 forms\" {\"ss02\"} "
 	    "['ss02' ('DFLT' <'dflt'> 'latn' <'dflt'>)]\n");
-	printf("OtfFeatName: 'ss02' 1033 \"SAA5052\"\n");
-	printf("Lookup: 1 0 0 \"ss04: SAA5054 forms\" {\"ss04\"} "
+	buf_printf(out, "OtfFeatName: 'ss02' 1033 \"SAA5052\"\n");
+	buf_printf(out, "Lookup: 1 0 0 \"ss04: SAA5054 forms\" {\"ss04\"} "
 	    "['ss04' ('DFLT' <'dflt'> 'latn' <'dflt'>)]\n");
-	printf("OtfFeatName: 'ss04' 1033 \"SAA5054\"\n");
-	printf("Lookup: 3 0 0 \"aalt: all alternates\" {\"aalt\"} "
+	buf_printf(out, "OtfFeatName: 'ss04' 1033 \"SAA5054\"\n");
+	buf_printf(out, "Lookup: 3 0 0 \"aalt: all alternates\" {\"aalt\"} "
 	    "['aalt' ('DFLT' <'dflt'> 'latn' <'dflt'>)]\n");
-	printf("Lookup: 257 0 0 \"palt: proportional metrics\" {\"palt\"} "
+	buf_printf(out,
+	    "Lookup: 257 0 0 \"palt: proportional metrics\" {\"palt\"} "
 	    "['palt' ('DFLT' <'dflt'> 'latn' <'dflt'>)]\n");
-	printf("Lookup: 1 0 0 \"smcp: lower-case to small caps\" {\"smcp\"} "
+	buf_printf(out,
+	    "Lookup: 1 0 0 \"smcp: lower-case to small caps\" {\"smcp\"} "
 	    "['smcp' ('latn' <'dflt'>)]\n");
-	printf("Lookup: 1 0 0 \"c2sc: upper-case to small caps\" {\"c2sc\"} "
+	buf_printf(out,
+	    "Lookup: 1 0 0 \"c2sc: upper-case to small caps\" {\"c2sc\"} "
 	    "['c2sc' ('latn' <'dflt'>)]\n");
-	printf("BeginChars: %d %d\n", 65536 + extraglyphs, nglyphs);
-	extraglyphs = 0;
-	for (i = 0; i < nglyphs; i++) {
-		if (glyphs[i].name)
-			printf("\nStartChar: %s\n", glyphs[i].name);
-		else
-			printf("\nStartChar: uni%04X\n",
-			    (unsigned)glyphs[i].unicode);
-		printf("Encoding: %d %d %d\n",
-		    glyphs[i].unicode != -1 ? glyphs[i].unicode :
-		    65536 + extraglyphs++, glyphs[i].unicode, i);
-		printf("Width: %d\n", XSIZE * XPIX);
-		printf("Flags: W\n");
-		printf("LayerCount: 2\n");
-		dolookups(&glyphs[i]);
-		if (glyphs[i].flags & MOS)
-			domosaic(glyphs[i].data[0],
-				 (glyphs[i].data[0] & 0x20) != 0);
-		else
-			dochar(glyphs[i].data, glyphs[i].flags);
-		printf("EndChar\n");
+}
+
+/* Write the SFD description of glyphs[i], whose outline is o. */
+static void
+sfdglyph(struct buf *b, struct bedstead_ctx *ctx, int i, int encoding,
+    struct bedstead_outline const *o)
+{
+	double t = 0;
+
+	buf_printf(b, "\nStartChar: %s\n", glyphname(i));
+	buf_printf(b, "Encoding: %d %d %d\n", encoding, glyphs[i].unicode, i);
+	buf_printf(b, "Width: %d\n", XSIZE * XPIX);
+	buf_printf(b, "Flags: W\n");
+	buf_printf(b, "LayerCount: 2\n");
+	dolookups(b, ctx, &glyphs[i]);
+	if (ctx->stats) t = stats_now();
+	emit_path(b, o);
+	if (ctx->stats) {
+		ctx->stats->emittime += stats_lap(&t);
+		/* Each contour ends by repeating its first point. */
+		ctx->stats->emitted += o->contours[o->ncontours] +
+		    o->ncontours;
 	}
-	printf("EndChars\n");
-	printf("EndSplineFont\n");
-	return 0;
+	buf_printf(b, "EndChar\n");
+}
+
+/* Write the SFD description of glyphs[i]. */
+static void
+genglyph(struct buf *b, struct bedstead_ctx *ctx, int i, int encoding)
+{
+
+	sfdglyph(b, ctx, i, encoding, bedstead_glyph(ctx, &glyphs[i]));
+}
+
+/*
+ * Parallel glyph generation.  The glyph table is cut into fixed-size
+ * chunks, and each worker thread repeatedly claims the next chunk and
+ * writes its glyphs into that chunk's own buffer using its own
+ * context.  Once all the workers have finished, the buffers are
+ * written out in table order, so the output is exactly what a serial
+ * run would produce.
+ */
+
+#define CHUNKSIZE 32
+
+struct workqueue {
+	struct param const *param;
+	int const *encodings;
+	struct buf *chunks;
+	int nchunks;
+	int next;
+	pthread_mutex_t lock;
+};
+
+static void *
+glyph_worker(void *arg)
+{
+	struct workqueue *q = arg;
+	struct bedstead_ctx *ctx;
+	struct buf *c;
+	int n, i;
+
+	ctx = bedstead_new(q->param);
+	for (;;) {
+		pthread_mutex_lock(&q->lock);
+		n = q->next++;
+		pthread_mutex_unlock(&q->lock);
+		if (n >= q->nchunks) break;
+		c = &q->chunks[n];
+		if (ctx == NULL) {
+			c->failed = true;
+			continue;
+		}
+		for (i = n * CHUNKSIZE;
+		     i < nglyphs && i < (n + 1) * CHUNKSIZE; i++)
+			doglyph(c, ctx, i, q->encodings[i]);
+	}
+	if (ctx) bedstead_free(ctx);
+	return NULL;
+}
+
+static int
+doglyphs_parallel(int nthreads, struct param const *param,
+    int const *encodings)
+{
+	struct workqueue q;
+	pthread_t *threads;
+	int i, started, ret = 0;
+
+	q.param = param;
+	q.encodings = encodings;
+	q.nchunks = (nglyphs + CHUNKSIZE - 1) / CHUNKSIZE;
+	q.next = 0;
+	q.chunks = malloc(q.nchunks * sizeof(q.chunks[0]));
+	threads = malloc(nthreads * sizeof(threads[0]));
+	if (q.chunks == NULL || threads == NULL) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < q.nchunks; i++)
+		buf_init(&q.chunks[i]);
+	pthread_mutex_init(&q.lock, NULL);
+	for (started = 0; started < nthreads; started++)
+		if (pthread_create(&threads[started], NULL,
+		    glyph_worker, &q) != 0)
+			break;
+	/* If we couldn't start any threads, do the work ourselves. */
+	if (started == 0)
+		glyph_worker(&q);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	/* This fails without writing anything if any chunk failed. */
+	if (buf_writev(q.chunks, q.nchunks, STDOUT_FILENO) != 0) {
+		fprintf(stderr, "error writing font: %s\n", strerror(errno));
+		ret = -1;
+	}
+	for (i = 0; i < q.nchunks; i++)
+		buf_free(&q.chunks[i]);
+	pthread_mutex_destroy(&q.lock);
+	free(q.chunks);
+	free(threads);
+	return ret;
 }
 
+/* Work out a glyph's "palt" adjustments, in pixels. */
 static void
-dopalt(struct glyph const *g)
+getpalt(struct glyph const *g, int *dxp, int *dhp)
 {
 	int i;
 	unsigned char cols = 0;
 	int dx = 0, dh = 0;
 
+	*dxp = *dhp = 0;
 	if (g->flags & MOS) return;
 	/*
 	 * For proportional layout, we'd like a left side-bearing of
@@ -1232,389 +1884,5343 @@ dopalt(struct glyph const *g)
 			dh--;
 		}
 	}
-	if (dx || dh)
-		printf("Position2: \"palt\" dx=%d dy=0 dh=%d dv=0\n",
-		    dx * XPIX, dh * XPIX);
+	*dxp = dx;
+	*dhp = dh;
 }
 
-
 static void
-dolookups(struct glyph const *g)
+dopalt(struct buf *b, struct bedstead_ctx *ctx, struct glyph const *g)
 {
-	char prefix[32];
-	size_t plen;
-	int i;
-	int const nglyphs = sizeof(glyphs) / sizeof(glyphs[0]);
+	int dx, dh;
 
-	if (g->name)
-		plen = sprintf(prefix, "%s.", g->name);
-	else
-		plen = sprintf(prefix, "uni%04X.", g->unicode);
-	assert(plen < 32);
+	getpalt(g, &dx, &dh);
+	if (dx || dh)
+		buf_printf(b, "Position2: \"palt\" dx=%d dy=0 dh=%d dv=0\n",
+		    dx * XPIX, dh * XPIX);
+}
 
-	/* Look for related glyphs */
-	for (i = 0; i < nglyphs; i++) {
-		if (glyphs[i].name &&
-		    strncmp(prefix, glyphs[i].name, plen) == 0) {
-			if (strcmp(glyphs[i].name + plen, "alt") == 0)
-				printf("Substitution2: \"salt\" %s\n",
-				       glyphs[i].name);
-			if (strcmp(glyphs[i].name + plen, "saa5051") == 0)
-				printf("Substitution2: \"ss01\" %s\n",
-				       glyphs[i].name);
-			if (strcmp(glyphs[i].name + plen, "saa5052") == 0)
-				printf("Substitution2: \"ss02\" %s\n",
-				       glyphs[i].name);
-			if (strcmp(glyphs[i].name + plen, "saa5054") == 0)
-				printf("Substitution2: \"ss04\" %s\n",
-				       glyphs[i].name);
-			printf("AlternateSubs2: \"aalt\" %s\n",
-			       glyphs[i].name);
-		}
-	}
-	if ((g->flags & SC))
-		printf("Substitution2: \"%s\" %c%ssc\n",
-		    isupper((unsigned char)prefix[0]) ? "c2sc" : "smcp",
-		    tolower((unsigned char)prefix[0]), prefix + 1);
-	dopalt(g);
-}
-
-typedef struct vec {
-	int x, y;
-} vec;
 
-typedef struct point {
-	struct point *next, *prev;
-	struct vec v;
-} point;
+/*
+ * A glyph's relatives are the named glyphs whose names start with the
+ * glyph's own name followed by a full stop, like "a.sc" for "a" or
+ * "uni0041.alt" for an unnamed U+0041.  Rather than searching the
+ * whole glyph table for each glyph, we find them all at once by
+ * looking up every prefix of every dotted name in a hash table of
+ * glyph names.  relatives[relstart[r]] to relatives[relstart[r + 1] - 1]
+ * are then the relatives, in table order, of every glyph whose name
+ * is the same as that of glyphs[r], and relkey[i] is the r for glyphs[i].
+ */
+static int *relkey, *relstart, *relatives;
 
-#define MAXPOINTS (XSIZE * YSIZE * 20)
+/* The hash table of glyph names, which is kept for findglyph(). */
+static int *nametable;
+static unsigned namemask;
 
-static point points[MAXPOINTS];
+/* Substitutions implied by the suffix of a relative's name. */
+static struct {
+	char const *suffix, *feature;
+	int subst;
+} const substs[] = {
+	{ "alt",	"salt",	SUBST_SALT },
+	{ "saa5051",	"ss01",	SUBST_SS01 },
+	{ "saa5052",	"ss02",	SUBST_SS02 },
+	{ "saa5054",	"ss04",	SUBST_SS04 },
+};
+#define NSUBSTS (sizeof(substs) / sizeof(substs[0]))
 
-static int nextpoint;
+/* Names for unnamed glyphs, as used in the SFD. */
+static char (*uninames)[16];
 
-static void
-clearpath()
+static char const *
+glyphname(int i)
 {
 
-	nextpoint = 0;
+	return glyphs[i].name ? glyphs[i].name : uninames[i];
 }
 
-static void
-moveto(unsigned x, unsigned y)
+static unsigned
+namehash(char const *name, size_t len)
 {
-	struct point *p = &points[nextpoint++];
+	unsigned h = 2166136261U;
 
-	p->v.x = x; p->v.y = y;
-	p->next = p->prev = NULL;
+	while (len--)
+		h = (h ^ (unsigned char)*name++) * 16777619U;
+	return h;
 }
 
-static void
-lineto(unsigned x, unsigned y)
+/*
+ * Find the slot for a name in a hash table, which maps names to the
+ * first glyph with that name.  Returns either a slot containing that
+ * glyph or an empty slot.
+ */
+static int *
+namelookup(int *table, unsigned mask, char const *name, size_t len)
 {
-	struct point *p = &points[nextpoint++];
+	unsigned h = namehash(name, len) & mask;
+	char const *n;
 
-	p->v.x = x; p->v.y = y;
-	p->next = NULL;
-	p->prev = p - 1;
-	p->prev->next = p;
+	for (;; h = (h + 1) & mask) {
+		if (table[h] == -1) return &table[h];
+		n = glyphname(table[h]);
+		if (strncmp(n, name, len) == 0 && n[len] == '\0')
+			return &table[h];
+	}
 }
 
-static void
-closepath()
+/* Find the first glyph with a given name, or -1 if there isn't one. */
+static int
+findglyph(char const *name)
 {
-	struct point *p = &points[nextpoint - 1];
 
-	while (p->prev) p--;
-	p->prev = points + nextpoint - 1;
-	points[nextpoint - 1].next = p;
+	return *namelookup(nametable, namemask, name, strlen(name));
+}
+
+static int
+build_relations(void)
+{
+	int *table, *slot, *count;
+	unsigned mask;
+	char const *name, *dot;
+	int i, r, pass;
+
+	relkey = malloc(nglyphs * sizeof(relkey[0]));
+	relstart = calloc(nglyphs + 1, sizeof(relstart[0]));
+	uninames = malloc(nglyphs * sizeof(uninames[0]));
+	for (mask = 1; mask < 2 * (unsigned)nglyphs; mask <<= 1)
+		continue;
+	table = malloc(mask * sizeof(table[0]));
+	count = calloc(nglyphs, sizeof(count[0]));
+	if (relkey == NULL || relstart == NULL || uninames == NULL ||
+	    table == NULL || count == NULL)
+		return -1;
+	mask--;
+	for (i = 0; i <= (int)mask; i++)
+		table[i] = -1;
+	for (i = 0; i < nglyphs; i++) {
+		if (!glyphs[i].name)
+			sprintf(uninames[i], "uni%04X",
+			    (unsigned)glyphs[i].unicode);
+		name = glyphname(i);
+		slot = namelookup(table, mask, name, strlen(name));
+		if (*slot == -1) *slot = i;
+		relkey[i] = *slot;
+	}
+	/*
+	 * Count the relatives of each name, then go round again to
+	 * fill them in.
+	 */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < nglyphs; i++) {
+			if (!glyphs[i].name) continue;
+			name = glyphs[i].name;
+			for (dot = strchr(name, '.'); dot;
+			     dot = strchr(dot + 1, '.')) {
+				r = *namelookup(table, mask, name, dot - name);
+				if (r == -1) continue;
+				if (pass == 0)
+					relstart[r + 1]++;
+				else
+					relatives[relstart[r] + count[r]++] = i;
+			}
+		}
+		if (pass == 0) {
+			for (r = 0; r < nglyphs; r++)
+				relstart[r + 1] += relstart[r];
+			relatives = malloc((relstart[nglyphs] + 1) *
+			    sizeof(relatives[0]));
+			if (relatives == NULL)
+				return -1;
+		}
+	}
+	nametable = table;
+	namemask = mask;
+	free(count);
+	return 0;
 }
 
 static void
-killpoint(point *p)
+dolookups(struct buf *b, struct bedstead_ctx *ctx, struct glyph const *g)
 {
+	char const *name = glyphname(g - glyphs);
+	size_t plen = strlen(name) + 1;
+	int i, k, r = relkey[g - glyphs];
+	size_t j;
+	char sc[64];
 
-	p->prev->next = p->next;
-	p->next->prev = p->prev;
-	p->next = p->prev = NULL;
+	/* Related glyphs */
+	for (k = relstart[r]; k < relstart[r + 1]; k++) {
+		i = relatives[k];
+		for (j = 0; j < NSUBSTS; j++)
+			if (strcmp(glyphs[i].name + plen,
+			    substs[j].suffix) == 0)
+				buf_printf(b, "Substitution2: \"%s\" %s\n",
+				    substs[j].feature, glyphs[i].name);
+		buf_printf(b, "AlternateSubs2: \"aalt\" %s\n",
+		    glyphs[i].name);
+	}
+	if ((g->flags & SC)) {
+		scname(sc, sizeof(sc), name);
+		buf_printf(b, "Substitution2: \"%s\" %s\n",
+		    isupper((unsigned char)name[0]) ? "c2sc" : "smcp", sc);
+	}
+	dopalt(b, ctx, g);
 }
 
-static vec const zero = { 0, 0 };
+/*
+ * The glyph cache.  Each glyph's SFD description is stored in the
+ * cache directory in a file named after a hash of everything that
+ * goes into it: the bitmap and flags, the design parameters, the
+ * glyph's name, position and encoding, the names of its relatives, and
+ * CACHE_VERSION.  The file starts with that key in full, so a hash
+ * collision is just a miss.  Files are written under temporary names
+ * and renamed into place, so several processes can share a cache.
+ *
+ * A manifest of which glyph had which hash last time is kept for each
+ * font, so that the glyphs that have changed since then can be listed
+ * for later build stages.
+ */
 
-static int
-vec_eqp(vec v1, vec v2)
+/* Change this whenever a change to the program changes any glyph. */
+#define CACHE_VERSION 1
+
+static unsigned long long
+fnv64(char const *p, size_t len)
 {
-	return v1.x == v2.x && v1.y == v2.y;
+	unsigned long long h = 14695981039346656037ULL;
+
+	while (len--)
+		h = (h ^ (unsigned char)*p++) * 1099511628211ULL;
+	return h;
 }
 
-static vec
-vec_sub(vec v1, vec v2)
+static void
+glyphkey(struct buf *b, struct bedstead_ctx *ctx, int i, int encoding)
 {
-	vec ret;
-	ret.x = v1.x - v2.x; ret.y = v1.y - v2.y;
-	return ret;
+	struct glyph const *g = &glyphs[i];
+	int k, r = relkey[i];
+	unsigned char d;
+
+	buf_printf(b, "bedstead-cache %d xpix=%d index=%d encoding=%d "
+	    "unicode=%d name=%s flags=%u data=", CACHE_VERSION, XPIX, i,
+	    encoding, g->unicode, glyphname(i), g->flags);
+	for (k = 0; k < YSIZE; k++) {
+		d = g->data[k];
+		buf_printf(b, "%s%c%c%c", k ? "," : "",
+		    '0' + (d >> 6), '0' + (d >> 3 & 7), '0' + (d & 7));
+	}
+	buf_printf(b, " relatives=");
+	for (k = relstart[r]; k < relstart[r + 1]; k++)
+		buf_printf(b, "%s%s", k > relstart[r] ? "," : "",
+		    glyphs[relatives[k]].name);
+	buf_printf(b, "\n");
 }
 
-static int
-gcd(int a, int b)
+/*
+ * Read the entry for a key into a freshly allocated buffer.  Returns
+ * NULL if there isn't one.
+ */
+static char *
+cachefile_read(unsigned long long hash, char const *key, size_t keylen,
+    size_t *lenp)
 {
-	int t;
-	while (b != 0) {
-		t = b;
-		b = a % b;
-		a = t;
+	char path[4096], *buf = NULL, *nbuf;
+	size_t len = 0, size = 0, n;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%016llx", cachedir, hash);
+	f = fopen(path, "rb");
+	if (f == NULL) return NULL;
+	for (;;) {
+		if (len == size) {
+			size = size ? 2 * size : 4096;
+			nbuf = realloc(buf, size);
+			if (nbuf == NULL) break;
+			buf = nbuf;
+		}
+		n = fread(buf + len, 1, size - len, f);
+		if (n == 0) break;
+		len += n;
 	}
-	return a;
+	if (ferror(f) || len < keylen || memcmp(buf, key, keylen) != 0) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(f);
+	if (buf == NULL) return NULL;
+	memmove(buf, buf + keylen, len - keylen);
+	*lenp = len - keylen;
+	return buf;
 }
 
-/* Return the shortest representable vector parallel to the argument. */
-static vec
-vec_bearing(vec v)
+static void
+cachefile_write(unsigned long long hash, char const *key, size_t keylen,
+    char const *body, size_t len)
 {
-	vec ret;
-	int d = gcd(abs(v.x), abs(v.y));
-	if (d != 0) {
-		ret.x = v.x / d;
-		ret.y = v.y / d;
-	} else {
-		ret.x = 0;
-		ret.y = 0;
+	char path[4096], tmp[4096];
+	FILE *f;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%016llx", cachedir, hash);
+	snprintf(tmp, sizeof(tmp), "%s/tmpXXXXXX", cachedir);
+	fd = mkstemp(tmp);
+	if (fd == -1) return;
+	f = fdopen(fd, "wb");
+	if (f == NULL) {
+		close(fd);
+		unlink(tmp);
+		return;
 	}
-	return ret;
+	fwrite(key, 1, keylen, f);
+	fwrite(body, 1, len, f);
+	if (fclose(f) != 0 || rename(tmp, path) != 0)
+		unlink(tmp);
 }
 
-/* If p is identical to its successor, remove p. */
+/*
+ * Look glyphs[i] up in the cache, leaving its key in key and the hash
+ * of that in *hash.  If it's there, add its SFD description to b.
+ */
+static bool
+cache_fetch(struct buf *b, struct buf *key, struct bedstead_ctx *ctx,
+    int i, int encoding, unsigned long long *hash)
+{
+	char *body;
+	size_t len;
+
+	glyphkey(key, ctx, i, encoding);
+	if (key->failed) return false;
+	*hash = fnv64((char *)key->data, key->len);
+	body = cachefile_read(*hash, (char *)key->data, key->len, &len);
+	if (body == NULL) return false;
+	buf_put(b, body, len);
+	free(body);
+	if (ctx->stats) ctx->stats->cached = true;
+	return true;
+}
+
+/* Store what's been added to b since start under a missed key. */
 static void
-fix_identical(point *p)
+cache_store(struct buf const *b, size_t start, struct buf const *key,
+    unsigned long long hash)
 {
-	if (!p->next) return;
-	if (vec_eqp(p->next->v, p->v))
-		killpoint(p);
+
+	if (!b->failed && !key->failed)
+		cachefile_write(hash, (char *)key->data, key->len,
+		    (char *)b->data + start, b->len - start);
 }
 
-/* Are a, b, and c distinct collinear points in that order? */
+/* Write the SFD description of glyphs[i], from the cache if possible. */
+static void
+cachedglyph(struct buf *b, struct bedstead_ctx *ctx, int i, int encoding)
+{
+	struct buf key;
+	size_t len;
+
+	if (cachedir == NULL) {
+		genglyph(b, ctx, i, encoding);
+		return;
+	}
+	buf_init(&key);
+	if (!cache_fetch(b, &key, ctx, i, encoding, &glyphhash[i])) {
+		len = b->len;
+		genglyph(b, ctx, i, encoding);
+		cache_store(b, len, &key, glyphhash[i]);
+	}
+	buf_free(&key);
+}
+
+/* Write the SFD description of glyphs[i], counting things if wanted. */
+static void
+doglyph(struct buf *b, struct bedstead_ctx *ctx, int i, int encoding)
+{
+	double t;
+
+	if (runstats == NULL) {
+		cachedglyph(b, ctx, i, encoding);
+		return;
+	}
+	ctx->stats = &runstats[i];
+	t = stats_now();
+	cachedglyph(b, ctx, i, encoding);
+	runstats[i].totaltime += stats_lap(&t);
+	ctx->stats = NULL;
+}
+
+/*
+ * Write the counters for every glyph, and their totals, as JSON.
+ * With more than one thread, the phase times add up to more than the
+ * wall-clock time.
+ */
 static int
-vec_inline3(vec a, vec b, vec c)
+write_stats(char const *fname, struct font const *font, int nthreads,
+    double walltime)
 {
-	return
-	    vec_eqp(vec_bearing(vec_sub(b, a)), vec_bearing(vec_sub(c, b))) &&
-	    !vec_eqp(vec_bearing(vec_sub(b, a)), zero);
+	static char const *const fields[] = {
+		"black_points", "white_points", "tile_points", "drawn_points",
+		"clean_rounds", "contours", "points", "emitted_points",
+	};
+	static char const *const times[] = {
+		"draw_ns", "clean_ns", "finish_ns", "emit_ns", "total_ns",
+	};
+#define NFIELDS (sizeof(fields) / sizeof(fields[0]))
+#define NTIMES (sizeof(times) / sizeof(times[0]))
+	struct glyphstats *st;
+	long total[NFIELDS] = { 0 };
+	double ttotal[NTIMES] = { 0 }, t[NTIMES];
+	int v[NFIELDS];
+	int i, peak = 0, maxrounds = 0, ncached = 0;
+	size_t k;
+	FILE *f;
+
+	f = fopen(fname, "w");
+	if (f == NULL) {
+		fprintf(stderr, "%s: %s\n", fname, strerror(errno));
+		return -1;
+	}
+	fprintf(f, "{\n  \"font\": \"%s\",\n  \"threads\": %d,\n"
+	    "  \"maxpoints\": %d,\n  \"wall_ns\": %.0f,\n  \"glyphs\": [",
+	    font->fontname, nthreads, MAXPOINTS, walltime);
+	for (i = 0; i < nglyphs; i++) {
+		st = &runstats[i];
+		v[0] = st->blackpoints; v[1] = st->whitepoints;
+		v[2] = st->tilepoints;
+		v[3] = st->blackpoints + st->whitepoints + st->tilepoints;
+		v[4] = st->rounds; v[5] = st->contours;
+		v[6] = st->points; v[7] = st->emitted;
+		t[0] = st->drawtime; t[1] = st->cleantime;
+		t[2] = st->finishtime; t[3] = st->emittime;
+		t[4] = st->totaltime;
+		fprintf(f, "%s\n    { \"name\": \"%s\", \"cached\": %s",
+		    i ? "," : "", glyphname(i),
+		    st->cached ? "true" : "false");
+		for (k = 0; k < NFIELDS; k++) {
+			fprintf(f, ", \"%s\": %d", fields[k], v[k]);
+			total[k] += v[k];
+		}
+		for (k = 0; k < NTIMES; k++) {
+			fprintf(f, ", \"%s\": %.0f", times[k], t[k]);
+			ttotal[k] += t[k];
+		}
+		fprintf(f, " }");
+		if (v[3] > peak) peak = v[3];
+		if (st->rounds > maxrounds) maxrounds = st->rounds;
+		if (st->cached) ncached++;
+	}
+	fprintf(f, "\n  ],\n  \"total\": {\n    \"glyphs\": %d,\n"
+	    "    \"cached\": %d,\n    \"peak_drawn_points\": %d,\n"
+	    "    \"max_clean_rounds\": %d", nglyphs, ncached, peak,
+	    maxrounds);
+	for (k = 0; k < NFIELDS; k++)
+		fprintf(f, ",\n    \"%s\": %ld", fields[k], total[k]);
+	for (k = 0; k < NTIMES; k++)
+		fprintf(f, ",\n    \"%s\": %.0f", times[k], ttotal[k]);
+	fprintf(f, "\n  }\n}\n");
+	if (fclose(f) != 0) {
+		fprintf(stderr, "%s: %s\n", fname, strerror(errno));
+		return -1;
+	}
+	return 0;
+#undef NFIELDS
+#undef NTIMES
 }
 
-/* Are a, b, c, and d distinct collinear points in that order? */
+/*
+ * Compare this run's glyph hashes with the ones in the manifest from
+ * last time, list the names of the glyphs that are new, changed or
+ * gone in changedfile if that isn't NULL, and write a new manifest.
+ */
 static int
-vec_inline4(vec a, vec b, vec c, vec d)
+update_manifest(struct param const *param, char const *changedfile,
+    unsigned long long const *hashes)
 {
-	return vec_inline3(a, b, c) && vec_inline3(b, c, d);
+	char path[4096], tmp[4096], *line = NULL, *name;
+	unsigned long long *oldhash;
+	size_t linesize = 0;
+	FILE *f, *out = NULL;
+	int i, j, fd, ret = -1;
+	bool *seen;
+
+	oldhash = calloc(nglyphs, sizeof(oldhash[0]));
+	seen = calloc(nglyphs, sizeof(seen[0]));
+	if (oldhash == NULL || seen == NULL) goto out;
+	if (changedfile != NULL && (out = fopen(changedfile, "w")) == NULL)
+		goto out;
+	snprintf(path, sizeof(path), "%s/%s.manifest", cachedir,
+	    param->fontname);
+	f = fopen(path, "r");
+	while (f != NULL && getline(&line, &linesize, f) != -1) {
+		name = strchr(line, ' ');
+		if (name == NULL) continue;
+		*name++ = '\0';
+		name[strcspn(name, "\n")] = '\0';
+		j = findglyph(name);
+		if (j != -1) {
+			oldhash[j] = strtoull(line, NULL, 16);
+			seen[j] = true;
+		} else if (out != NULL)
+			fprintf(out, "%s\n", name);
+	}
+	if (f != NULL) fclose(f);
+	if (out != NULL)
+		for (i = 0; i < nglyphs; i++)
+			if (!seen[i] || oldhash[i] != hashes[i])
+				fprintf(out, "%s\n", glyphname(i));
+
+	snprintf(tmp, sizeof(tmp), "%s/tmpXXXXXX", cachedir);
+	if ((fd = mkstemp(tmp)) == -1) goto out;
+	if ((f = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+	for (i = 0; i < nglyphs; i++)
+		fprintf(f, "%016llx %s\n", hashes[i], glyphname(i));
+	if (fclose(f) != 0 || rename(tmp, path) != 0) {
+		unlink(tmp);
+		goto out;
+	}
+	ret = 0;
+out:
+	if (ret != 0)
+		fprintf(stderr, "%s: %s\n", cachedir, strerror(errno));
+	if (out != NULL && fclose(out) != 0 && ret == 0) {
+		fprintf(stderr, "%s: %s\n", changedfile, strerror(errno));
+		ret = -1;
+	}
+	free(line);
+	free(oldhash);
+	free(seen);
+	return ret;
 }
 
-/* If p is on the line between its predecessor and successor, remove p. */
-static void
-fix_collinear(point *p)
+/*
+ * Several fonts from one run.  Each variant is a set of design
+ * parameters with its own SFD file.  Since bedstead_rescale() can
+ * make an outline at any width that's a multiple of 4 from one at
+ * another, each glyph is drawn and tidied up only once, at a width of
+ * 4, and rescaled for every variant.  Other widths would truncate
+ * XQTR, so they aren't allowed.  With a cache, each variant has its
+ * own manifest and its own list of changed glyphs, and a glyph is only
+ * drawn at all if some variant misses.
+ */
+static struct param const quarter_param = { NULL, NULL, 4, 0 };
+
+struct variant {
+	struct param param;
+	char fontname[32], fullname[32];
+	char sfdname[32], changedname[32];
+	unsigned long long *hashes;
+};
+
+struct variantqueue {
+	struct variant *v;
+	int nvariants;
+	int const *encodings;
+	struct buf *chunks;		/* nchunks for each variant in turn */
+	int nchunks;
+	int next;
+	pthread_mutex_t lock;
+};
+
+/*
+ * A variant is "default", "extended", or a pixel width and a
+ * usWidthClass separated by a colon, such as "112:6".  Complains and
+ * returns -1 if it's none of those.
+ */
+static int
+parse_variant(struct variant *v, char const *spec)
 {
-	if (!p->next) return;
-	if (vec_inline3(p->prev->v, p->v, p->next->v))
-		killpoint(p);
+	char base[20], *endptr;
+	long xpix, width;
+
+	if (strcmp(spec, "default") == 0) {
+		v->param = default_param;
+		snprintf(base, sizeof(base), "bedstead");
+	} else if (strcmp(spec, "extended") == 0) {
+		v->param = extended_param;
+		snprintf(base, sizeof(base), "bedstead-ext");
+	} else {
+		xpix = strtol(spec, &endptr, 10);
+		if (xpix >= 1 && xpix <= 1000 && *endptr == ':')
+			width = strtol(endptr + 1, &endptr, 10);
+		else
+			width = 0;
+		if (width < 1 || width > 9 || *endptr) {
+			fprintf(stderr, "invalid variant '%s'\n", spec);
+			return -1;
+		}
+		if (xpix % 4 != 0) {
+			fprintf(stderr, "variant '%s': pixel width must be a "
+			    "multiple of 4\n", spec);
+			return -1;
+		}
+		snprintf(v->fontname, sizeof(v->fontname), "Bedstead-%ld",
+		    xpix);
+		snprintf(v->fullname, sizeof(v->fullname), "Bedstead %ld",
+		    xpix);
+		v->param.fontname = v->fontname;
+		v->param.fullname = v->fullname;
+		v->param.xpix = xpix;
+		v->param.ttfwidth = width;
+		snprintf(base, sizeof(base), "bedstead-%ld", xpix);
+	}
+	snprintf(v->sfdname, sizeof(v->sfdname), "%s.sfd", base);
+	snprintf(v->changedname, sizeof(v->changedname), "%s.changed", base);
+	return 0;
 }
 
-/* If p is the only point on its path, remove p. */
+/*
+ * Write glyphs[i] into chunk n of every variant.  ctx[k] is for
+ * variant k, and ctx[nvariants] for quarter_param.
+ */
 static void
-fix_isolated(point *p)
+variant_glyph(struct variantqueue *q, struct bedstead_ctx **ctx, int n,
+    int i)
 {
-	if (p->next == p)
-		killpoint(p);
+	struct bedstead_outline const *o, *shared = NULL;
+	struct buf key, *b;
+	size_t start;
+	int k;
+
+	for (k = 0; k < q->nvariants; k++) {
+		b = &q->chunks[k * q->nchunks + n];
+		start = b->len;
+		buf_init(&key);
+		if (cachedir != NULL && cache_fetch(b, &key, ctx[k], i,
+		    q->encodings[i], &q->v[k].hashes[i])) {
+			buf_free(&key);
+			continue;
+		}
+		if (shared == NULL)
+			shared = bedstead_glyph(ctx[q->nvariants], &glyphs[i]);
+		o = bedstead_rescale(ctx[k], shared, quarter_param.xpix);
+		if (o == NULL)
+			b->failed = true;
+		else
+			sfdglyph(b, ctx[k], i, q->encodings[i], o);
+		if (cachedir != NULL)
+			cache_store(b, start, &key, q->v[k].hashes[i]);
+		buf_free(&key);
+	}
 }
 
-static int done_anything;
+static void *
+variant_worker(void *arg)
+{
+	struct variantqueue *q = arg;
+	struct bedstead_ctx **ctx;
+	int k, n, i;
+	bool ok;
 
-static void
-fix_edges(point *a0, point *b0)
+	ctx = calloc(q->nvariants + 1, sizeof(ctx[0]));
+	ok = ctx != NULL;
+	for (k = 0; ok && k <= q->nvariants; k++) {
+		ctx[k] = bedstead_new(k < q->nvariants ? &q->v[k].param :
+		    &quarter_param);
+		ok = ctx[k] != NULL;
+	}
+	for (;;) {
+		pthread_mutex_lock(&q->lock);
+		n = q->next++;
+		pthread_mutex_unlock(&q->lock);
+		if (n >= q->nchunks) break;
+		for (k = 0; !ok && k < q->nvariants; k++)
+			q->chunks[k * q->nchunks + n].failed = true;
+		for (i = n * CHUNKSIZE;
+		     ok && i < nglyphs && i < (n + 1) * CHUNKSIZE; i++)
+			variant_glyph(q, ctx, n, i);
+	}
+	for (k = 0; ctx != NULL && k <= q->nvariants; k++)
+		if (ctx[k] != NULL) bedstead_free(ctx[k]);
+	free(ctx);
+	return NULL;
+}
+
+static int
+dovariants(int nthreads, int nargs, char **args)
 {
-	point *a1 = a0->next, *b1 = b0->next;
+	struct variantqueue q;
+	struct variant *v;
+	struct font font;
+	struct buf out;
+	pthread_t *threads;
+	int *encodings, extraglyphs = 0;
+	int i, k, fd, started, ret = 0;
 
-	assert(a1->prev == a0); assert(b1->prev == b0);
-	assert(a0 != a1); assert(a0 != b0);
-	assert(a1 != b1); assert(b0 != b1);
-	if (vec_eqp(vec_bearing(vec_sub(a0->v, a1->v)),
-		    vec_bearing(vec_sub(b1->v, b0->v))) &&
-	    (vec_inline4(a0->v, b1->v, a1->v, b0->v) ||
-	     vec_inline4(a0->v, b1->v, b0->v, a1->v) ||
-	     vec_inline4(b1->v, a0->v, b0->v, a1->v) ||
-	     vec_inline4(b1->v, a0->v, a1->v, b0->v) ||
-	     vec_eqp(a0->v, b1->v) || vec_eqp(a1->v, b0->v))) {
-		a0->next = b1; b1->prev = a0;
-		b0->next = a1; a1->prev = b0;
-		fix_isolated(a0);
-		fix_identical(a0);
-		fix_collinear(b1);
-		fix_isolated(b0);
-		fix_identical(b0);
-		fix_collinear(a1);
-		done_anything = 1;
+	if (nargs == 0) {
+		fprintf(stderr, "no variants given\n");
+		return 1;
+	}
+	v = calloc(nargs, sizeof(v[0]));
+	encodings = malloc(nglyphs * sizeof(encodings[0]));
+	threads = malloc(nthreads * sizeof(threads[0]));
+	q.nchunks = (nglyphs + CHUNKSIZE - 1) / CHUNKSIZE;
+	q.chunks = malloc(nargs * q.nchunks * sizeof(q.chunks[0]));
+	if (v == NULL || encodings == NULL || threads == NULL ||
+	    q.chunks == NULL) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		return 1;
 	}
+	for (k = 0; k < nargs; k++) {
+		if (parse_variant(&v[k], args[k]) != 0)
+			return 1;
+		v[k].hashes = calloc(nglyphs, sizeof(v[k].hashes[0]));
+		if (v[k].hashes == NULL) {
+			fprintf(stderr, "%s\n", strerror(errno));
+			return 1;
+		}
+	}
+	if (cachedir != NULL && mkdir(cachedir, 0777) != 0 &&
+	    errno != EEXIST) {
+		fprintf(stderr, "%s: %s\n", cachedir, strerror(errno));
+		return 1;
+	}
+	/* As in main(), so that every variant is encoded the same way. */
+	for (i = 0; i < nglyphs; i++)
+		encodings[i] = glyphs[i].unicode != -1 ? glyphs[i].unicode :
+		    65536 + extraglyphs++;
+
+	q.v = v;
+	q.nvariants = nargs;
+	q.encodings = encodings;
+	q.next = 0;
+	for (i = 0; i < nargs * q.nchunks; i++)
+		buf_init(&q.chunks[i]);
+	pthread_mutex_init(&q.lock, NULL);
+	for (started = 0; nthreads > 1 && started < nthreads; started++)
+		if (pthread_create(&threads[started], NULL,
+		    variant_worker, &q) != 0)
+			break;
+	if (started == 0)
+		variant_worker(&q);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&q.lock);
+
+	buf_init(&out);
+	for (k = 0; k < nargs && ret == 0; k++) {
+		fontinfo(&font, &v[k].param);
+		sfdheader(&out, &font, "UnicodeBmp", true);
+		buf_printf(&out, "BeginChars: %d %d\n",
+		    65536 + extraglyphs, nglyphs);
+		fd = open(v[k].sfdname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (fd == -1 || buf_write(&out, fd) != 0 ||
+		    buf_writev(&q.chunks[k * q.nchunks], q.nchunks, fd) != 0)
+			ret = 1;
+		buf_printf(&out, "EndChars\n");
+		buf_printf(&out, "EndSplineFont\n");
+		if ((ret == 0 && buf_write(&out, fd) != 0) ||
+		    (fd != -1 && close(fd) != 0))
+			ret = 1;
+		if (ret != 0)
+			fprintf(stderr, "%s: %s\n", v[k].sfdname,
+			    strerror(errno));
+		else if (cachedir != NULL &&
+		    update_manifest(&v[k].param, v[k].changedname,
+			v[k].hashes) != 0)
+			ret = 1;
+	}
+	buf_free(&out);
+	for (i = 0; i < nargs * q.nchunks; i++)
+		buf_free(&q.chunks[i]);
+	for (k = 0; k < nargs; k++)
+		free(v[k].hashes);
+	free(q.chunks);
+	free(threads);
+	free(encodings);
+	free(v);
+	return ret;
 }
 
+/* The name of the small-caps form of a glyph with the SC flag. */
 static void
-clean_path()
+scname(char *buf, size_t size, char const *name)
 {
-	int i, j;
 
-	do {
-		done_anything = 0;
-		for (i = 0; i < nextpoint; i++)
-			for (j = i+1; points[i].next && j < nextpoint; j++)
-				if (points[j].next)
-					fix_edges(&points[i], &points[j]);
-	} while (done_anything);
+	snprintf(buf, size, "%c%s.sc", tolower((unsigned char)name[0]),
+	    name + 1);
 }
 
-static void 
-emit_path()
+/*
+ * Describe the whole font, including outlines, for write_otf().  The
+ * outlines are copied out of the context, since it only keeps one.
+ */
+static int
+buildfont(struct font *font, struct bedstead_ctx *ctx)
 {
-	int i, started = 0;
-	point *p, *p1;
+	struct bedstead_outline const *o;
+	struct fontglyph *fg;
+	struct glyph const *g;
+	char const *name;
+	char sc[64];
+	size_t plen, j;
+	int i, k, r, n;
 
-	for (i = 0; i < nextpoint; i++) {
-		p = &points[i];
-		if (p->next) {
-			if (!started) printf("Fore\nSplineSet\n");
-			started = 1;
-			do {
-				printf(" %d %d %s 1\n",
-				    p->v.x, p->v.y - 3*YPIX,
-				    p == &points[i] && p->next ? "m" : "l");
-				p1 = p->next;
-				p->prev = p->next = NULL;
-				p = p1;
-			} while (p);
+	font->nglyphs = nglyphs;
+	font->glyphs = calloc(nglyphs, sizeof(font->glyphs[0]));
+	if (font->glyphs == NULL) return -1;
+	for (i = 0; i < nglyphs; i++) {
+		g = &glyphs[i];
+		fg = &font->glyphs[i];
+		name = glyphname(i);
+		plen = strlen(name) + 1;
+		fg->name = name;
+		fg->unicode = g->unicode;
+		fg->advance = XSIZE * XPIX;
+		getpalt(g, &fg->palt_dx, &fg->palt_dh);
+		fg->palt_dx *= XPIX;
+		fg->palt_dh *= XPIX;
+		for (k = 0; k < NSUBST; k++)
+			fg->subst[k] = -1;
+		r = relkey[i];
+		for (k = relstart[r]; k < relstart[r + 1]; k++)
+			for (j = 0; j < NSUBSTS; j++)
+				if (strcmp(glyphs[relatives[k]].name + plen,
+				    substs[j].suffix) == 0)
+					fg->subst[substs[j].subst] =
+					    relatives[k];
+		fg->nalts = relstart[r + 1] - relstart[r];
+		fg->alts = &relatives[relstart[r]];
+		if (g->flags & SC) {
+			scname(sc, sizeof(sc), name);
+			fg->subst[isupper((unsigned char)name[0]) ?
+			    SUBST_C2SC : SUBST_SMCP] = findglyph(sc);
 		}
+		o = bedstead_glyph(ctx, g);
+		n = o->contours[o->ncontours];
+		fg->ncontours = o->ncontours;
+		fg->contours = malloc((o->ncontours + 1) *
+		    sizeof(fg->contours[0]));
+		fg->points = malloc((n + 1) * sizeof(fg->points[0]));
+		if (fg->contours == NULL || fg->points == NULL) return -1;
+		memcpy(fg->contours, o->contours,
+		    (o->ncontours + 1) * sizeof(fg->contours[0]));
+		memcpy(fg->points, o->points, n * sizeof(fg->points[0]));
 	}
-	if (started) printf("EndSplineSet\n");
+	return 0;
 }
-		
+
 static void
-blackpixel(int x, int y, int bl, int br, int tr, int tl)
+freefont(struct font *font)
 {
-	x *= XPIX; y *= YPIX;
+	int i;
 
-	if (bl)	moveto(x, y);
-	else { moveto(x+XQTR, y); lineto(x, y+YQTR); }
-	if (tl) lineto(x, y+YPIX);
-	else { lineto(x, y+YPIX-YQTR); lineto(x+XQTR, y+YPIX); }
-	if (tr) lineto(x+XPIX, y+YPIX);
-	else { lineto(x+XPIX-XQTR, y+YPIX); lineto(x+XPIX, y+YPIX-YQTR); }
-	if (br) lineto(x+XPIX, y);
-	else { lineto(x+XPIX, y+YQTR); lineto(x+XPIX-XQTR, y); }
-	closepath();
+	if (font->glyphs == NULL) return;
+	for (i = 0; i < font->nglyphs; i++) {
+		free(font->glyphs[i].contours);
+		free(font->glyphs[i].points);
+	}
+	free(font->glyphs);
+	font->glyphs = NULL;
 }
 
-static void
-whitepixel(int x, int y, int bl, int br, int tr, int tl)
+/*
+ * Write the whole font as OpenType to stdout.  The strikes that the
+ * gasp table asks for are embedded too, but only when the pixels are
+ * square, since otherwise they'd be too narrow for the outlines.
+ */
+static int
+dootf(struct bedstead_ctx *ctx, struct font *font)
 {
-	x *= XPIX; y *= YPIX;
+	struct strike strikes[2];
+	int i, ret = 0;
 
-	if (bl) {
-		moveto(x, y); lineto(x, y+YPIX-YQTR);
-		if (br) { lineto(x+XPIX/2, y+YPIX/2-YQTR); lineto(x+XQTR, y); }
-		else lineto(x+XPIX-XQTR, y);
-		closepath();
+	font->nstrikes = 0;
+	font->strikes = strikes;
+	for (i = 0; i < 2 && ctx->param->xpix == DEFAULT_XPIX; i++) {
+		if (buildstrike(&strikes[i], font, (i + 1) * YSIZE) != 0) {
+			ret = 1;
+			break;
+		}
+		font->nstrikes++;
 	}
-	if (tl) {
-		moveto(x, y+YPIX); lineto(x+XPIX-XQTR, y+YPIX);
-		if (bl) { lineto(x+XPIX/2-XQTR, y+YPIX/2);
-			lineto(x, y+YPIX-YQTR); }
-		else lineto(x, y+YQTR);
-		closepath();
+	if (ret != 0)
+		fprintf(stderr, "%s\n", strerror(errno));
+	else if (buildfont(font, ctx) != 0) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		ret = 1;
+	} else if (write_otf(stdout, font) != 0 || fflush(stdout) != 0) {
+		fprintf(stderr, "error writing font\n");
+		ret = 1;
 	}
-	if (tr) {
-		moveto(x+XPIX, y+YPIX); lineto(x+XPIX, y+YQTR);
-		if (tl) { lineto(x+XPIX/2, y+YPIX/2+YQTR);
-			lineto(x+XPIX-XQTR, y+YPIX); }
-		else lineto(x+XQTR, y+YPIX);
-		closepath();
+	for (i = 0; i < font->nstrikes; i++)
+		free(strikes[i].glyphs);
+	font->nstrikes = 0;
+	freefont(font);
+	bedstead_free(ctx);
+	return ret;
+}
+
+/*
+ * A bitmap strike of the whole font.  The 10-pixel strike is the
+ * SAA5050's input and the 20-pixel one is its output.
+ */
+static int
+buildstrike(struct strike *s, struct font const *font, int size)
+{
+	unsigned (*rows)[2 * YSIZE];
+	int i;
+
+	s->width = XSIZE * size / YSIZE;
+	s->height = size;
+	s->ascent = font->ascent * size / (font->ascent + font->descent);
+	s->nglyphs = nglyphs;
+	s->glyphs = malloc(nglyphs * sizeof(s->glyphs[0]));
+	rows = malloc(nglyphs * sizeof(rows[0]));
+	if (s->glyphs == NULL || rows == NULL) {
+		free(s->glyphs);
+		free(rows);
+		return -1;
 	}
-	if (br) {
-		moveto(x+XPIX, y); lineto(x+XQTR, y);
-		if (tr) { lineto(x+XPIX/2+XQTR, y+YPIX/2);
-			lineto(x+XPIX, y+YQTR); }
-		else lineto(x+XPIX, y+YPIX-YQTR);
-		closepath();
+	bedstead_bitmaps(nglyphs, glyphs, size == 2 * YSIZE, rows);
+	for (i = 0; i < nglyphs; i++) {
+		s->glyphs[i].name = glyphname(i);
+		s->glyphs[i].unicode = glyphs[i].unicode;
+		memcpy(s->glyphs[i].rows, rows[i], sizeof(rows[i]));
 	}
+	free(rows);
+	return 0;
 }
 
-void
-dochar(char const data[YSIZE], unsigned flags)
+/* Write a bitmap strike of the whole font to stdout. */
+static int
+dobitmap(struct font const *font, char const *format, int size)
 {
-	int x, y;
+	struct strike s;
+	int ret;
 
-#define GETPIX(x,y) (getpix(data, (x), (y), flags))
-#define L GETPIX(x-1, y)
-#define R GETPIX(x+1, y)
-#define U GETPIX(x, y-1)
-#define D GETPIX(x, y+1)
-#define UL GETPIX(x-1, y-1)
-#define UR GETPIX(x+1, y-1)
-#define DL GETPIX(x-1, y+1)
-#define DR GETPIX(x+1, y+1)
+	if (buildstrike(&s, font, size) != 0) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		return 1;
+	}
+	if (strcmp(format, "bdf") == 0)
+		ret = write_bdf(stdout, font, &s);
+	else if (strcmp(format, "pcf") == 0)
+		ret = write_pcf(stdout, font, &s);
+	else
+		ret = write_psf2(stdout, font, &s);
+	if (ret != 0 || fflush(stdout) != 0) {
+		fprintf(stderr, "error writing font\n");
+		ret = 1;
+	}
+	free(s.glyphs);
+	return ret;
+}
 
-	clearpath();
-	for (x = 0; x < XSIZE; x++) {
-		for (y = 0; y < YSIZE; y++) {
-			if (GETPIX(x, y)) {
-				bool tl, tr, bl, br;
+/*
+ * Dwarf Fortress tilesets.  Each size is rasterised and written by
+ * whichever worker thread claims it, all sharing one set of outlines.
+ */
+struct tilequeue {
+	struct font const *font;
+	int gids[256];
+	int const *sizes;
+	int nsizes;
+	int next;
+	bool failed;
+	pthread_mutex_t lock;
+};
 
-				/* Assume filled in */
-				tl = tr = bl = br = true;
-				/* Check for diagonals */
-				if ((UL && !U && !L) || (DR && !D && !R))
-					tr = bl = false;
-				if ((UR && !U && !R) || (DL && !D && !L))
-					tl = br = false;
-				/* Avoid odd gaps */
-				if (L || UL || U) tl = true;
-				if (R || UR || U) tr = true;
-				if (L || DL || D) bl = true;
-				if (R || DR || D) br = true;
-				blackpixel(x, YSIZE - y - 1, bl, br, tr, tl);
-			} else {
-				bool tl, tr, bl, br;
+static void *
+tileset_worker(void *arg)
+{
+	struct tilequeue *q = arg;
+	char fname[64];
+	FILE *f;
+	int n;
+	bool ok;
 
-				/* Assume clear */
-				tl = tr = bl = br = false;
-				/* white pixel -- just diagonals */
-				if (L && U && !UL) tl = true;
-				if (R && U && !UR) tr = true;
-				if (L && D && !DL) bl = true;
-				if (R && D && !DR) br = true;
-				whitepixel(x, YSIZE - y - 1, bl, br, tr, tl);
-			}
+	for (;;) {
+		pthread_mutex_lock(&q->lock);
+		n = q->next++;
+		pthread_mutex_unlock(&q->lock);
+		if (n >= q->nsizes) break;
+		snprintf(fname, sizeof(fname), "bedstead-%d-df.png",
+		    q->sizes[n]);
+		f = fopen(fname, "wb");
+		ok = f != NULL;
+		if (ok && write_tileset(f, q->font, q->gids, q->sizes[n]) != 0)
+			ok = false;
+		if (f != NULL && fclose(f) != 0)
+			ok = false;
+		if (!ok) {
+			fprintf(stderr, "%s: %s\n", fname, strerror(errno));
+			pthread_mutex_lock(&q->lock);
+			q->failed = true;
+			pthread_mutex_unlock(&q->lock);
 		}
 	}
-	clean_path();
-	emit_path();
+	return NULL;
 }
 
-static void
-tile(int x0, int y0, int x1, int y1)
+static int
+dotilesets(struct bedstead_ctx *ctx, struct font *font, int nthreads,
+    int nsizes, char **args)
 {
-	x0 *= XPIX; y0 *= YPIX;
-	x1 *= XPIX; y1 *= YPIX;
-	moveto(x0, y0); lineto(x0, y1); lineto(x1, y1); lineto(x1, y0);
-	closepath();
+	struct tilequeue q;
+	pthread_t *threads;
+	int *sizes, i, started;
+	char *endptr;
+
+	sizes = malloc((nsizes + 1) * sizeof(sizes[0]));
+	threads = malloc(nthreads * sizeof(threads[0]));
+	if (sizes == NULL || threads == NULL || buildfont(font, ctx) != 0) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		return 1;
+	}
+	bedstead_free(ctx);
+	for (i = 0; i < nsizes; i++) {
+		sizes[i] = strtol(args[i], &endptr, 10);
+		if (sizes[i] < 1 || sizes[i] > 1000 || *endptr) {
+			fprintf(stderr, "invalid tileset size '%s'\n",
+			    args[i]);
+			return 1;
+		}
+	}
+	q.font = font;
+	for (i = 0; i < 256; i++) {
+		q.gids[i] = findglyph(cp437_names[i]);
+		if (q.gids[i] == -1)
+			fprintf(stderr, "no glyph called '%s'\n",
+			    cp437_names[i]);
+	}
+	q.sizes = sizes;
+	q.nsizes = nsizes;
+	q.next = 0;
+	q.failed = false;
+	pthread_mutex_init(&q.lock, NULL);
+	if (nthreads > nsizes) nthreads = nsizes;
+	for (started = 0; started < nthreads; started++)
+		if (pthread_create(&threads[started], NULL,
+		    tileset_worker, &q) != 0)
+			break;
+	if (started == 0)
+		tileset_worker(&q);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&q.lock);
+	freefont(font);
+	free(sizes);
+	free(threads);
+	return q.failed ? 1 : 0;
 }
-	
+
+/*
+ * Web font subsets.  A teletext page uses one G0 set, with one
+ * national option, and from level 1.5 the G2 set that goes with it,
+ * so a viewer only needs those characters and the mosaics.  Each
+ * subset is written to its own WOFF2 file.  Where a national option
+ * goes with a chip whose letters differ, the chip's forms take the
+ * place of the usual ones, so the subset needs no stylistic set.  The
+ * repertoires are the ones listed in NOTES.
+ */
+static int const latin_g2[96] = {
+	0x00a0, 0x00a1, 0x00a2, 0x00a3, 0x0024, 0x00a5, 0x0023, 0x00a7,
+	0x00a4, 0x2018, 0x201c, 0x00ab, 0x2190, 0x2191, 0x2192, 0x2193,
+	0x00b0, 0x00b1, 0x00b2, 0x00b3, 0x00d7, 0x00b5, 0x00b6, 0x00b7,
+	0x00f7, 0x2019, 0x201d, 0x00bb, 0x00bc, 0x00bd, 0x00be, 0x00bf,
+	0x0020, 0x02cb, 0x02ca, 0x02c6, 0x02dc, 0x02c9, 0x02d8, 0x02d9,
+	0x00a8, 0x002e, 0x02da, 0x02cf, 0x02cd, 0x02dd, 0x02db, 0x02c7,
+	0x2014, 0x00b9, 0x00ae, 0x00a9, 0x2122, 0x266a, 0x20a0, 0x2030,
+	0x0251, 0x0020, 0x0020, 0x0020, 0x215b, 0x215c, 0x215d, 0x215e,
+	0x2126, 0x00c6, 0x00d0, 0x00aa, 0x0126, 0x0020, 0x0132, 0x013f,
+	0x0141, 0x00d8, 0x0152, 0x00ba, 0x00de, 0x0166, 0x014a, 0x0149,
+	0x0138, 0x00e6, 0x0111, 0x00f0, 0x0127, 0x0131, 0x0133, 0x0140,
+	0x0142, 0x00f8, 0x0153, 0x00df, 0x00fe, 0x0167, 0x014b, 0x25a0,
+};
+
+/* Cyrillic G0 option 2 (Russian), from 0x40. */
+static int const cyrillic_g0[64] = {
+	0x042e, 0x0410, 0x0411, 0x0426, 0x0414, 0x0415, 0x0424, 0x0413,
+	0x0425, 0x0418, 0x040d, 0x041a, 0x041b, 0x041c, 0x041d, 0x041e,
+	0x041f, 0x042f, 0x0420, 0x0421, 0x0422, 0x0423, 0x0416, 0x0412,
+	0x042c, 0x042a, 0x0417, 0x0428, 0x042d, 0x0429, 0x0427, 0x042b,
+	0x044e, 0x0430, 0x0431, 0x0446, 0x0434, 0x0435, 0x0444, 0x0433,
+	0x0445, 0x0438, 0x045d, 0x043a, 0x043b, 0x043c, 0x043d, 0x043e,
+	0x043f, 0x044f, 0x0440, 0x0441, 0x0442, 0x0443, 0x0436, 0x0432,
+	0x044c, 0x044a, 0x0437, 0x0448, 0x044d, 0x0449, 0x0447, 0x25a0,
+};
+
+/* Hebrew G0, from 0x5b. */
+static int const hebrew_g0[37] = {
+	0x2190, 0x00bd, 0x2192, 0x2191, 0x0023, 0x05d0, 0x05d1, 0x05d2,
+	0x05d3, 0x05d4, 0x05d5, 0x05d6, 0x05d7, 0x05d8, 0x05d9, 0x05da,
+	0x05db, 0x05dc, 0x05dd, 0x05de, 0x05df, 0x05e0, 0x05e1, 0x05e2,
+	0x05e3, 0x05e4, 0x05e5, 0x05e6, 0x05e7, 0x05e8, 0x05e9, 0x05ea,
+	0x20aa, 0x2016, 0x00be, 0x00f7, 0x25a0,
+};
+
+static char const *const national_names[NNATIONAL] = {
+	[NATIONAL_ENGLISH] = "english", [NATIONAL_GERMAN] = "german",
+	[NATIONAL_SWEDISH] = "swedish", [NATIONAL_ITALIAN] = "italian",
+	[NATIONAL_FRENCH] = "french", [NATIONAL_SPANISH] = "spanish",
+	[NATIONAL_CZECH] = "czech",
+};
+
+/*
+ * Add a character to a subset, unless the font lacks it or the subset
+ * already has it or its glyph.
+ */
+static void
+subset_add(struct font *sub, struct font const *font, int subst, int u)
+{
+	struct fontglyph *fg;
+	int i, g = -1;
+
+	for (i = 0; i < font->nglyphs && g == -1; i++)
+		if (font->glyphs[i].unicode == u) g = i;
+	if (g == -1) return;
+	if (subst >= 0 && font->glyphs[g].subst[subst] >= 0)
+		g = font->glyphs[g].subst[subst];
+	for (i = 0; i < sub->nglyphs; i++)
+		if (sub->glyphs[i].unicode == u ||
+		    sub->glyphs[i].name == font->glyphs[g].name)
+			return;
+	fg = &sub->glyphs[sub->nglyphs++];
+	*fg = font->glyphs[g];
+	fg->unicode = u;
+	for (i = 0; i < NSUBST; i++)
+		fg->subst[i] = -1;
+	fg->nalts = 0;
+}
+
+/*
+ * Make the subset for a set of G0 characters from 0x20: ASCII apart
+ * from the Latin primary set's exceptions, then a national option's
+ * characters in the places that it changes, or a non-Latin set from
+ * 'first' on.
+ */
+static void
+subset_fill(struct font *sub, struct font const *font, int national,
+    int subst, int const *g0, int first, int n)
+{
+	int c, i, u;
+
+	sub->nglyphs = 1;
+	sub->glyphs[0] = font->glyphs[findglyph(".notdef")];
+	for (i = 0; i < NSUBST; i++)
+		sub->glyphs[0].subst[i] = -1;
+	sub->glyphs[0].nalts = 0;
+	for (c = 0x20; c < 0x80; c++) {
+		u = c == 0x24 ? 0x00a4 : c == 0x7c ? 0x00a6 :
+		    c == 0x7f ? 0x25a0 : c;
+		for (i = 0; national >= 0 && i < 13; i++)
+			if (national_codes[i] == c)
+				u = national_options[national].unicode[i];
+		if (g0 != NULL && c >= first && c < first + n)
+			u = g0[c - first];
+		subset_add(sub, font, subst, u);
+	}
+	for (i = 0; national >= 0 && i < 96; i++)
+		subset_add(sub, font, subst, latin_g2[i]);
+	for (i = 0; i < nglyphs; i++)
+		if (glyphs[i].flags & MOS)
+			subset_add(sub, font, -1, glyphs[i].unicode);
+}
+
+static int
+dosubsets(struct bedstead_ctx *ctx, struct font *font,
+    struct param const *param)
+{
+	struct font sub;
+	char fname[64];
+	char const *prefix, *name;
+	size_t j;
+	int k, subst, ret = 0;
+	FILE *f;
+
+	if (buildfont(font, ctx) != 0) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		return 1;
+	}
+	prefix = param == &default_param ? "bedstead" : "bedstead-ext";
+	bedstead_free(ctx);
+	sub = *font;
+	sub.nstrikes = 0;
+	sub.glyphs = malloc(nglyphs * sizeof(sub.glyphs[0]));
+	if (sub.glyphs == NULL) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		freefont(font);
+		return 1;
+	}
+	for (k = 0; k < NNATIONAL + 2 && ret == 0; k++) {
+		if (k < NNATIONAL) {
+			subst = -1;
+			for (j = 0; j < NSUBSTS; j++)
+				if (national_options[k].suffix != NULL &&
+				    strcmp(substs[j].suffix,
+					national_options[k].suffix) == 0)
+					subst = substs[j].subst;
+			subset_fill(&sub, font, k, subst, NULL, 0, 0);
+			name = national_names[k];
+		} else if (k == NNATIONAL) {
+			subset_fill(&sub, font, -1, -1, cyrillic_g0, 0x40, 64);
+			name = "cyrillic";
+		} else {
+			subset_fill(&sub, font, -1, -1, hebrew_g0, 0x5b, 37);
+			name = "hebrew";
+		}
+		snprintf(fname, sizeof(fname), "%s-%s.woff2", prefix, name);
+		f = fopen(fname, "wb");
+		if (f == NULL || write_woff2(f, &sub) != 0) {
+			fprintf(stderr, "%s: %s\n", fname, strerror(errno));
+			ret = 1;
+		}
+		if (f != NULL && fclose(f) != 0) {
+			fprintf(stderr, "%s: %s\n", fname, strerror(errno));
+			ret = 1;
+		}
+	}
+	free(sub.glyphs);
+	freefont(font);
+	return ret;
+}
+
+/*
+ * Benchmarks.  Each phase of glyph generation is run over the glyph
+ * table, or over a fixed corpus of random bitmaps, a number of times,
+ * and the time per glyph is reported as JSON along with, where the
+ * system allows, the CPU cycles and instructions it took.  Only the
+ * part of each phase named in its description is timed.
+ */
+
+#define BENCHCORPUS 4096
+
+struct bench {
+	int fd[2];			/* Cycles, instructions, or -1 */
+	struct timespec t0;
+	double ns;
+};
+
+static char (*benchcorpus)[YSIZE];
+
+static void
+bench_start(struct bench *b)
+{
+#ifdef __linux__
+	int i;
+
+	for (i = 0; i < 2; i++)
+		if (b->fd[i] != -1)
+			ioctl(b->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+#endif
+	clock_gettime(CLOCK_MONOTONIC, &b->t0);
+}
+
+static void
+bench_stop(struct bench *b)
+{
+	struct timespec t1;
+#ifdef __linux__
+	int i;
+#endif
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+#ifdef __linux__
+	for (i = 0; i < 2; i++)
+		if (b->fd[i] != -1)
+			ioctl(b->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+#endif
+	b->ns += (t1.tv_sec - b->t0.tv_sec) * 1e9 +
+	    (t1.tv_nsec - b->t0.tv_nsec);
+}
+
+/* Open a hardware counter for this thread, initially disabled. */
+static int
+bench_counter(unsigned long long config)
+{
+#ifdef __linux__
+	struct perf_event_attr pe;
+
+	memset(&pe, 0, sizeof(pe));
+	pe.type = PERF_TYPE_HARDWARE;
+	pe.size = sizeof(pe);
+	pe.config = config;
+	pe.disabled = 1;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+static int
+bench_char(struct bench *b, struct bedstead_ctx *ctx, struct buf *out)
+{
+	int i, n = 0;
+
+	bench_start(b);
+	for (i = 0; i < nglyphs; i++)
+		if (!(glyphs[i].flags & MOS)) {
+			bedstead_char(ctx, glyphs[i].data, glyphs[i].flags);
+			n++;
+		}
+	bench_stop(b);
+	return n;
+}
+
+static int
+bench_mosaic(struct bench *b, struct bedstead_ctx *ctx, struct buf *out)
+{
+	int i, n = 0;
+
+	bench_start(b);
+	for (i = 0; i < nglyphs; i++)
+		if (glyphs[i].flags & MOS) {
+			bedstead_glyph(ctx, &glyphs[i]);
+			n++;
+		}
+	bench_stop(b);
+	return n;
+}
+
+static int
+bench_clean(struct bench *b, struct bedstead_ctx *ctx, struct buf *out)
+{
+	int i, n = 0;
+
+	for (i = 0; i < nglyphs; i++)
+		if (!(glyphs[i].flags & MOS)) {
+			draw_char(ctx, glyphs[i].data);
+			bench_start(b);
+			clean_path(ctx);
+			bench_stop(b);
+			finish_path(ctx, 3 * YPIX);
+			n++;
+		}
+	return n;
+}
+
+static int
+bench_random(struct bench *b, struct bedstead_ctx *ctx, struct buf *out)
+{
+	int i;
+
+	bench_start(b);
+	for (i = 0; i < BENCHCORPUS; i++)
+		bedstead_char(ctx, benchcorpus[i], 0);
+	bench_stop(b);
+	return BENCHCORPUS;
+}
+
+static int
+bench_lookups(struct bench *b, struct bedstead_ctx *ctx, struct buf *out)
+{
+	int i;
+
+	out->len = 0;
+	bench_start(b);
+	for (i = 0; i < nglyphs; i++)
+		dolookups(out, ctx, &glyphs[i]);
+	bench_stop(b);
+	return nglyphs;
+}
+
+static int
+bench_sfd(struct bench *b, struct bedstead_ctx *ctx, struct buf *out)
+{
+	int i;
+
+	out->len = 0;
+	bench_start(b);
+	for (i = 0; i < nglyphs; i++)
+		genglyph(out, ctx, i, i);
+	bench_stop(b);
+	return nglyphs;
+}
+
+static struct {
+	char const *name, *description;
+	int (*run)(struct bench *, struct bedstead_ctx *, struct buf *);
+} const benchphases[] = {
+	{ "char", "bedstead_char() on each character glyph", bench_char },
+	{ "mosaic", "bedstead_glyph() on each mosaic glyph", bench_mosaic },
+	{ "clean_path", "clean_path() on each character glyph",
+	  bench_clean },
+	{ "random", "bedstead_char() on random bitmaps", bench_random },
+	{ "lookups", "dolookups() on each glyph", bench_lookups },
+	{ "sfd", "the SFD description of each glyph", bench_sfd },
+};
+#define NBENCHPHASES (sizeof(benchphases) / sizeof(benchphases[0]))
+
+static int
+dobench(struct bedstead_ctx *ctx, struct font *font, int nargs, char **args)
+{
+	static unsigned long long const configs[2] = {
+#ifdef __linux__
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+#else
+		0, 0,
+#endif
+	};
+	static char const *const counters[2] = { "cycles", "instructions" };
+	struct bench b;
+	struct buf out;
+	unsigned long long x = 88172645463325252ULL, count;
+	double *pertime, mean, var, min;
+	char *endptr;
+	int reps = 20, i, r, n = 0, y;
+	size_t p;
+
+	if (nargs > 1) {
+		fprintf(stderr, "too many arguments\n");
+		return 1;
+	}
+	if (nargs == 1) {
+		reps = strtol(args[0], &endptr, 10);
+		if (reps < 1 || *endptr) {
+			fprintf(stderr, "invalid repeat count '%s'\n",
+			    args[0]);
+			return 1;
+		}
+	}
+	/* A fixed xorshift generator, so every run sees the same corpus. */
+	benchcorpus = malloc(BENCHCORPUS * sizeof(benchcorpus[0]));
+	pertime = malloc(reps * sizeof(pertime[0]));
+	if (benchcorpus == NULL || pertime == NULL) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		return 1;
+	}
+	for (i = 0; i < BENCHCORPUS; i++)
+		for (y = 0; y < YSIZE; y++) {
+			x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+			benchcorpus[i][y] = x & ((1 << XSIZE) - 1);
+		}
+	for (i = 0; i < 2; i++)
+		b.fd[i] = bench_counter(configs[i]);
+	buf_init(&out);
+
+	printf("{\n  \"font\": \"%s\",\n  \"repeats\": %d,\n"
+	    "  \"phases\": [", font->fontname, reps);
+	for (p = 0; p < NBENCHPHASES; p++) {
+		/* One untimed run to warm the caches. */
+		b.ns = 0;
+		benchphases[p].run(&b, ctx, &out);
+#ifdef __linux__
+		for (i = 0; i < 2; i++)
+			if (b.fd[i] != -1)
+				ioctl(b.fd[i], PERF_EVENT_IOC_RESET, 0);
+#endif
+		for (r = 0; r < reps; r++) {
+			b.ns = 0;
+			n = benchphases[p].run(&b, ctx, &out);
+			pertime[r] = b.ns / n;
+		}
+		mean = min = pertime[0];
+		for (r = 1; r < reps; r++) {
+			mean += pertime[r];
+			if (pertime[r] < min) min = pertime[r];
+		}
+		mean /= reps;
+		var = 0;
+		for (r = 0; r < reps; r++)
+			var += (pertime[r] - mean) * (pertime[r] - mean);
+		var /= reps;
+		printf("%s\n    {\n      \"name\": \"%s\",\n"
+		    "      \"description\": \"%s\",\n"
+		    "      \"glyphs\": %d,\n"
+		    "      \"ns_per_glyph\": %.1f,\n"
+		    "      \"ns_per_glyph_min\": %.1f,\n"
+		    "      \"ns_per_glyph_stddev\": %.1f,\n"
+		    "      \"glyphs_per_second\": %.0f",
+		    p ? "," : "", benchphases[p].name,
+		    benchphases[p].description, n, mean, min, sqrt(var),
+		    1e9 / mean);
+		for (i = 0; i < 2; i++) {
+			printf(",\n      \"%s_per_glyph\": ", counters[i]);
+			if (b.fd[i] != -1 &&
+			    read(b.fd[i], &count, sizeof(count)) ==
+			    sizeof(count))
+				printf("%.1f", (double)count / n / reps);
+			else
+				printf("null");
+		}
+		printf("\n    }");
+	}
+	printf("\n  ]\n}\n");
+	for (i = 0; i < 2; i++)
+		if (b.fd[i] != -1) close(b.fd[i]);
+	buf_free(&out);
+	free(pertime);
+	free(benchcorpus);
+	bedstead_free(ctx);
+	if (fflush(stdout) != 0) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Checking that outlines haven't changed.  --hashes lists a hash of
+ * each glyph's outline, exactly as it would appear in the SFD, and
+ * given a list from an earlier run instead reports the glyphs whose
+ * hashes differ from it.
+ */
+static int
+dohashes(struct bedstead_ctx *ctx, int nargs, char **args)
+{
+	struct buf b;
+	unsigned long long *hash, h;
+	bool *seen;
+	char *line = NULL, *name;
+	size_t linesize = 0;
+	FILE *f;
+	int i, ndiff = 0;
+
+	if (nargs > 1) {
+		fprintf(stderr, "too many arguments\n");
+		return 1;
+	}
+	hash = malloc(nglyphs * sizeof(hash[0]));
+	seen = calloc(nglyphs, sizeof(seen[0]));
+	if (hash == NULL || seen == NULL) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		return 1;
+	}
+	buf_init(&b);
+	for (i = 0; i < nglyphs; i++) {
+		b.len = 0;
+		emit_path(&b, bedstead_glyph(ctx, &glyphs[i]));
+		hash[i] = fnv64((char *)b.data, b.len);
+	}
+	buf_free(&b);
+	bedstead_free(ctx);
+	if (nargs == 0) {
+		for (i = 0; i < nglyphs; i++)
+			printf("%016llx %s\n", hash[i], glyphname(i));
+		return fflush(stdout) != 0;
+	}
+	f = fopen(args[0], "r");
+	if (f == NULL) {
+		fprintf(stderr, "%s: %s\n", args[0], strerror(errno));
+		return 1;
+	}
+	while (getline(&line, &linesize, f) != -1) {
+		name = strchr(line, ' ');
+		if (name == NULL) continue;
+		*name++ = '\0';
+		name[strcspn(name, "\n")] = '\0';
+		h = strtoull(line, NULL, 16);
+		i = findglyph(name);
+		if (i == -1) {
+			printf("gone %s\n", name);
+			ndiff++;
+		} else {
+			seen[i] = true;
+			if (hash[i] != h) {
+				printf("changed %s\n", name);
+				ndiff++;
+			}
+		}
+	}
+	fclose(f);
+	for (i = 0; i < nglyphs; i++)
+		if (!seen[i]) {
+			printf("new %s\n", glyphname(i));
+			ndiff++;
+		}
+	fprintf(stderr, "%d glyph%s differ%s\n", ndiff,
+	    ndiff == 1 ? "" : "s", ndiff == 1 ? "s" : "");
+	free(line);
+	free(hash);
+	free(seen);
+	return ndiff != 0;
+}
+
+/*
+ * The reference engine.  This is the outline algorithm as it stood
+ * before any of it was optimised: each pixel's neighbours are looked
+ * up one by one, each vertex is worked out from the pixel size, and
+ * every pair of edges is tried in turn when cleaning up.  It has its
+ * own copies of the path-building and tidying-up functions too, so
+ * that a change to the real engine's can't change both sides of the
+ * comparison.  Don't change it to keep up with optimisations: that's
+ * what it's for.
+ */
+static int
+ref_getpix(char const data[YSIZE], int x, int y)
+{
+
+	if (x < 0 || x >= XSIZE || y < 0 || y >= YSIZE)
+		return 0;
+	else
+		return (data[y] >> (XSIZE - x - 1)) & 1;
+}
+
+static void
+ref_moveto(struct bedstead_ctx *ctx, unsigned x, unsigned y)
+{
+	struct point *p;
+
+	assert(ctx->nextpoint < ctx->size);
+	p = &ctx->points[ctx->nextpoint++];
+
+	p->v.x = x; p->v.y = y;
+	p->next = p->prev = NULL;
+}
+
+static void
+ref_lineto(struct bedstead_ctx *ctx, unsigned x, unsigned y)
+{
+	struct point *p;
+
+	assert(ctx->nextpoint < ctx->size);
+	p = &ctx->points[ctx->nextpoint++];
+
+	p->v.x = x; p->v.y = y;
+	p->next = NULL;
+	p->prev = p - 1;
+	p->prev->next = p;
+}
+
+static void
+ref_closepath(struct bedstead_ctx *ctx)
+{
+	struct point *p = &ctx->points[ctx->nextpoint - 1];
+
+	while (p->prev) p--;
+	p->prev = ctx->points + ctx->nextpoint - 1;
+	ctx->points[ctx->nextpoint - 1].next = p;
+}
+
+static void
+ref_killpoint(point *p)
+{
+
+	p->prev->next = p->next;
+	p->next->prev = p->prev;
+	p->next = p->prev = NULL;
+}
+
+static int
+ref_vec_eqp(vec v1, vec v2)
+{
+	return v1.x == v2.x && v1.y == v2.y;
+}
+
+static vec
+ref_vec_sub(vec v1, vec v2)
+{
+	vec ret;
+	ret.x = v1.x - v2.x; ret.y = v1.y - v2.y;
+	return ret;
+}
+
+static int
+ref_gcd(int a, int b)
+{
+	int t;
+	while (b != 0) {
+		t = b;
+		b = a % b;
+		a = t;
+	}
+	return a;
+}
+
+static vec
+ref_vec_bearing(vec v)
+{
+	vec ret;
+	int d = ref_gcd(abs(v.x), abs(v.y));
+	if (d != 0) {
+		ret.x = v.x / d;
+		ret.y = v.y / d;
+	} else {
+		ret.x = 0;
+		ret.y = 0;
+	}
+	return ret;
+}
+
+static void
+ref_fix_identical(point *p)
+{
+	if (!p->next) return;
+	if (ref_vec_eqp(p->next->v, p->v))
+		ref_killpoint(p);
+}
+
+static int
+ref_vec_inline3(vec a, vec b, vec c)
+{
+	vec const zero = { 0, 0 };
+
+	return
+	    ref_vec_eqp(ref_vec_bearing(ref_vec_sub(b, a)),
+		ref_vec_bearing(ref_vec_sub(c, b))) &&
+	    !ref_vec_eqp(ref_vec_bearing(ref_vec_sub(b, a)), zero);
+}
+
+static int
+ref_vec_inline4(vec a, vec b, vec c, vec d)
+{
+	return ref_vec_inline3(a, b, c) && ref_vec_inline3(b, c, d);
+}
+
+static void
+ref_fix_collinear(point *p)
+{
+	if (!p->next) return;
+	if (ref_vec_inline3(p->prev->v, p->v, p->next->v))
+		ref_killpoint(p);
+}
+
+static void
+ref_fix_isolated(point *p)
+{
+	if (p->next == p)
+		ref_killpoint(p);
+}
+
+static void
+ref_fix_edges(struct bedstead_ctx *ctx, point *a0, point *b0)
+{
+	point *a1 = a0->next, *b1 = b0->next;
+
+	assert(a1->prev == a0); assert(b1->prev == b0);
+	assert(a0 != a1); assert(a0 != b0);
+	assert(a1 != b1); assert(b0 != b1);
+	if (ref_vec_eqp(ref_vec_bearing(ref_vec_sub(a0->v, a1->v)),
+		    ref_vec_bearing(ref_vec_sub(b1->v, b0->v))) &&
+	    (ref_vec_inline4(a0->v, b1->v, a1->v, b0->v) ||
+	     ref_vec_inline4(a0->v, b1->v, b0->v, a1->v) ||
+	     ref_vec_inline4(b1->v, a0->v, b0->v, a1->v) ||
+	     ref_vec_inline4(b1->v, a0->v, a1->v, b0->v) ||
+	     ref_vec_eqp(a0->v, b1->v) || ref_vec_eqp(a1->v, b0->v))) {
+		a0->next = b1; b1->prev = a0;
+		b0->next = a1; a1->prev = b0;
+		ref_fix_isolated(a0);
+		ref_fix_identical(a0);
+		ref_fix_collinear(b1);
+		ref_fix_isolated(b0);
+		ref_fix_identical(b0);
+		ref_fix_collinear(a1);
+		ctx->done_anything = 1;
+	}
+}
+
+static struct bedstead_outline const *
+ref_finish_path(struct bedstead_ctx *ctx, int yoff)
+{
+	int i, n = 0, nc = 0;
+	point *p, *p1;
+
+	for (i = 0; i < ctx->nextpoint; i++) {
+		p = &ctx->points[i];
+		if (p->next) {
+			ctx->contours[nc++] = n;
+			do {
+				ctx->opoints[n].x = p->v.x;
+				ctx->opoints[n].y = p->v.y - yoff;
+				n++;
+				p1 = p->next;
+				p->prev = p->next = NULL;
+				p = p1;
+			} while (p->next);
+		}
+	}
+	ctx->contours[nc] = n;
+	ctx->outline.ncontours = nc;
+	return &ctx->outline;
+}
+
+static void
+ref_blackpixel(struct bedstead_ctx *ctx,
+    int x, int y, int bl, int br, int tr, int tl)
+{
+	x *= XPIX; y *= YPIX;
+
+	if (bl)	ref_moveto(ctx, x, y);
+	else { ref_moveto(ctx, x+XQTR, y); ref_lineto(ctx, x, y+YQTR); }
+	if (tl) ref_lineto(ctx, x, y+YPIX);
+	else { ref_lineto(ctx, x, y+YPIX-YQTR);
+		ref_lineto(ctx, x+XQTR, y+YPIX); }
+	if (tr) ref_lineto(ctx, x+XPIX, y+YPIX);
+	else { ref_lineto(ctx, x+XPIX-XQTR, y+YPIX);
+		ref_lineto(ctx, x+XPIX, y+YPIX-YQTR); }
+	if (br) ref_lineto(ctx, x+XPIX, y);
+	else { ref_lineto(ctx, x+XPIX, y+YQTR);
+		ref_lineto(ctx, x+XPIX-XQTR, y); }
+	ref_closepath(ctx);
+}
+
+static void
+ref_whitepixel(struct bedstead_ctx *ctx,
+    int x, int y, int bl, int br, int tr, int tl)
+{
+	x *= XPIX; y *= YPIX;
+
+	if (bl) {
+		ref_moveto(ctx, x, y); ref_lineto(ctx, x, y+YPIX-YQTR);
+		if (br) { ref_lineto(ctx, x+XPIX/2, y+YPIX/2-YQTR);
+			ref_lineto(ctx, x+XQTR, y); }
+		else ref_lineto(ctx, x+XPIX-XQTR, y);
+		ref_closepath(ctx);
+	}
+	if (tl) {
+		ref_moveto(ctx, x, y+YPIX);
+		ref_lineto(ctx, x+XPIX-XQTR, y+YPIX);
+		if (bl) { ref_lineto(ctx, x+XPIX/2-XQTR, y+YPIX/2);
+			ref_lineto(ctx, x, y+YPIX-YQTR); }
+		else ref_lineto(ctx, x, y+YQTR);
+		ref_closepath(ctx);
+	}
+	if (tr) {
+		ref_moveto(ctx, x+XPIX, y+YPIX);
+		ref_lineto(ctx, x+XPIX, y+YQTR);
+		if (tl) { ref_lineto(ctx, x+XPIX/2, y+YPIX/2+YQTR);
+			ref_lineto(ctx, x+XPIX-XQTR, y+YPIX); }
+		else ref_lineto(ctx, x+XQTR, y+YPIX);
+		ref_closepath(ctx);
+	}
+	if (br) {
+		ref_moveto(ctx, x+XPIX, y); ref_lineto(ctx, x+XQTR, y);
+		if (tr) { ref_lineto(ctx, x+XPIX/2+XQTR, y+YPIX/2);
+			ref_lineto(ctx, x+XPIX, y+YQTR); }
+		else ref_lineto(ctx, x+XPIX, y+YPIX-YQTR);
+		ref_closepath(ctx);
+	}
+}
+
+static void
+ref_clean_path(struct bedstead_ctx *ctx)
+{
+	int i, j;
+	point *points = ctx->points;
+
+	do {
+		ctx->done_anything = 0;
+		for (i = 0; i < ctx->nextpoint; i++)
+			for (j = i+1; points[i].next && j < ctx->nextpoint;
+			     j++)
+				if (points[j].next)
+					ref_fix_edges(ctx, &points[i],
+					    &points[j]);
+	} while (ctx->done_anything);
+}
+
+static struct bedstead_outline const *
+ref_char(struct bedstead_ctx *ctx, char const data[YSIZE])
+{
+	int x, y;
+
+#define GETPIX(x,y) (ref_getpix(data, (x), (y)))
+#define L GETPIX(x-1, y)
+#define R GETPIX(x+1, y)
+#define U GETPIX(x, y-1)
+#define D GETPIX(x, y+1)
+#define UL GETPIX(x-1, y-1)
+#define UR GETPIX(x+1, y-1)
+#define DL GETPIX(x-1, y+1)
+#define DR GETPIX(x+1, y+1)
+
+	ctx->nextpoint = 0;
+	for (x = 0; x < XSIZE; x++) {
+		for (y = 0; y < YSIZE; y++) {
+			if (GETPIX(x, y)) {
+				bool tl, tr, bl, br;
+
+				/* Assume filled in */
+				tl = tr = bl = br = true;
+				/* Check for diagonals */
+				if ((UL && !U && !L) || (DR && !D && !R))
+					tr = bl = false;
+				if ((UR && !U && !R) || (DL && !D && !L))
+					tl = br = false;
+				/* Avoid odd gaps */
+				if (L || UL || U) tl = true;
+				if (R || UR || U) tr = true;
+				if (L || DL || D) bl = true;
+				if (R || DR || D) br = true;
+				ref_blackpixel(ctx, x, YSIZE - y - 1,
+				    bl, br, tr, tl);
+			} else {
+				bool tl, tr, bl, br;
+
+				/* Assume clear */
+				tl = tr = bl = br = false;
+				/* white pixel -- just diagonals */
+				if (L && U && !UL) tl = true;
+				if (R && U && !UR) tr = true;
+				if (L && D && !DL) bl = true;
+				if (R && D && !DR) br = true;
+				ref_whitepixel(ctx, x, YSIZE - y - 1,
+				    bl, br, tr, tl);
+			}
+		}
+	}
+#undef GETPIX
+#undef L
+#undef R
+#undef U
+#undef D
+#undef UL
+#undef UR
+#undef DL
+#undef DR
+	ref_clean_path(ctx);
+	return ref_finish_path(ctx, 3 * YPIX);
+}
+
+/*
+ * Differential testing.  Random bitmaps are run through both the real
+ * engine and the reference one, and the first bitmap on which they
+ * disagree is reported.  Bitmap n is a function of the seed and n
+ * alone, so a failure can be reproduced with any number of threads.
+ */
+
+#define DIFFBLOCK 1024
+
+struct diffqueue {
+	struct param const *param;
+	unsigned long long seed;
+	long count, next;
+	long first;			/* First disagreement, or -1 */
+	bool failed;
+	pthread_mutex_t lock;
+};
+
+static bool
+outline_eqp(struct bedstead_outline const *a,
+    struct bedstead_outline const *b)
+{
+	int n = a->contours[a->ncontours];
+
+	return a->ncontours == b->ncontours &&
+	    memcmp(a->contours, b->contours,
+		(a->ncontours + 1) * sizeof(a->contours[0])) == 0 &&
+	    memcmp(a->points, b->points, n * sizeof(a->points[0])) == 0;
+}
+
+/* splitmix64, to turn a seed and an index into a bitmap. */
+static void
+diff_bitmap(unsigned long long seed, long n, char data[YSIZE])
+{
+	unsigned long long x = seed + (unsigned long long)n *
+	    0x9e3779b97f4a7c15ULL, r[2];
+	int i, y;
+
+	for (i = 0; i < 2; i++) {
+		x += 0x9e3779b97f4a7c15ULL;
+		r[i] = x;
+		r[i] = (r[i] ^ (r[i] >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		r[i] = (r[i] ^ (r[i] >> 27)) * 0x94d049bb133111ebULL;
+		r[i] ^= r[i] >> 31;
+	}
+	/* Vary the density, so sparse and dense glyphs both turn up. */
+	for (y = 0; y < YSIZE; y++) {
+		data[y] = r[0] >> (6 * y) & 077;
+		if (n % 3 == 1) data[y] &= r[1] >> (6 * y);
+		if (n % 3 == 2) data[y] |= r[1] >> (6 * y);
+		data[y] &= 077;
+	}
+}
+
+static void *
+diff_worker(void *arg)
+{
+	struct diffqueue *q = arg;
+	struct bedstead_ctx *ctx, *ref;
+	char data[YSIZE];
+	long n, start;
+
+	ctx = bedstead_new(q->param);
+	ref = bedstead_new(q->param);
+	if (ctx == NULL || ref == NULL) {
+		pthread_mutex_lock(&q->lock);
+		q->failed = true;
+		pthread_mutex_unlock(&q->lock);
+	}
+	for (;;) {
+		pthread_mutex_lock(&q->lock);
+		start = q->next;
+		q->next += DIFFBLOCK;
+		if (q->failed || q->first != -1) start = q->count;
+		pthread_mutex_unlock(&q->lock);
+		if (start >= q->count) break;
+		/* Finish the block, so that the lowest failure is found. */
+		for (n = start; n < start + DIFFBLOCK && n < q->count; n++) {
+			diff_bitmap(q->seed, n, data);
+			if (!outline_eqp(bedstead_char(ctx, data, 0),
+			    ref_char(ref, data))) {
+				pthread_mutex_lock(&q->lock);
+				if (q->first == -1 || n < q->first)
+					q->first = n;
+				pthread_mutex_unlock(&q->lock);
+				break;
+			}
+		}
+	}
+	if (ctx) bedstead_free(ctx);
+	if (ref) bedstead_free(ref);
+	return NULL;
+}
+
+static int
+dodifferential(struct param const *param, int nthreads, int nargs,
+    char **args)
+{
+	struct diffqueue q;
+	struct bedstead_ctx *ctx;
+	struct buf b;
+	pthread_t *threads;
+	char data[YSIZE], *endptr;
+	int i, started;
+
+	q.param = param;
+	q.count = 1000000;
+	q.seed = 1;
+	if (nargs > 2) {
+		fprintf(stderr, "too many arguments\n");
+		return 1;
+	}
+	if (nargs > 0) {
+		q.count = strtol(args[0], &endptr, 10);
+		if (q.count < 1 || *endptr) {
+			fprintf(stderr, "invalid count '%s'\n", args[0]);
+			return 1;
+		}
+	}
+	if (nargs > 1) {
+		q.seed = strtoull(args[1], &endptr, 0);
+		if (*endptr) {
+			fprintf(stderr, "invalid seed '%s'\n", args[1]);
+			return 1;
+		}
+	}
+	q.next = 0;
+	q.first = -1;
+	q.failed = false;
+	threads = malloc(nthreads * sizeof(threads[0]));
+	if (threads == NULL) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		return 1;
+	}
+	pthread_mutex_init(&q.lock, NULL);
+	for (started = 0; started < nthreads; started++)
+		if (pthread_create(&threads[started], NULL,
+		    diff_worker, &q) != 0)
+			break;
+	if (started == 0)
+		diff_worker(&q);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&q.lock);
+	free(threads);
+	if (q.failed) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	if (q.first == -1) {
+		printf("%ld bitmaps agree\n", q.count);
+		return fflush(stdout) != 0;
+	}
+	diff_bitmap(q.seed, q.first, data);
+	printf("bitmap %ld differs:", q.first);
+	for (i = 0; i < YSIZE; i++)
+		printf(" %d", data[i]);
+	ctx = bedstead_new(param);
+	if (ctx == NULL) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		return 1;
+	}
+	buf_init(&b);
+	buf_puts(&b, "\nengine:\n");
+	emit_path(&b, bedstead_char(ctx, data, 0));
+	buf_puts(&b, "reference:\n");
+	emit_path(&b, ref_char(ctx, data));
+	fflush(stdout);
+	buf_write(&b, STDOUT_FILENO);
+	buf_free(&b);
+	bedstead_free(ctx);
+	return 1;
+}
+
+/*
+ * Checking that outlines are as simple as they can be.  clean_path()
+ * is meant to leave exactly the union of a glyph's pixels, in which
+ * case no point can go without changing the filled area: none lies
+ * on a straight line through its neighbours, and no two edges cross
+ * or overlap.  --minimal counts the points that an exact
+ * simplification could still remove, and reports any glyph that has
+ * some or whose edges cross or overlap.
+ */
+static long long
+vec_cross3(struct bedstead_vec o, struct bedstead_vec a, struct bedstead_vec b)
+{
+
+	return (long long)(a.x - o.x) * (b.y - o.y) -
+	    (long long)(a.y - o.y) * (b.x - o.x);
+}
+
+static long long
+vec_dot3(struct bedstead_vec o, struct bedstead_vec a, struct bedstead_vec b)
+{
+
+	return (long long)(a.x - o.x) * (b.x - o.x) +
+	    (long long)(a.y - o.y) * (b.y - o.y);
+}
+
+/*
+ * The points of a contour that are corners, once repeated points,
+ * points in straight lines and the tips of zero-width spikes are
+ * gone.  A contour with fewer than three has no area at all.
+ */
+static int
+contour_corners(struct bedstead_vec *v, int n)
+{
+	bool changed;
+	int i;
+
+	do {
+		changed = false;
+		for (i = 0; i < n; i++)
+			if (vec_cross3(v[(i + n - 1) % n], v[i],
+			    v[(i + 1) % n]) == 0) {
+				memmove(v + i, v + i + 1,
+				    (n - i - 1) * sizeof(v[0]));
+				n--;
+				i--;
+				changed = true;
+			}
+	} while (changed && n > 0);
+	return n < 3 ? 0 : n;
+}
+
+/* Edges that cross, or run along each other, in a whole outline. */
+static void
+outline_clashes(struct bedstead_outline const *o, int *overlaps,
+    int *crossings)
+{
+	struct bedstead_vec p, q, r, s;
+	long long d1, d2, d3, d4, len, tr, ts;
+	int c, d, i, j, n = o->contours[o->ncontours];
+
+	*overlaps = *crossings = 0;
+	for (c = 0; c < o->ncontours; c++)
+	for (i = o->contours[c]; i < o->contours[c + 1]; i++) {
+		p = o->points[i];
+		q = o->points[i + 1 < o->contours[c + 1] ? i + 1 :
+		    o->contours[c]];
+		len = vec_dot3(p, q, q);
+		for (d = c, j = i + 1; j < n; j++) {
+			while (j >= o->contours[d + 1]) d++;
+			r = o->points[j];
+			s = o->points[j + 1 < o->contours[d + 1] ? j + 1 :
+			    o->contours[d]];
+			d1 = vec_cross3(r, s, p); d2 = vec_cross3(r, s, q);
+			d3 = vec_cross3(p, q, r); d4 = vec_cross3(p, q, s);
+			if (d3 == 0 && d4 == 0) {
+				/* On the same line: do they share a length? */
+				tr = vec_dot3(p, q, r);
+				ts = vec_dot3(p, q, s);
+				if ((tr < ts ? tr : ts) < len &&
+				    (tr > ts ? tr : ts) > 0)
+					(*overlaps)++;
+			} else if (((d1 < 0 && d2 > 0) || (d1 > 0 && d2 < 0)) &&
+			    ((d3 < 0 && d4 > 0) || (d3 > 0 && d4 < 0)))
+				(*crossings)++;
+		}
+	}
+}
+
+static int
+dominimal(struct bedstead_ctx *ctx, int nargs)
+{
+	struct bedstead_outline const *o;
+	struct bedstead_vec *v = NULL, *nv;
+	long points = 0, minimal = 0;
+	int i, c, n, size = 0, corners, overlaps, crossings, nbad = 0;
+
+	if (nargs > 0) {
+		fprintf(stderr, "too many arguments\n");
+		return 1;
+	}
+	for (i = 0; i < nglyphs; i++) {
+		o = bedstead_glyph(ctx, &glyphs[i]);
+		n = o->contours[o->ncontours];
+		if (n > size) {
+			nv = realloc(v, n * sizeof(v[0]));
+			if (nv == NULL) {
+				fprintf(stderr, "%s\n", strerror(errno));
+				free(v);
+				return 1;
+			}
+			v = nv;
+			size = n;
+		}
+		corners = 0;
+		for (c = 0; c < o->ncontours; c++) {
+			memcpy(v, o->points + o->contours[c],
+			    (o->contours[c + 1] - o->contours[c]) *
+			    sizeof(v[0]));
+			corners += contour_corners(v,
+			    o->contours[c + 1] - o->contours[c]);
+		}
+		outline_clashes(o, &overlaps, &crossings);
+		points += n;
+		minimal += corners;
+		if (corners < n || overlaps || crossings) {
+			printf("%s: %d points, %d minimal, %d overlapping "
+			    "and %d crossing edges\n", glyphname(i), n, corners,
+			    overlaps, crossings);
+			nbad++;
+		}
+	}
+	printf("%d glyphs, %ld points, %ld minimal, %ld removable\n",
+	    nglyphs, points, minimal, points - minimal);
+	free(v);
+	bedstead_free(ctx);
+	if (fflush(stdout) != 0) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		return 1;
+	}
+	return nbad > 0;
+}
+
+static void
+emit_path(struct buf *b, struct bedstead_outline const *o)
+{
+	int i, j;
+
+	if (o->ncontours == 0) return;
+	buf_puts(b, "Fore\nSplineSet\n");
+	for (i = 0; i < o->ncontours; i++) {
+		for (j = o->contours[i]; j < o->contours[i + 1]; j++) {
+			buf_put8(b, ' ');
+			buf_putdec(b, o->points[j].x);
+			buf_put8(b, ' ');
+			buf_putdec(b, o->points[j].y);
+			buf_puts(b, j == o->contours[i] ? " m 1\n" : " l 1\n");
+		}
+		j = o->contours[i];
+		buf_put8(b, ' ');
+		buf_putdec(b, o->points[j].x);
+		buf_put8(b, ' ');
+		buf_putdec(b, o->points[j].y);
+		buf_puts(b, " l 1\n");
+	}
+	buf_puts(b, "EndSplineSet\n");
+}
+
+/*
+ * Parse a bitmap given as up to YSIZE numbers, one per row, in any
+ * base that strtoul() understands.  Missing rows are blank.
+ */
+static int
+parse_bitmap(int n, char **words, char data[YSIZE], char *err, size_t errlen)
+{
+	int i;
+	unsigned long u;
+	char *endptr;
+
+	memset(data, 0, YSIZE);
+	for (i = 0; i < n; i++) {
+		if (i >= YSIZE) {
+			snprintf(err, errlen, "too many arguments");
+			return -1;
+		}
+		u = strtoul(words[i], &endptr, 0);
+		if (u > 077 || !words[i] || *endptr) {
+			snprintf(err, errlen, "invalid argument \"%s\"",
+			    words[i]);
+			return -1;
+		}
+		data[i] = u;
+	}
+	return 0;
+}
+
+/*
+ * Batch mode.  Each line of input describes one glyph, either in the
+ * same form as the command-line arguments, optionally followed by a
+ * name and flags:
+ *
+ *   4 12 21 21 37 21 21 A SC
+ *
+ * or in the form used by the glyph table above, which is also what
+ * the editor prints:
+ *
+ *   {{004,012,021,021,037,021,021,000,000}, 0x0041, "A", SC },
+ *
+ * Blank lines and comments are ignored.  Each glyph's outline is
+ * written in the same form as the single-glyph output, between
+ * StartChar and EndChar lines.
+ */
+
+/* Parse flags like "SC|MOS". */
+static int
+parse_flags(char *word, unsigned *flags, char *err, size_t errlen)
+{
+	char *flag, *save;
+
+	for (flag = strtok_r(word, "|", &save); flag;
+	     flag = strtok_r(NULL, "|", &save)) {
+		if (strcmp(flag, "SC") == 0)
+			*flags |= SC;
+		else if (strcmp(flag, "MOS") == 0)
+			*flags |= MOS;
+		else if (strcmp(flag, "0") != 0) {
+			snprintf(err, errlen, "unknown flag \"%s\"", flag);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Parse one line of batch input into g and name.  Returns 1 for a
+ * glyph, 0 for a line with nothing on it, and -1 for an error.
+ */
+static int
+parse_glyph_line(char *line, struct glyph *g, char *name, size_t namelen,
+    char *err, size_t errlen)
+{
+	char *words[YSIZE + 1], *word, *save, *end, *p;
+	bool table;
+	int n = 0;
+
+	memset(g, 0, sizeof(*g));
+	g->unicode = -1;
+	name[0] = '\0';
+	if ((p = strstr(line, "/*")) != NULL) *p = '\0';
+	if ((p = strchr(line, '#')) != NULL) *p = '\0';
+	line += strspn(line, " \t\r\n");
+	/* This also skips the middles of block comments. */
+	if (*line == '\0' || *line == '*')
+		return 0;
+	table = (p = strstr(line, "{{")) != NULL;
+	if (table) {
+		/* The rows are between the braces, separated by commas. */
+		line = p + 2;
+		end = strchr(line, '}');
+		if (end == NULL) {
+			snprintf(err, errlen, "missing \"}\"");
+			return -1;
+		}
+		*end++ = '\0';
+		for (word = strtok_r(line, ", \t", &save);
+		     word && n <= YSIZE;
+		     word = strtok_r(NULL, ", \t", &save))
+			words[n++] = word;
+		if (parse_bitmap(n, words, g->data, err, errlen))
+			return -1;
+		line = end;
+		for (p = line; *p; p++)
+			if (*p == ',' || *p == '}') *p = ' ';
+	}
+	n = 0;
+	for (word = strtok_r(line, " \t\r\n", &save); word;
+	     word = strtok_r(NULL, " \t\r\n", &save)) {
+		if (!table && isdigit((unsigned char)word[0])) {
+			if (n > YSIZE || *name) {
+				snprintf(err, errlen, "unexpected \"%s\"",
+				    word);
+				return -1;
+			}
+			words[n++] = word;
+		} else if (table && n++ == 0) {
+			/* The editor leaves the code point as "0x". */
+			if (strcmp(word, "0x") != 0 &&
+			    strcmp(word, "-1") != 0) {
+				g->unicode = strtol(word, &end, 0);
+				if (*end || g->unicode < 0) {
+					snprintf(err, errlen,
+					    "invalid code point \"%s\"", word);
+					return -1;
+				}
+			}
+		} else if (*name == '\0' && (table ? word[0] == '"' : true)) {
+			if (word[0] == '"') {
+				word++;
+				end = strchr(word, '"');
+				if (end) *end = '\0';
+			}
+			snprintf(name, namelen, "%s", word);
+		} else if (parse_flags(word, &g->flags, err, errlen))
+			return -1;
+	}
+	if (!table && parse_bitmap(n, words, g->data, err, errlen))
+		return -1;
+	return 1;
+}
+
+static int
+dobatch(struct bedstead_ctx *ctx, FILE *in, char const *fname)
+{
+	struct glyph g;
+	struct buf out;
+	char *line = NULL, name[64], err[80];
+	size_t linesize = 0;
+	int lineno = 0, count = 0, ret = 0;
+
+	buf_init(&out);
+
+	while (getline(&line, &linesize, in) != -1) {
+		lineno++;
+		switch (parse_glyph_line(line, &g, name, sizeof(name),
+			err, sizeof(err))) {
+		case 0:
+			continue;
+		case -1:
+			fprintf(stderr, "%s:%d: %s\n", fname, lineno, err);
+			ret = 1;
+			continue;
+		}
+		if (*name)
+			buf_printf(&out, "StartChar: %s\n", name);
+		else if (g.unicode != -1) {
+			snprintf(name, sizeof(name), "uni%04X",
+			    (unsigned)g.unicode);
+			buf_printf(&out, "StartChar: %s\n", name);
+		} else
+			buf_printf(&out, "StartChar: glyph%d\n", count);
+		emit_path(&out, bedstead_glyph(ctx, &g));
+		buf_printf(&out, "EndChar\n");
+		count++;
+		if (out.len >= OUTBUFSIZE && buf_write(&out, STDOUT_FILENO))
+			break;
+	}
+	free(line);
+	if (ferror(in)) {
+		fprintf(stderr, "%s: %s\n", fname, strerror(errno));
+		ret = 1;
+	}
+	if (buf_write(&out, STDOUT_FILENO) != 0) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		ret = 1;
+	}
+	buf_free(&out);
+	return ret;
+}
+
+/*
+ * Importing BDF fonts.  Each pixel of a glyph's bitmap becomes a pixel
+ * of the outline, rounded just as Bedstead's own glyphs are, and the
+ * glyphs keep their names and encodings.  Reading the file is serial,
+ * but every glyph can be outlined on its own, so that's shared between
+ * threads in chunks as in doglyphs_parallel().  Names and encodings
+ * are checked for clashes with hash tables, so the whole thing takes
+ * time in proportion to the size of the font.
+ */
+
+struct bdfglyph {
+	char *name;		/* NULL until one has been chosen */
+	int encoding;		/* -1 if unencoded */
+	int unicode;
+	int advance;		/* In pixels */
+	int width, height, xoff, yoff;
+	unsigned char *bits;	/* Rows of (width + 7) / 8 bytes */
+};
+
+struct bdffont {
+	char *family, *face, *weight, *copyright, *registry, *encoding;
+	char fontname[64];
+	int ascent, descent;	/* In pixels, or -1 if not given */
+	int nglyphs, size;
+	struct bdfglyph *glyphs;
+};
+
+/* The value of a property, without any quotes. */
+static char *
+bdf_string(char const *p)
+{
+	char *s, *q;
+
+	if (*p != '"')
+		return strdup(p);
+	s = q = strdup(p + 1);
+	if (s == NULL) return NULL;
+	for (p = s; *p; p++) {
+		/* A quote is doubled inside a string. */
+		if (*p == '"' && *++p != '"') break;
+		*q++ = *p;
+	}
+	*q = '\0';
+	return s;
+}
+
+/* Read one row of a glyph's bitmap from hexadecimal. */
+static int
+bdf_row(char const *p, unsigned char *row, int len)
+{
+	int i, k, v;
+
+	for (i = 0; i < 2 * len && p[i]; i++) {
+		if (!isxdigit((unsigned char)p[i])) return -1;
+		v = isdigit((unsigned char)p[i]) ? p[i] - '0' :
+		    tolower((unsigned char)p[i]) - 'a' + 10;
+		k = i / 2;
+		row[k] |= i % 2 ? v : v << 4;
+	}
+	return 0;
+}
+
+static void
+bdf_free(struct bdffont *bdf)
+{
+	int i;
+
+	for (i = 0; i < bdf->nglyphs; i++) {
+		free(bdf->glyphs[i].name);
+		free(bdf->glyphs[i].bits);
+	}
+	free(bdf->glyphs);
+	free(bdf->family); free(bdf->face); free(bdf->weight);
+	free(bdf->copyright); free(bdf->registry); free(bdf->encoding);
+}
+
+static int
+read_bdf(FILE *in, char const *fname, struct bdffont *bdf)
+{
+	struct bdfglyph *g = NULL, *ng;
+	char *line = NULL, *key, *args, **prop;
+	size_t linesize = 0;
+	int lineno = 0, row = -1, stride = 0, n;
+	bool ended = false;
+	int fbb[4] = { 0, 0, 0, 0 }, dwidth = -1;
+	char const *err = NULL;
+
+	memset(bdf, 0, sizeof(*bdf));
+	bdf->ascent = bdf->descent = -1;
+	while (err == NULL && getline(&line, &linesize, in) != -1) {
+		lineno++;
+		line[strcspn(line, "\r\n")] = '\0';
+		key = line + strspn(line, " \t");
+		args = key + strcspn(key, " \t");
+		if (*args) *args++ = '\0';
+		args += strspn(args, " \t");
+		if (row >= 0) {
+			if (strcmp(key, "ENDCHAR") == 0) {
+				g = NULL;
+				row = -1;
+			} else if (row < g->height &&
+			    bdf_row(key, g->bits + row++ * stride, stride))
+				err = "bad bitmap row";
+			continue;
+		}
+		if (g == NULL) {
+			prop = NULL;
+			if (strcmp(key, "STARTCHAR") == 0) {
+				if (bdf->nglyphs == bdf->size) {
+					n = bdf->size ? 2 * bdf->size : 256;
+					ng = realloc(bdf->glyphs,
+					    n * sizeof(ng[0]));
+					if (ng == NULL) goto nomem;
+					bdf->glyphs = ng;
+					bdf->size = n;
+				}
+				g = &bdf->glyphs[bdf->nglyphs++];
+				memset(g, 0, sizeof(*g));
+				if (*args && (g->name = strdup(args)) == NULL)
+					goto nomem;
+				g->encoding = g->unicode = -1;
+				g->advance = dwidth >= 0 ? dwidth : fbb[0];
+				g->width = fbb[0]; g->height = fbb[1];
+				g->xoff = fbb[2]; g->yoff = fbb[3];
+			} else if (strcmp(key, "FONTBOUNDINGBOX") == 0) {
+				if (sscanf(args, "%d %d %d %d", &fbb[0],
+				    &fbb[1], &fbb[2], &fbb[3]) != 4 ||
+				    fbb[0] < 0 || fbb[1] < 0)
+					err = "bad FONTBOUNDINGBOX";
+			} else if (strcmp(key, "DWIDTH") == 0) {
+				if (sscanf(args, "%d", &dwidth) != 1)
+					err = "bad DWIDTH";
+			} else if (strcmp(key, "FONT_ASCENT") == 0) {
+				if (sscanf(args, "%d", &bdf->ascent) != 1)
+					err = "bad FONT_ASCENT";
+			} else if (strcmp(key, "FONT_DESCENT") == 0) {
+				if (sscanf(args, "%d", &bdf->descent) != 1)
+					err = "bad FONT_DESCENT";
+			} else if (strcmp(key, "FAMILY_NAME") == 0)
+				prop = &bdf->family;
+			else if (strcmp(key, "FACE_NAME") == 0)
+				prop = &bdf->face;
+			else if (strcmp(key, "WEIGHT_NAME") == 0)
+				prop = &bdf->weight;
+			else if (strcmp(key, "COPYRIGHT") == 0)
+				prop = &bdf->copyright;
+			else if (strcmp(key, "CHARSET_REGISTRY") == 0)
+				prop = &bdf->registry;
+			else if (strcmp(key, "CHARSET_ENCODING") == 0)
+				prop = &bdf->encoding;
+			else if (strcmp(key, "ENDFONT") == 0) {
+				ended = true;
+				break;
+			}
+			if (prop != NULL) {
+				free(*prop);
+				if ((*prop = bdf_string(args)) == NULL)
+					goto nomem;
+			}
+			continue;
+		}
+		if (strcmp(key, "ENCODING") == 0) {
+			/* "-1 n" is in a non-standard encoding: ignore it. */
+			if (sscanf(args, "%d", &g->encoding) != 1 ||
+			    g->encoding < -1)
+				err = "bad ENCODING";
+		} else if (strcmp(key, "DWIDTH") == 0) {
+			if (sscanf(args, "%d", &g->advance) != 1)
+				err = "bad DWIDTH";
+		} else if (strcmp(key, "BBX") == 0) {
+			if (sscanf(args, "%d %d %d %d", &g->width, &g->height,
+			    &g->xoff, &g->yoff) != 4 ||
+			    g->width < 0 || g->height < 0)
+				err = "bad BBX";
+		} else if (strcmp(key, "BITMAP") == 0) {
+			stride = (g->width + 7) / 8;
+			g->bits = calloc((size_t)stride * g->height + 1, 1);
+			if (g->bits == NULL) goto nomem;
+			row = 0;
+		} else if (strcmp(key, "ENDCHAR") == 0) {
+			/* A glyph with no bitmap is blank. */
+			g->width = g->height = 0;
+			g = NULL;
+		}
+	}
+	free(line);
+	if (err != NULL) {
+		fprintf(stderr, "%s:%d: %s\n", fname, lineno, err);
+		return -1;
+	}
+	if (ferror(in)) {
+		fprintf(stderr, "%s: %s\n", fname, strerror(errno));
+		return -1;
+	}
+	if (!ended) {
+		fprintf(stderr, "%s: missing ENDFONT\n", fname);
+		return -1;
+	}
+	/* Without the properties, the bounding box will have to do. */
+	if (bdf->ascent < 0) bdf->ascent = fbb[1] + fbb[3];
+	if (bdf->descent < 0) bdf->descent = -fbb[3];
+	if (bdf->ascent + bdf->descent <= 0) {
+		fprintf(stderr, "%s: no FONT_ASCENT or FONT_DESCENT\n", fname);
+		return -1;
+	}
+	return 0;
+nomem:
+	fprintf(stderr, "%s:%d: %s\n", fname, lineno, strerror(errno));
+	free(line);
+	return -1;
+}
+
+/* Whether a glyph name from a BDF file will do for PostScript. */
+static bool
+bdf_goodname(char const *name)
+{
+	size_t len = strspn(name, "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+	    "abcdefghijklmnopqrstuvwxyz0123456789._");
+
+	return len > 0 && len < 64 && name[len] == '\0' &&
+	    !isdigit((unsigned char)name[0]);
+}
+
+/*
+ * Find the slot for a name in a hash table of glyphs, as for
+ * namelookup().
+ */
+static int *
+bdf_namelookup(struct bdffont const *bdf, int *table, unsigned mask,
+    char const *name)
+{
+	unsigned h = namehash(name, strlen(name)) & mask;
+
+	for (;; h = (h + 1) & mask)
+		if (table[h] == -1 ||
+		    strcmp(bdf->glyphs[table[h]].name, name) == 0)
+			return &table[h];
+}
+
+/*
+ * Give every glyph a unique name, keeping the first of each name from
+ * the file and making up the rest, and map the encodings to Unicode
+ * if the font is in ISO 10646 or ISO 8859-1.  Each glyph's position in
+ * the SFD is its encoding, or for glyphs without one, or with the same
+ * one as an earlier glyph, a position after all the encoded ones.
+ * Returns the size of the encoding, or -1 if memory runs out.
+ */
+static int
+bdf_names(struct bdffont *bdf, int *encodings, char const **sfdencoding)
+{
+	int *table, *codes, *slot, i, k, max = -1, extra = 0;
+	bool unicode, full = false;
+	unsigned mask, h;
+	char name[80];
+
+	unicode = bdf->registry &&
+	    (strcmp(bdf->registry, "ISO10646") == 0 ||
+		(strcmp(bdf->registry, "ISO8859") == 0 &&
+		    bdf->encoding && strcmp(bdf->encoding, "1") == 0));
+	for (mask = 1; mask < 2 * (unsigned)bdf->nglyphs; mask <<= 1)
+		continue;
+	table = malloc(mask * sizeof(table[0]));
+	codes = malloc(mask * sizeof(codes[0]));
+	if (table == NULL || codes == NULL) {
+		free(table);
+		free(codes);
+		return -1;
+	}
+	mask--;
+	for (h = 0; h <= mask; h++)
+		table[h] = codes[h] = -1;
+	for (i = 0; i < bdf->nglyphs; i++) {
+		if (bdf->glyphs[i].name == NULL) continue;
+		if (!bdf_goodname(bdf->glyphs[i].name)) {
+			free(bdf->glyphs[i].name);
+			bdf->glyphs[i].name = NULL;
+			continue;
+		}
+		slot = bdf_namelookup(bdf, table, mask, bdf->glyphs[i].name);
+		if (*slot == -1)
+			*slot = i;
+		else {
+			free(bdf->glyphs[i].name);
+			bdf->glyphs[i].name = NULL;
+		}
+	}
+	for (i = 0; i < bdf->nglyphs; i++) {
+		k = bdf->glyphs[i].encoding;
+		encodings[i] = -1;
+		if (k < 0 || (unicode &&
+		    (k > 0x10ffff || (k >= 0xd800 && k < 0xe000))))
+			continue;
+		for (h = (unsigned)k * 2654435761U & mask; codes[h] != -1;
+		     h = (h + 1) & mask)
+			if (bdf->glyphs[codes[h]].encoding == k)
+				break;
+		if (codes[h] != -1) continue;
+		codes[h] = i;
+		encodings[i] = k;
+		if (k > max) max = k;
+		if (unicode) bdf->glyphs[i].unicode = k;
+		if (k > 0xffff) full = true;
+	}
+	for (i = 0; i < bdf->nglyphs; i++) {
+		struct bdfglyph *g = &bdf->glyphs[i];
+
+		if (g->name != NULL) continue;
+		if (g->unicode >= 0)
+			snprintf(name, sizeof(name), g->unicode > 0xffff ?
+			    "u%04X" : "uni%04X", (unsigned)g->unicode);
+		else
+			snprintf(name, sizeof(name), "glyph%d", i);
+		/* In case the font has already used that name. */
+		for (k = 1;
+		     *(slot = bdf_namelookup(bdf, table, mask, name)) != -1;
+		     k++)
+			snprintf(strchr(name, '.') ? strchr(name, '.') :
+			    name + strlen(name), 16, ".%d", k);
+		if ((g->name = strdup(name)) == NULL) {
+			free(table);
+			free(codes);
+			return -1;
+		}
+		*slot = i;
+	}
+	free(table);
+	free(codes);
+	if (unicode) {
+		*sfdencoding = full ? "UnicodeFull" : "UnicodeBmp";
+		max = full ? 0x10ffff : 0xffff;
+	} else
+		*sfdencoding = "Custom";
+	for (i = 0; i < bdf->nglyphs; i++)
+		if (encodings[i] < 0)
+			encodings[i] = max + 1 + extra++;
+	return max + 1 + extra;
+}
+
+/*
+ * Fill in the font-wide parts of an imported font's description, in
+ * the same proportions as Bedstead's own where there's nothing better
+ * to go on.
+ */
+static void
+bdf_fontinfo(struct font *font, struct bdffont *bdf, struct param const *param)
+{
+	int px = bdf->ascent + bdf->descent, em = px * YPIX, i, n;
+	char const *p;
+
+	memset(font, 0, sizeof(*font));
+	font->familyname = bdf->family ? bdf->family : "Imported";
+	font->fullname = bdf->face ? bdf->face : font->familyname;
+	for (p = font->fullname, n = 0;
+	     *p && n < (int)sizeof(bdf->fontname) - 1; p++)
+		if (isalnum((unsigned char)*p) || *p == '-')
+			bdf->fontname[n++] = *p;
+	bdf->fontname[n] = '\0';
+	font->fontname = n ? bdf->fontname : "Imported";
+	font->weight = bdf->weight ? bdf->weight : "Medium";
+	font->weightclass = strcmp(font->weight, "Bold") == 0 ? 700 : 500;
+	font->widthclass = param->ttfwidth;
+	font->copyright = bdf->copyright ? bdf->copyright : "";
+	font->version = "001.000";
+	font->ascent = bdf->ascent * YPIX;
+	font->descent = bdf->descent * YPIX;
+	font->underlinepos = -YPIX / 2;
+	font->underlinewidth = YPIX;
+	font->strikepos = bdf->ascent * 3 / 8 * YPIX;
+	font->strikesize = YPIX;
+	font->subxsize = font->supxsize = em * 3 / 5;
+	font->subysize = font->supysize = em * 5 / 7;
+	font->subxoff = font->supxoff = 0;
+	font->subyoff = font->supyoff = em / 5;
+	font->stdhw = YPIX;
+	font->stdvw = param->xpix;
+	/* Monochrome at the bitmap's own size and at its rounded size. */
+	if (px > 1) {
+		static int const flags[] = { 2, 0, 3, 0 };
+
+		for (i = 0; i < 4; i++) {
+			font->gasp[i].ppem = (i / 2 + 1) * px - (i % 2 == 0);
+			font->gasp[i].flags = flags[i];
+		}
+		font->ngasp = 4;
+	}
+	font->gasp[font->ngasp].ppem = 65535;
+	font->gasp[font->ngasp++].flags = 3;
+}
+
+struct importqueue {
+	struct param const *param;
+	struct bdffont const *bdf;
+	struct font *font;
+	int const *encodings;
+	struct buf *chunks;	/* SFD for each chunk, or NULL for OpenType */
+	int nchunks;
+	int next;
+	bool failed;
+	pthread_mutex_t lock;
+};
+
+/* Outline one imported glyph, keeping a copy of the outline. */
+static int
+import_glyph(struct bedstead_ctx *ctx, struct bdfglyph const *b,
+    struct fontglyph *fg)
+{
+	struct bedstead_outline const *o;
+	int i, n;
+
+	o = bedstead_image(ctx, b->width, b->height, -b->yoff, b->bits,
+	    (b->width + 7) / 8);
+	if (o == NULL) return -1;
+	n = o->contours[o->ncontours];
+	fg->ncontours = o->ncontours;
+	fg->contours = malloc((o->ncontours + 1) * sizeof(fg->contours[0]));
+	fg->points = malloc((n + 1) * sizeof(fg->points[0]));
+	if (fg->contours == NULL || fg->points == NULL) return -1;
+	memcpy(fg->contours, o->contours,
+	    (o->ncontours + 1) * sizeof(fg->contours[0]));
+	for (i = 0; i < n; i++) {
+		fg->points[i].x = o->points[i].x + b->xoff * XPIX;
+		fg->points[i].y = o->points[i].y;
+	}
+	return 0;
+}
+
+static void
+import_sfd(struct buf *b, struct fontglyph *fg, int encoding, int i)
+{
+	struct bedstead_outline o;
+
+	buf_printf(b, "\nStartChar: %s\n", fg->name);
+	buf_printf(b, "Encoding: %d %d %d\n", encoding, fg->unicode, i);
+	buf_printf(b, "Width: %d\n", fg->advance);
+	buf_printf(b, "Flags: W\n");
+	buf_printf(b, "LayerCount: 2\n");
+	o.ncontours = fg->ncontours;
+	o.contours = fg->contours;
+	o.points = fg->points;
+	emit_path(b, &o);
+	buf_printf(b, "EndChar\n");
+}
+
+static void *
+import_worker(void *arg)
+{
+	struct importqueue *q = arg;
+	struct bedstead_ctx *ctx;
+	struct fontglyph *fg;
+	bool failed = false;
+	int n, i;
+
+	ctx = bedstead_new(q->param);
+	for (;;) {
+		pthread_mutex_lock(&q->lock);
+		n = q->next++;
+		if (failed) q->failed = true;
+		pthread_mutex_unlock(&q->lock);
+		if (n >= q->nchunks) break;
+		if (ctx == NULL) {
+			failed = true;
+			continue;
+		}
+		for (i = n * CHUNKSIZE;
+		     i < q->font->nglyphs && i < (n + 1) * CHUNKSIZE; i++) {
+			fg = &q->font->glyphs[i];
+			if (import_glyph(ctx, &q->bdf->glyphs[i], fg) != 0) {
+				failed = true;
+				break;
+			}
+			if (q->chunks == NULL) continue;
+			/* The outline isn't needed once it's written. */
+			import_sfd(&q->chunks[n], fg, q->encodings[i], i);
+			free(fg->contours); fg->contours = NULL;
+			free(fg->points); fg->points = NULL;
+		}
+	}
+	if (ctx) bedstead_free(ctx);
+	return NULL;
+}
+
+/* Convert a BDF font to SFD or OpenType on stdout. */
+static int
+doimport(struct param const *param, int nthreads, char const *fname,
+    bool otf)
+{
+	struct bdffont bdf;
+	struct font font;
+	struct importqueue q;
+	struct fontglyph *fg;
+	struct buf out;
+	char const *sfdencoding;
+	pthread_t *threads;
+	FILE *in = stdin;
+	int *encodings = NULL;
+	int i, k, size, started, ret = 1;
+
+	if (strcmp(fname, "-") != 0 && (in = fopen(fname, "r")) == NULL) {
+		fprintf(stderr, "%s: %s\n", fname, strerror(errno));
+		return 1;
+	}
+	k = read_bdf(in, fname, &bdf);
+	if (in != stdin) fclose(in);
+	memset(&font, 0, sizeof(font));
+	memset(&q, 0, sizeof(q));
+	buf_init(&out);
+	threads = NULL;
+	if (k != 0) goto out;
+	encodings = malloc((bdf.nglyphs + 1) * sizeof(encodings[0]));
+	if (encodings == NULL ||
+	    (size = bdf_names(&bdf, encodings, &sfdencoding)) < 0)
+		goto nomem;
+	bdf_fontinfo(&font, &bdf, param);
+	font.nglyphs = bdf.nglyphs;
+	font.glyphs = calloc(bdf.nglyphs + 1, sizeof(font.glyphs[0]));
+	if (font.glyphs == NULL) goto nomem;
+	for (i = 0; i < bdf.nglyphs; i++) {
+		fg = &font.glyphs[i];
+		fg->name = bdf.glyphs[i].name;
+		fg->unicode = bdf.glyphs[i].unicode;
+		fg->advance = bdf.glyphs[i].advance * param->xpix;
+		for (k = 0; k < NSUBST; k++)
+			fg->subst[k] = -1;
+	}
+
+	q.param = param;
+	q.bdf = &bdf;
+	q.font = &font;
+	q.encodings = encodings;
+	q.nchunks = (bdf.nglyphs + CHUNKSIZE - 1) / CHUNKSIZE;
+	if (!otf) {
+		q.chunks = malloc((q.nchunks + 1) * sizeof(q.chunks[0]));
+		if (q.chunks == NULL) goto nomem;
+		for (i = 0; i < q.nchunks; i++)
+			buf_init(&q.chunks[i]);
+	}
+	threads = malloc(nthreads * sizeof(threads[0]));
+	if (threads == NULL) goto nomem;
+	pthread_mutex_init(&q.lock, NULL);
+	for (started = 0; started < nthreads; started++)
+		if (pthread_create(&threads[started], NULL,
+		    import_worker, &q) != 0)
+			break;
+	/* If we couldn't start any threads, do the work ourselves. */
+	if (started == 0)
+		import_worker(&q);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&q.lock);
+	if (q.failed) goto nomem;
+
+	if (otf) {
+		if (write_otf(stdout, &font) != 0 || fflush(stdout) != 0)
+			fprintf(stderr, "error writing font\n");
+		else
+			ret = 0;
+		goto out;
+	}
+	sfdheader(&out, &font, sfdencoding, false);
+	buf_printf(&out, "BeginChars: %d %d\n", size, bdf.nglyphs);
+	if (buf_write(&out, STDOUT_FILENO) != 0 ||
+	    buf_writev(q.chunks, q.nchunks, STDOUT_FILENO) != 0)
+		goto badwrite;
+	buf_printf(&out, "EndChars\n");
+	buf_printf(&out, "EndSplineFont\n");
+	if (buf_write(&out, STDOUT_FILENO) != 0)
+		goto badwrite;
+	ret = 0;
+	goto out;
+badwrite:
+	fprintf(stderr, "error writing font: %s\n", strerror(errno));
+	goto out;
+nomem:
+	fprintf(stderr, "%s\n", strerror(ENOMEM));
+out:
+	if (q.chunks != NULL)
+		for (i = 0; i < q.nchunks; i++)
+			buf_free(&q.chunks[i]);
+	free(q.chunks);
+	free(threads);
+	if (font.glyphs != NULL)
+		for (i = 0; i < font.nglyphs; i++) {
+			free(font.glyphs[i].contours);
+			free(font.glyphs[i].points);
+		}
+	free(font.glyphs);
+	free(encodings);
+	buf_free(&out);
+	bdf_free(&bdf);
+	return ret;
+}
+
+/* The number of processors, for modes that use them all by default. */
+static int
+ncpus(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (n > 0) return n < 1024 ? n : 1024;
+#endif
+	return 1;
+}
+
+/*
+ * Teletext to video.  A T42 file is a recording of teletext packets
+ * as they came off the air, each being 42 bytes: a two-byte magazine
+ * and row address, and 40 bytes of data.  Packets are decoded into a
+ * cache of pages, and one page is drawn in every frame of a Y4M
+ * stream on stdout.  Decoding, drawing and converting to YCbCr each
+ * have a thread, connected by a ring of frames, so that a live source
+ * can be kept up with.
+ */
+
+#define T42SIZE 42
+
+/* VBI lines carrying teletext in each frame, unless told otherwise. */
+#define T42PERFRAME 32
+
+/* The SAA5050 flashes with a period of 64 fields, on for 48 of them. */
+#define FLASHPERIOD 32
+#define FLASHON 24
+
+#define NFRAMES 4
+
+struct t42page {
+	unsigned char codes[PAGE_ROWS][PAGE_COLS];
+	int national;
+	unsigned long serial;		/* Changes whenever the page does */
+};
+
+struct t42frame {
+	unsigned char codes[PAGE_ROWS][PAGE_COLS];
+	int national;
+	bool changed;			/* Since the previous frame */
+	bool flashoff;
+	bool same;			/* Repeat the previous frame */
+	unsigned char pix[PAGE_HEIGHT][PAGE_WIDTH];
+};
+
+struct t42pipe {
+	struct bedstead_teletext *tt;
+	struct t42frame *frames;
+	long decoded, drawn, encoded;	/* Frames through each stage */
+	bool eof, failed;
+	bool direct;			/* Stages called by the decoder */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* Belonging to the drawing stage */
+	bool flashoff;
+	/* Belonging to the encoding stage */
+	unsigned char ycc[3][8];	/* Y, Cb and Cr of each colour */
+	unsigned char (*yuv)[PAGE_HEIGHT * PAGE_WIDTH];
+	struct buf out;
+};
+
+static signed char hamming84[256];
+
+/* Hamming 8/4 decoding, correcting single-bit errors.  -1 if invalid. */
+static void
+hamming_init(void)
+{
+	int b, d, e, k, p1, p2, p3, p4;
+	int d1, d2, d3, d4;
+
+	memset(hamming84, -1, sizeof(hamming84));
+	for (d = 0; d < 16; d++) {
+		d1 = d & 1; d2 = d >> 1 & 1; d3 = d >> 2 & 1; d4 = d >> 3;
+		p1 = 1 ^ d1 ^ d3 ^ d4;
+		p2 = 1 ^ d1 ^ d2 ^ d4;
+		p3 = 1 ^ d1 ^ d2 ^ d3;
+		p4 = 1 ^ p1 ^ d1 ^ p2 ^ d2 ^ p3 ^ d3 ^ d4;
+		b = p1 | d1 << 1 | p2 << 2 | d2 << 3 |
+		    p3 << 4 | d3 << 5 | p4 << 6 | d4 << 7;
+		hamming84[b] = d;
+		for (k = 0; k < 8; k++) {
+			e = b ^ 1 << k;
+			hamming84[e] = d;
+		}
+	}
+}
+
+/* Strip odd parity, showing a space for a byte that fails it. */
+static unsigned char
+t42_parity(unsigned char c)
+{
+	unsigned p = c ^ c >> 4;
+
+	p ^= p >> 2;
+	p ^= p >> 1;
+	return p & 1 ? c & 0x7f : 0x20;
+}
+
+/*
+ * Add one packet to the page cache.  current[] is the page that each
+ * magazine is sending, or -1.  The last eight columns of a header are
+ * a clock, which is kept in clock[] from every header that goes by.
+ * Returns true if the clock changed.
+ */
+static bool
+t42_packet(unsigned char const *pkt, struct t42page *cache, int current[8],
+    unsigned char clock[8])
+{
+	unsigned char header[PAGE_COLS];
+	bool tick;
+
+	int h[8], mag, row, c, i;
+	struct t42page *p;
+
+	h[0] = hamming84[pkt[0]];
+	h[1] = hamming84[pkt[1]];
+	if (h[0] < 0 || h[1] < 0) return false;
+	mag = h[0] & 7;
+	row = h[0] >> 3 | h[1] << 1;
+	if (row > 24) return false;	/* Not part of a level 1 page */
+	if (row == 0) {
+		for (i = 0; i < 8; i++)
+			if ((h[i] = hamming84[pkt[2 + i]]) < 0) {
+				current[mag] = -1;
+				return false;
+			}
+		memset(header, ' ', 8);
+		for (c = 8; c < PAGE_COLS; c++)
+			header[c] = t42_parity(pkt[2 + c]);
+		tick = memcmp(clock, header + PAGE_COLS - 8, 8) != 0;
+		memcpy(clock, header + PAGE_COLS - 8, 8);
+		/* Page xFF only marks the end of the previous page. */
+		if (h[0] == 0xf && h[1] == 0xf) {
+			current[mag] = -1;
+			return tick;
+		}
+		current[mag] = mag << 8 | h[1] << 4 | h[0];
+		p = &cache[current[mag]];
+		/* C4: erase page */
+		if (h[3] & 8)
+			memset(p->codes[1], ' ', sizeof(p->codes) - PAGE_COLS);
+		/* C12-C14: national option */
+		p->national = (h[7] & 2) << 1 | (h[7] & 4) >> 1 |
+		    (h[7] & 8) >> 3;
+		memcpy(p->codes[0], header, PAGE_COLS);
+		p->serial++;
+		return tick;
+	}
+	if (current[mag] < 0) return false;
+	p = &cache[current[mag]];
+	for (c = 0; c < PAGE_COLS; c++)
+		p->codes[row][c] = t42_parity(pkt[2 + c]);
+	p->serial++;
+	return false;
+}
+
+static void
+t42_signal(struct t42pipe *pp)
+{
+
+	pthread_cond_broadcast(&pp->cond);
+	pthread_mutex_unlock(&pp->lock);
+}
+
+/* The drawing stage.  Frames that haven't changed aren't redrawn. */
+static void *
+t42_draw(void *arg)
+{
+	struct t42pipe *pp = arg;
+	struct t42frame *f;
+
+	for (;;) {
+		pthread_mutex_lock(&pp->lock);
+		while (pp->drawn == pp->decoded && !pp->eof && !pp->direct)
+			pthread_cond_wait(&pp->cond, &pp->lock);
+		if (pp->drawn == pp->decoded) {
+			pthread_mutex_unlock(&pp->lock);
+			return NULL;
+		}
+		f = &pp->frames[pp->drawn % NFRAMES];
+		pthread_mutex_unlock(&pp->lock);
+
+		f->same = pp->drawn > 0 && !f->changed &&
+		    (f->flashoff == pp->flashoff ||
+		     memchr(f->codes, 0x08, sizeof(f->codes)) == NULL);
+		if (!f->same)
+			bedstead_teletext_page(pp->tt, f->codes, f->national,
+			    f->flashoff ? PAGE_FLASHOFF : 0, f->pix[0],
+			    PAGE_WIDTH);
+		pp->flashoff = f->flashoff;
+
+		pthread_mutex_lock(&pp->lock);
+		pp->drawn++;
+		t42_signal(pp);
+	}
+}
+
+/* The encoding stage, which writes frames in Y4M's 4:4:4 format. */
+static void *
+t42_encode(void *arg)
+{
+	struct t42pipe *pp = arg;
+	struct t42frame *f;
+	unsigned char const *pix;
+	int i, k;
+	bool failed;
+
+	for (;;) {
+		pthread_mutex_lock(&pp->lock);
+		while (pp->encoded == pp->drawn && !pp->direct &&
+		    !(pp->eof && pp->drawn == pp->decoded))
+			pthread_cond_wait(&pp->cond, &pp->lock);
+		if (pp->encoded == pp->drawn) {
+			pthread_mutex_unlock(&pp->lock);
+			return NULL;
+		}
+		f = &pp->frames[pp->encoded % NFRAMES];
+		failed = pp->failed;
+		pthread_mutex_unlock(&pp->lock);
+
+		for (k = 0; k < 3 && !f->same && !failed; k++) {
+			pix = f->pix[0];
+			for (i = 0; i < PAGE_HEIGHT * PAGE_WIDTH; i++)
+				pp->yuv[k][i] = pp->ycc[k][pix[i]];
+		}
+		if (!failed) {
+			buf_puts(&pp->out, "FRAME\n");
+			buf_put(&pp->out, pp->yuv, 3 * sizeof(pp->yuv[0]));
+			if (buf_write(&pp->out, STDOUT_FILENO) != 0) {
+				fprintf(stderr, "error writing video: %s\n",
+				    strerror(errno));
+				failed = true;
+			}
+		}
+
+		pthread_mutex_lock(&pp->lock);
+		if (failed) pp->failed = true;
+		pp->encoded++;
+		t42_signal(pp);
+	}
+}
+
+/*
+ * Decode a T42 file as video of one page.  Each frame takes perframe
+ * packets from the file, as if they'd been on the VBI lines of that
+ * frame.
+ */
+static int
+dot42(char const *fname, int argc, char **argv)
+{
+	static struct t42page cache[0x800];
+	unsigned char clock[8], pkt[T42SIZE];
+	struct t42pipe pp;
+	struct t42page *p;
+	struct t42frame *f;
+	pthread_t draw, encode;
+	unsigned long serial = 0;
+	int current[8], page = 0x100, perframe = T42PERFRAME;
+	int i, k, n, ret = 1;
+	double r, g, b;
+	bool drawing = false, encoding = false, tick = true;
+	char *endptr;
+	FILE *in = stdin;
+	long frame;
+
+	if (argc > 2) {
+		fprintf(stderr, "too many arguments\n");
+		return 1;
+	}
+	if (argc > 0) {
+		page = strtol(argv[0], &endptr, 16);
+		if (page < 0x100 || page > 0x8ff || *endptr) {
+			fprintf(stderr, "invalid page number '%s'\n", argv[0]);
+			return 1;
+		}
+	}
+	if (argc > 1) {
+		perframe = strtol(argv[1], &endptr, 10);
+		if (perframe < 1 || *endptr) {
+			fprintf(stderr, "invalid packet count '%s'\n",
+			    argv[1]);
+			return 1;
+		}
+	}
+	if (strcmp(fname, "-") != 0 && (in = fopen(fname, "rb")) == NULL) {
+		fprintf(stderr, "%s: %s\n", fname, strerror(errno));
+		return 1;
+	}
+
+	hamming_init();
+	for (i = 0; i < 0x800; i++)
+		memset(cache[i].codes, ' ', sizeof(cache[i].codes));
+	for (i = 0; i < 8; i++)
+		current[i] = -1;
+	memset(clock, ' ', sizeof(clock));
+	/* Magazine 8 is sent as magazine 0. */
+	p = &cache[page & 0x7ff];
+	memset(&pp, 0, sizeof(pp));
+	buf_init(&pp.out);
+	/* BT.601 colours, with the usual headroom. */
+	for (k = 0; k < 8; k++) {
+		r = k & 1; g = k >> 1 & 1; b = k >> 2 & 1;
+		pp.ycc[0][k] = lround(16 + 65.481*r + 128.553*g + 24.966*b);
+		pp.ycc[1][k] = lround(128 - 37.797*r - 74.203*g + 112*b);
+		pp.ycc[2][k] = lround(128 + 112*r - 93.786*g - 18.214*b);
+	}
+	pp.tt = bedstead_teletext_new();
+	pp.frames = malloc(NFRAMES * sizeof(pp.frames[0]));
+	pp.yuv = malloc(3 * sizeof(pp.yuv[0]));
+	if (pp.tt == NULL || pp.frames == NULL || pp.yuv == NULL) {
+		fprintf(stderr, "%s\n", strerror(ENOMEM));
+		goto out;
+	}
+	/* 576i subpixels are 14.75:12; see the design parameters. */
+	printf("YUV4MPEG2 W%d H%d F25:1 Ip A59:48 C444\n",
+	    PAGE_WIDTH, PAGE_HEIGHT);
+	if (fflush(stdout) != 0) {
+		fprintf(stderr, "error writing video: %s\n", strerror(errno));
+		goto out;
+	}
+	pthread_mutex_init(&pp.lock, NULL);
+	pthread_cond_init(&pp.cond, NULL);
+	drawing = pthread_create(&draw, NULL, t42_draw, &pp) == 0;
+	if (drawing)
+		encoding = pthread_create(&encode, NULL, t42_encode, &pp) == 0;
+	/* Without both threads, the decoder runs each stage in turn. */
+	if (!encoding) {
+		pthread_mutex_lock(&pp.lock);
+		pp.direct = true;
+		t42_signal(&pp);
+		if (drawing) pthread_join(draw, NULL);
+	}
+
+	for (frame = 0; ; frame++) {
+		for (n = 0; n < perframe; n++) {
+			if (fread(pkt, T42SIZE, 1, in) != 1) break;
+			tick |= t42_packet(pkt, cache, current, clock);
+		}
+		if (n == 0) break;
+
+		pthread_mutex_lock(&pp.lock);
+		while (pp.decoded - pp.encoded == NFRAMES && !pp.failed)
+			pthread_cond_wait(&pp.cond, &pp.lock);
+		f = &pp.frames[pp.decoded % NFRAMES];
+		k = pp.failed;
+		pthread_mutex_unlock(&pp.lock);
+		if (k) break;
+
+		memcpy(f->codes, p->codes, sizeof(f->codes));
+		snprintf((char *)f->codes[0], 8, " P%03X  ", page);
+		f->codes[0][7] = ' ';
+		memcpy(f->codes[0] + PAGE_COLS - 8, clock, 8);
+		f->national = p->national;
+		f->changed = p->serial != serial || tick;
+		f->flashoff = frame % FLASHPERIOD >= FLASHON;
+		serial = p->serial;
+		tick = false;
+
+		pthread_mutex_lock(&pp.lock);
+		pp.decoded++;
+		t42_signal(&pp);
+		if (pp.direct) {
+			t42_draw(&pp);
+			t42_encode(&pp);
+		}
+	}
+	if (ferror(in))
+		fprintf(stderr, "%s: %s\n", fname, strerror(errno));
+
+	pthread_mutex_lock(&pp.lock);
+	pp.eof = true;
+	t42_signal(&pp);
+	if (encoding) {
+		pthread_join(draw, NULL);
+		pthread_join(encode, NULL);
+	}
+	if (!pp.failed && !ferror(in)) ret = 0;
+	pthread_cond_destroy(&pp.cond);
+	pthread_mutex_destroy(&pp.lock);
+out:
+	if (in != stdin) fclose(in);
+	if (pp.tt) bedstead_teletext_free(pp.tt);
+	free(pp.frames);
+	free(pp.yuv);
+	buf_free(&pp.out);
+	return ret;
+}
+
+/*
+ * Self-tests, which "make check" runs, for what --hashes and
+ * --differential don't reach.  Each test reports what went wrong and
+ * returns the number of failures.
+ */
+
+/* C12, C13 and C14 from a page header, and the option they select. */
+static struct { int c12, c13, c14, national; } const t42_options[] = {
+	{ 0, 0, 0, NATIONAL_ENGLISH }, { 0, 0, 1, NATIONAL_GERMAN },
+	{ 0, 1, 0, NATIONAL_SWEDISH }, { 0, 1, 1, NATIONAL_ITALIAN },
+	{ 1, 0, 0, NATIONAL_FRENCH }, { 1, 0, 1, NATIONAL_SPANISH },
+	{ 1, 1, 0, NATIONAL_CZECH },
+	{ 1, 1, 1, NNATIONAL },		/* Unassigned; drawn as English */
+};
+
+static int
+selftest_t42(void)
+{
+	unsigned char pkt[T42SIZE], enc[16], clock[8];
+	struct t42page *cache;
+	int current[8], b, i, k, fails = 0;
+
+	cache = calloc(0x800, sizeof(cache[0]));
+	if (cache == NULL) {
+		fprintf(stderr, "%s\n", strerror(errno));
+		return 1;
+	}
+	hamming_init();
+	for (b = 255; b >= 0; b--)
+		if (hamming84[b] >= 0) enc[hamming84[b]] = b;
+	for (k = 0; k < 8; k++) {
+		/* A header for page 100, with C12-C14 set as in the table. */
+		memset(pkt, 0x20, sizeof(pkt));
+		for (i = 0; i < 10; i++)
+			pkt[i] = enc[0];
+		pkt[0] = enc[1];
+		pkt[9] = enc[t42_options[k].c12 << 1 |
+		    t42_options[k].c13 << 2 | t42_options[k].c14 << 3];
+		for (i = 0; i < 8; i++)
+			current[i] = -1;
+		memset(clock, 0, sizeof(clock));
+		t42_packet(pkt, cache, current, clock);
+		if (current[1] != 0x100 ||
+		    cache[0x100].national != t42_options[k].national) {
+			fprintf(stderr, "t42: C12-C14 = %d%d%d gave national "
+			    "option %d, not %d\n", t42_options[k].c12,
+			    t42_options[k].c13, t42_options[k].c14,
+			    cache[0x100].national, t42_options[k].national);
+			fails++;
+		}
+	}
+	free(cache);
+	return fails;
+}
+
+/*
+ * A DRCS character's outline should be the one that its bitmap has at
+ * twice the width, halved: in particular, half a pixel's width not
+ * being a multiple of 4 mustn't put diagonals out of line.
+ */
+static int
+selftest_drcs(void)
+{
+	static struct param const *const params[] = {
+		&default_param, &extended_param,
+	};
+	struct bedstead_drcs *dc;
+	struct bedstead_drcs_glyph const *g;
+	struct bedstead_outline const *o;
+	struct bedstead_ctx *ctx;
+	unsigned rows[DRCS_HEIGHT];
+	unsigned char data[DRCS_HEIGHT][2];
+	int i, k, y, n, fails = 0;
+	bool same;
+
+	/* A diagonal, six pixels long. */
+	for (y = 0; y < DRCS_HEIGHT; y++) {
+		rows[y] = y < 6 ? 1U << (DRCS_WIDTH - 1 - y) : 0;
+		data[y][0] = rows[y] >> 4;
+		data[y][1] = rows[y] << 4;
+	}
+	for (k = 0; k < 2; k++) {
+		dc = bedstead_drcs_new(params[k], 1);
+		ctx = bedstead_new(params[k]);
+		g = dc ? bedstead_drcs_get(dc, rows) : NULL;
+		o = ctx ? bedstead_image(ctx, DRCS_WIDTH, DRCS_HEIGHT, 2,
+		    data[0], 2) : NULL;
+		if (g == NULL || o == NULL) {
+			fprintf(stderr, "%s\n", strerror(errno));
+			return fails + 1;
+		}
+		n = o->contours[o->ncontours];
+		same = g->outline.ncontours == o->ncontours &&
+		    memcmp(g->outline.contours, o->contours,
+			(o->ncontours + 1) * sizeof(o->contours[0])) == 0;
+		for (i = 0; same && i < n; i++)
+			same = g->outline.points[i].x ==
+			    (o->points[i].x + 1) / 2 &&
+			    g->outline.points[i].y == o->points[i].y;
+		if (!same) {
+			fprintf(stderr, "drcs: %s diagonal has %d points in "
+			    "%d contours, not %d in %d\n", params[k]->fontname,
+			    g->outline.contours[g->outline.ncontours],
+			    g->outline.ncontours, n, o->ncontours);
+			fails++;
+		}
+		bedstead_drcs_put(dc, g);
+		bedstead_drcs_free(dc);
+		bedstead_free(ctx);
+	}
+	return fails;
+}
+
+static int
+doselftest(void)
+{
+	int fails;
+
+	fails = selftest_t42() + selftest_drcs();
+	if (fails != 0) {
+		fprintf(stderr, "%d self-test%s failed\n", fails,
+		    fails == 1 ? "" : "s");
+		return 1;
+	}
+	printf("self-tests passed\n");
+	return fflush(stdout) != 0;
+}
+
+/*
+ * Server mode.  Each request is a line containing a bitmap in the
+ * same form as the command-line arguments.  The reply to a good
+ * request is "OK <length>" on a line of its own, followed by exactly
+ * <length> bytes of outline in the same format as the single-glyph
+ * command-line output.  The reply to a bad one is "ERR <message>".
+ *
+ * Replies are remembered in a small cache shared between all clients,
+ * since an editor tends to ask for the same few bitmaps over and over
+ * again as a pixel is toggled back and forth.
+ */
+
+#define CACHESIZE 256
+
+static struct cache_entry {
+	bool valid;
+	char data[YSIZE];
+	char *reply;
+	size_t len;
+} cache[CACHESIZE];
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned
+cache_hash(char const data[YSIZE])
+{
+	unsigned h = 0;
+	int i;
+
+	for (i = 0; i < YSIZE; i++)
+		h = h * 31 + (unsigned char)data[i];
+	return h % CACHESIZE;
+}
+
+/* Look up a bitmap in the cache, returning a copy of its reply. */
+static char *
+cache_get(char const data[YSIZE], size_t *lenp)
+{
+	struct cache_entry *e = &cache[cache_hash(data)];
+	char *reply = NULL;
+
+	pthread_mutex_lock(&cache_lock);
+	if (e->valid && memcmp(e->data, data, YSIZE) == 0) {
+		reply = malloc(e->len);
+		if (reply) {
+			memcpy(reply, e->reply, e->len);
+			*lenp = e->len;
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return reply;
+}
+
+static void
+cache_put(char const data[YSIZE], char const *reply, size_t len)
+{
+	struct cache_entry *e = &cache[cache_hash(data)];
+	char *copy = malloc(len);
+
+	if (copy == NULL) return;
+	memcpy(copy, reply, len);
+	pthread_mutex_lock(&cache_lock);
+	free(e->reply);
+	e->valid = true;
+	memcpy(e->data, data, YSIZE);
+	e->reply = copy;
+	e->len = len;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+static void
+serve_stream(FILE *in, FILE *out, struct param const *param)
+{
+	struct bedstead_ctx *ctx;
+	char *line = NULL, *reply, *word, *save;
+	char *words[YSIZE + 1];
+	char data[YSIZE], err[80];
+	size_t linesize = 0, len;
+	struct buf b;
+	int n;
+
+	ctx = bedstead_new(param);
+	if (ctx == NULL) {
+		fprintf(out, "ERR %s\n", strerror(errno));
+		return;
+	}
+	while (getline(&line, &linesize, in) != -1) {
+		n = 0;
+		for (word = strtok_r(line, " \t\r\n", &save);
+		     word && n <= YSIZE;
+		     word = strtok_r(NULL, " \t\r\n", &save))
+			words[n++] = word;
+		if (parse_bitmap(n, words, data, err, sizeof(err))) {
+			fprintf(out, "ERR %s\n", err);
+			fflush(out);
+			continue;
+		}
+		reply = cache_get(data, &len);
+		if (reply == NULL) {
+			buf_init(&b);
+			emit_path(&b, bedstead_char(ctx, data, 0));
+			if (b.failed) {
+				buf_free(&b);
+				fprintf(out, "ERR out of memory\n");
+				fflush(out);
+				continue;
+			}
+			reply = (char *)b.data;
+			len = b.len;
+			cache_put(data, reply, len);
+		}
+		fprintf(out, "OK %zu\n", len);
+		fwrite(reply, 1, len, out);
+		fflush(out);
+		free(reply);
+	}
+	free(line);
+	bedstead_free(ctx);
+}
+
+struct client {
+	int fd;
+	struct param const *param;
+};
+
+static void *
+serve_client(void *arg)
+{
+	struct client *c = arg;
+	FILE *in, *out;
+	int fd2;
+
+	fd2 = dup(c->fd);
+	in = fdopen(c->fd, "r");
+	out = fd2 == -1 ? NULL : fdopen(fd2, "w");
+	if (in && out)
+		serve_stream(in, out, c->param);
+	if (in) fclose(in); else close(c->fd);
+	if (out) fclose(out); else if (fd2 != -1) close(fd2);
+	free(c);
+	return NULL;
+}
+
+/* Listen on a Unix-domain socket, serving each client in its own thread. */
+static int
+serve_socket(char const *path, struct param const *param)
+{
+	struct sockaddr_un sun;
+	struct client *c;
+	pthread_t thread;
+	int sock, fd;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "socket path too long\n");
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+	unlink(path);
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock == -1 ||
+	    bind(sock, (struct sockaddr *)&sun, sizeof(sun)) == -1 ||
+	    listen(sock, 16) == -1) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	for (;;) {
+		fd = accept(sock, NULL, NULL);
+		if (fd == -1) {
+			if (errno == EINTR) continue;
+			fprintf(stderr, "accept: %s\n", strerror(errno));
+			return 1;
+		}
+		c = malloc(sizeof(*c));
+		if (c == NULL) {
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+		c->param = param;
+		if (pthread_create(&thread, NULL, serve_client, c) != 0) {
+			close(fd);
+			free(c);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+}
+
+#endif /* BEDSTEAD_LIBRARY */
+
+/*
+ * Make room for n points.  This mustn't be called while there are
+ * points in the arena, since they point at each other.
+ */
+static int
+reserve_points(struct bedstead_ctx *ctx, int n)
+{
+	void *p;
+
+	if (n <= ctx->size) return 0;
+#define GROW(array, count) do {						\
+		p = realloc(ctx->array, (count) * sizeof(ctx->array[0])); \
+		if (p == NULL) return -1;				\
+		ctx->array = p;						\
+	} while (0)
+	GROW(points, n);
+	GROW(lines, n);
+	GROW(rank, n);
+	GROW(nodes, n);
+	GROW(roots, n);
+	GROW(opoints, n);
+	GROW(contours, n + 1);
+#undef GROW
+	ctx->size = n;
+	ctx->outline.contours = ctx->contours;
+	ctx->outline.points = ctx->opoints;
+	return 0;
+}
+
+struct bedstead_ctx *
+bedstead_new(struct param const *param)
+{
+	struct bedstead_ctx *ctx;
+
+	ctx = malloc(sizeof(*ctx));
+	if (ctx == NULL) return NULL;
+	ctx->size = 0;
+	ctx->points = NULL;
+	ctx->lines = NULL;
+	ctx->rank = NULL;
+	ctx->nodes = NULL;
+	ctx->roots = NULL;
+	ctx->opoints = NULL;
+	ctx->contours = NULL;
+	ctx->scratch = NULL;
+	ctx->scratchsize = 0;
+	if (reserve_points(ctx, MAXPOINTS) != 0) {
+		bedstead_free(ctx);
+		return NULL;
+	}
+	ctx->param = param;
+	if (param->xpix == DEFAULT_XPIX)
+		ctx->frag = &default_fragments;
+	else if (param->xpix == EXTENDED_XPIX)
+		ctx->frag = &extended_fragments;
+	else {
+		ctx->ownfrag =
+		    (struct fragments)FRAGMENTS(param->xpix, YPIX);
+		ctx->frag = &ctx->ownfrag;
+	}
+	ctx->stats = NULL;
+	ctx->nextpoint = 0;
+	ctx->outline.ncontours = 0;
+	ctx->contours[0] = 0;
+	return ctx;
+}
+
+void
+bedstead_free(struct bedstead_ctx *ctx)
+{
+
+	free(ctx->points);
+	free(ctx->lines);
+	free(ctx->rank);
+	free(ctx->nodes);
+	free(ctx->roots);
+	free(ctx->opoints);
+	free(ctx->contours);
+	free(ctx->scratch);
+	free(ctx);
+}
+
+static void
+clearpath(struct bedstead_ctx *ctx)
+{
+
+	ctx->nextpoint = 0;
+}
+
+static void
+moveto(struct bedstead_ctx *ctx, unsigned x, unsigned y)
+{
+	struct point *p;
+
+	assert(ctx->nextpoint < ctx->size);
+	p = &ctx->points[ctx->nextpoint++];
+
+	p->v.x = x; p->v.y = y;
+	p->next = p->prev = NULL;
+}
+
+static void
+lineto(struct bedstead_ctx *ctx, unsigned x, unsigned y)
+{
+	struct point *p;
+
+	assert(ctx->nextpoint < ctx->size);
+	p = &ctx->points[ctx->nextpoint++];
+
+	p->v.x = x; p->v.y = y;
+	p->next = NULL;
+	p->prev = p - 1;
+	p->prev->next = p;
+}
+
+static void
+closepath(struct bedstead_ctx *ctx)
+{
+	struct point *p = &ctx->points[ctx->nextpoint - 1];
+
+	while (p->prev) p--;
+	p->prev = ctx->points + ctx->nextpoint - 1;
+	ctx->points[ctx->nextpoint - 1].next = p;
+}
+
+static void
+killpoint(point *p)
+{
+
+	p->prev->next = p->next;
+	p->next->prev = p->prev;
+	p->next = p->prev = NULL;
+}
+
+static vec const zero = { 0, 0 };
+
+static int
+vec_eqp(vec v1, vec v2)
+{
+	return v1.x == v2.x && v1.y == v2.y;
+}
+
+static vec
+vec_sub(vec v1, vec v2)
+{
+	vec ret;
+	ret.x = v1.x - v2.x; ret.y = v1.y - v2.y;
+	return ret;
+}
+
+static int
+gcd(int a, int b)
+{
+	int t;
+	while (b != 0) {
+		t = b;
+		b = a % b;
+		a = t;
+	}
+	return a;
+}
+
+/* Return the shortest representable vector parallel to the argument. */
+static vec
+vec_bearing(vec v)
+{
+	vec ret;
+	int d = gcd(abs(v.x), abs(v.y));
+	if (d != 0) {
+		ret.x = v.x / d;
+		ret.y = v.y / d;
+	} else {
+		ret.x = 0;
+		ret.y = 0;
+	}
+	return ret;
+}
+
+/* If p is identical to its successor, remove p. */
+static void
+fix_identical(point *p)
+{
+	if (!p->next) return;
+	if (vec_eqp(p->next->v, p->v))
+		killpoint(p);
+}
+
+/* Are a, b, and c distinct collinear points in that order? */
+static int
+vec_inline3(vec a, vec b, vec c)
+{
+	return
+	    vec_eqp(vec_bearing(vec_sub(b, a)), vec_bearing(vec_sub(c, b))) &&
+	    !vec_eqp(vec_bearing(vec_sub(b, a)), zero);
+}
+
+/* Are a, b, c, and d distinct collinear points in that order? */
+static int
+vec_inline4(vec a, vec b, vec c, vec d)
+{
+	return vec_inline3(a, b, c) && vec_inline3(b, c, d);
+}
+
+/* If p is on the line between its predecessor and successor, remove p. */
+static void
+fix_collinear(point *p)
+{
+	if (!p->next) return;
+	if (vec_inline3(p->prev->v, p->v, p->next->v))
+		killpoint(p);
+}
+
+/* If p is the only point on its path, remove p. */
+static void
+fix_isolated(point *p)
+{
+	if (p->next == p)
+		killpoint(p);
+}
+
+/*
+ * The edge trees are treaps: each node's priority, a hash of its
+ * index, is less than its parent's, which keeps them balanced however
+ * the edges move.  Nodes are ordered by start, then by index.
+ */
+static unsigned
+tree_prio(int i)
+{
+	unsigned x = (unsigned)i * 0x9e3779b1U;
+
+	x ^= x >> 16;
+	x *= 0x85ebca6bU;
+	return x ^ x >> 13;
+}
+
+static bool
+tree_before(struct edgenode const *t, int i, int j)
+{
+
+	return t[i].s < t[j].s || (t[i].s == t[j].s && i < j);
+}
+
+static void
+tree_fix(struct edgenode *t, int i)
+{
+
+	t[i].maxe = t[i].e;
+	if (t[i].left >= 0 && t[t[i].left].maxe > t[i].maxe)
+		t[i].maxe = t[t[i].left].maxe;
+	if (t[i].right >= 0 && t[t[i].right].maxe > t[i].maxe)
+		t[i].maxe = t[t[i].right].maxe;
+}
+
+/* Split the tree at root into the nodes before i and the rest. */
+static void
+tree_split(struct edgenode *t, int root, int i, int *l, int *r)
+{
+
+	if (root < 0)
+		*l = *r = -1;
+	else if (tree_before(t, root, i)) {
+		tree_split(t, t[root].right, i, &t[root].right, r);
+		tree_fix(t, root);
+		*l = root;
+	} else {
+		tree_split(t, t[root].left, i, l, &t[root].left);
+		tree_fix(t, root);
+		*r = root;
+	}
+}
+
+/* Join two trees, all of whose nodes in l come before those in r. */
+static int
+tree_join(struct edgenode *t, int l, int r)
+{
+
+	if (l < 0) return r;
+	if (r < 0) return l;
+	if (tree_prio(l) > tree_prio(r)) {
+		t[l].right = tree_join(t, t[l].right, r);
+		tree_fix(t, l);
+		return l;
+	}
+	t[r].left = tree_join(t, l, t[r].left);
+	tree_fix(t, r);
+	return r;
+}
+
+static int
+tree_insert(struct edgenode *t, int root, int i)
+{
+
+	if (root < 0 || tree_prio(i) > tree_prio(root)) {
+		tree_split(t, root, i, &t[i].left, &t[i].right);
+		tree_fix(t, i);
+		return i;
+	}
+	if (tree_before(t, i, root))
+		t[root].left = tree_insert(t, t[root].left, i);
+	else
+		t[root].right = tree_insert(t, t[root].right, i);
+	tree_fix(t, root);
+	return root;
+}
+
+static int
+tree_delete(struct edgenode *t, int root, int i)
+{
+
+	if (root == i)
+		return tree_join(t, t[i].left, t[i].right);
+	if (tree_before(t, i, root))
+		t[root].left = tree_delete(t, t[root].left, i);
+	else
+		t[root].right = tree_delete(t, t[root].right, i);
+	tree_fix(t, root);
+	return root;
+}
+
+/*
+ * Find the lowest-numbered edge above number after that runs the
+ * opposite way to n and overlaps or touches it, and return its node,
+ * or -1 if there isn't one.  Only such edges can fix_edges() merge
+ * with n.
+ */
+static int
+tree_find(struct edgenode const *t, int root, struct edgenode const *n,
+    int after)
+{
+	int best, k;
+
+	if (root < 0 || t[root].maxe < n->s) return -1;
+	best = tree_find(t, t[root].left, n, after);
+	if (t[root].s > n->e) return best;
+	if (t[root].e >= n->s && t[root].rising != n->rising &&
+	    t[root].i > after && (best < 0 || t[root].i < t[best].i))
+		best = root;
+	k = tree_find(t, t[root].right, n, after);
+	if (k >= 0 && (best < 0 || t[k].i < t[best].i))
+		best = k;
+	return best;
+}
+
+/*
+ * Where along line l the edge starting at p lies.  Positions are
+ * measured in multiples of the line's direction vector, so comparing
+ * them needs no division.
+ */
+static void
+tree_extent(struct edgeline const *l, point const *p, struct edgenode *n)
+{
+	int a = l->bx * p->v.x + l->by * p->v.y;
+	int a1 = l->bx * p->next->v.x + l->by * p->next->v.y;
+
+	n->rising = a1 > a;
+	n->s = n->rising ? a : a1;
+	n->e = n->rising ? a1 : a;
+}
+
+static int
+edgestart_cmp(void const *va, void const *vb)
+{
+	struct edgeline const *a = va, *b = vb;
+
+	if (a->s != b->s) return a->s < b->s ? -1 : 1;
+	return a->i < b->i ? -1 : a->i > b->i;
+}
+
+/*
+ * Build the tree for the count edges on a line, whose entries in
+ * lines[] start at line.  Those are sorted into the tree's order, and
+ * its right-hand edge so far is kept on a stack, for which the line's
+ * other entries in roots[] are free.
+ */
+static void
+tree_build(struct bedstead_ctx *ctx, int line, int count)
+{
+	struct edgenode *t = ctx->nodes;
+	struct edgeline *l = ctx->lines;
+	int *stack = ctx->roots + line, sp = 0, k, last;
+
+	for (k = line; k < line + count; k++) {
+		tree_extent(&l[k], &ctx->points[l[k].i], &t[k]);
+		l[k].s = t[k].s;
+	}
+	qsort(l + line, count, sizeof(l[0]), edgestart_cmp);
+	for (k = line; k < line + count; k++) {
+		tree_extent(&l[k], &ctx->points[l[k].i], &t[k]);
+		t[k].i = l[k].i;
+		t[k].intree = true;
+		ctx->rank[l[k].i] = k;
+		last = -1;
+		while (sp > 0 && tree_prio(stack[sp - 1]) < tree_prio(k)) {
+			last = stack[--sp];
+			tree_fix(t, last);
+		}
+		t[k].left = last;
+		t[k].right = -1;
+		if (sp > 0) t[stack[sp - 1]].right = k;
+		stack[sp++] = k;
+	}
+	/* This leaves the root at the bottom of the stack. */
+	while (sp > 0)
+		tree_fix(t, stack[--sp]);
+}
+
+/*
+ * Move the edge starting at p to where it now lies in its line's tree,
+ * or take it out if it's gone.
+ */
+static void
+tree_update(struct bedstead_ctx *ctx, point *p)
+{
+	int k = ctx->rank[p - ctx->points];
+	struct edgenode *t = ctx->nodes, n;
+	int *root = &ctx->roots[t[k].line];
+
+	if (!t[k].intree) return;
+	if (p->next == NULL) {
+		*root = tree_delete(t, *root, k);
+		t[k].intree = false;
+		return;
+	}
+	tree_extent(&ctx->lines[t[k].line], p, &n);
+	if (n.s == t[k].s && n.e == t[k].e && n.rising == t[k].rising)
+		return;
+	*root = tree_delete(t, *root, k);
+	t[k].s = n.s;
+	t[k].e = n.e;
+	t[k].rising = n.rising;
+	*root = tree_insert(t, *root, k);
+}
+
+static void
+fix_edges(struct bedstead_ctx *ctx, point *a0, point *b0)
+{
+	point *a1 = a0->next, *b1 = b0->next;
+	point *ap = a0->prev, *bp = b0->prev;
+
+	assert(a1->prev == a0); assert(b1->prev == b0);
+	assert(a0 != a1); assert(a0 != b0);
+	assert(a1 != b1); assert(b0 != b1);
+	if (vec_eqp(vec_bearing(vec_sub(a0->v, a1->v)),
+		    vec_bearing(vec_sub(b1->v, b0->v))) &&
+	    (vec_inline4(a0->v, b1->v, a1->v, b0->v) ||
+	     vec_inline4(a0->v, b1->v, b0->v, a1->v) ||
+	     vec_inline4(b1->v, a0->v, b0->v, a1->v) ||
+	     vec_inline4(b1->v, a0->v, a1->v, b0->v) ||
+	     vec_eqp(a0->v, b1->v) || vec_eqp(a1->v, b0->v))) {
+		a0->next = b1; b1->prev = a0;
+		b0->next = a1; a1->prev = b0;
+		fix_isolated(a0);
+		fix_identical(a0);
+		fix_collinear(b1);
+		fix_isolated(b0);
+		fix_identical(b0);
+		fix_collinear(a1);
+		ctx->done_anything = 1;
+		/* No other edges can have moved or gone. */
+		tree_update(ctx, a0); tree_update(ctx, a1);
+		tree_update(ctx, ap); tree_update(ctx, b0);
+		tree_update(ctx, b1); tree_update(ctx, bp);
+	}
+}
+
+static int
+edgeline_cmp(void const *va, void const *vb)
+{
+	struct edgeline const *a = va, *b = vb;
+
+	if (a->bx != b->bx) return a->bx < b->bx ? -1 : 1;
+	if (a->by != b->by) return a->by < b->by ? -1 : 1;
+	if (a->c != b->c) return a->c < b->c ? -1 : 1;
+	return a->i < b->i ? -1 : a->i > b->i;
+}
+
+static bool
+edgeline_eqp(struct edgeline const *a, struct edgeline const *b)
+{
+
+	return a->bx == b->bx && a->by == b->by && a->c == b->c;
+}
+
+/*
+ * A quick test for whether two edges on the same line run in opposite
+ * directions and overlap or touch, without which fix_edges() won't do
+ * anything.  Positions along the line are measured in multiples of
+ * its direction vector, so this needs no division.  Large bitmaps have
+ * long lines with many edges on them, most of which are far apart.
+ */
+static bool
+edges_meet(point const *a0, point const *b0, struct edgeline const *l)
+{
+	int a = l->bx * a0->v.x + l->by * a0->v.y;
+	int a1 = l->bx * a0->next->v.x + l->by * a0->next->v.y;
+	int b = l->bx * b0->v.x + l->by * b0->v.y;
+	int b1 = l->bx * b0->next->v.x + l->by * b0->next->v.y;
+
+	if ((a1 > a && b1 > b) || (a1 < a && b1 < b)) return false;
+	if (a1 < a) { int t = a; a = a1; a1 = t; }
+	if (b1 < b) { int t = b; b = b1; b1 = t; }
+	return a <= b1 && b <= a1;
+}
+
+/*
+ * fix_edges() can only do anything to a pair of edges that lie on the
+ * same line, run in opposite directions, and overlap or touch.
+ * Nothing that it does moves an edge off the line that it started on:
+ * merged edges stay on their common line, and points are only removed
+ * where that leaves the edge before them pointing the same way.  So we
+ * sort the edges by line once and only try pairs within each group, in
+ * the same order as trying every pair.
+ *
+ * Large bitmaps have long lines with many edges on them, most of which
+ * are far apart.  On those, rather than trying every later edge, we
+ * find the ones that each edge meets in a tree of the line's edges,
+ * ordered by where they start.
+ */
+static void
+clean_path(struct bedstead_ctx *ctx)
+{
+	int i, j, k, r, line, n = ctx->nextpoint;
+	point *points = ctx->points;
+	struct edgeline *lines = ctx->lines;
+	struct edgenode *nodes = ctx->nodes;
+	vec b;
+
+	for (i = 0; i < n; i++) {
+		b = vec_bearing(vec_sub(points[i].next->v, points[i].v));
+		if (b.x < 0 || (b.x == 0 && b.y < 0)) {
+			b.x = -b.x; b.y = -b.y;
+		}
+		lines[i].bx = b.x;
+		lines[i].by = b.y;
+		lines[i].c = b.x * points[i].v.y - b.y * points[i].v.x;
+		lines[i].i = i;
+	}
+	qsort(lines, n, sizeof(lines[0]), edgeline_cmp);
+	for (line = 0; line < n; line = k) {
+		for (k = line; k < n && edgeline_eqp(&lines[k], &lines[line]);
+		     k++) {
+			ctx->rank[lines[k].i] = k;
+			nodes[k].line = line;
+			nodes[k].intree = false;
+		}
+		if (k - line > TREELINE) tree_build(ctx, line, k - line);
+	}
+	do {
+		if (ctx->stats) ctx->stats->rounds++;
+		ctx->done_anything = 0;
+		for (i = 0; i < n; i++) {
+			r = ctx->rank[i];
+			if (nodes[r].intree)
+				for (j = i; points[i].next &&
+					 (k = tree_find(nodes,
+					     ctx->roots[nodes[r].line],
+					     &nodes[r], j)) >= 0;) {
+					j = nodes[k].i;
+					fix_edges(ctx, &points[i], &points[j]);
+				}
+			else
+				for (k = r + 1; points[i].next && k < n &&
+					 edgeline_eqp(&lines[k], &lines[r]);
+				     k++) {
+					j = lines[k].i;
+					if (points[j].next &&
+					    edges_meet(&points[i], &points[j],
+						&lines[k]))
+						fix_edges(ctx, &points[i],
+						    &points[j]);
+				}
+		}
+	} while (ctx->done_anything);
+}
+
+/*
+ * Copy the surviving contours out of the point arena into the
+ * context's outline, moving the baseline, which is yoff above the
+ * bottom of the bitmap, to y = 0.
+ */
+static struct bedstead_outline const *
+finish_path(struct bedstead_ctx *ctx, int yoff)
+{
+	int i, n = 0, nc = 0;
+	point *p, *p1;
+
+	for (i = 0; i < ctx->nextpoint; i++) {
+		p = &ctx->points[i];
+		if (p->next) {
+			ctx->contours[nc++] = n;
+			do {
+				ctx->opoints[n].x = p->v.x;
+				ctx->opoints[n].y = p->v.y - yoff;
+				n++;
+				p1 = p->next;
+				p->prev = p->next = NULL;
+				p = p1;
+			} while (p->next);
+		}
+	}
+	ctx->contours[nc] = n;
+	ctx->outline.ncontours = nc;
+	return &ctx->outline;
+}
+		
+static void
+fragment(struct bedstead_ctx *ctx, int x, int y, struct fragment const *f,
+    bool start)
+{
+	int i;
+
+	for (i = 0; i < f->n; i++)
+		if (start && i == 0)
+			moveto(ctx, x + f->v[i].x, y + f->v[i].y);
+		else
+			lineto(ctx, x + f->v[i].x, y + f->v[i].y);
+}
+
+static void
+blackpixel(struct bedstead_ctx *ctx,
+    int x, int y, int bl, int br, int tr, int tl)
+{
+	struct fragment const (*f)[2] = ctx->frag->black;
+
+	x *= XPIX; y *= YPIX;
+	fragment(ctx, x, y, &f[BL][!bl], true);
+	fragment(ctx, x, y, &f[TL][!tl], false);
+	fragment(ctx, x, y, &f[TR][!tr], false);
+	fragment(ctx, x, y, &f[BR][!br], false);
+	closepath(ctx);
+}
+
+static void
+whitepixel(struct bedstead_ctx *ctx,
+    int x, int y, int bl, int br, int tr, int tl)
+{
+	struct fragment const (*f)[2] = ctx->frag->white;
+
+	x *= XPIX; y *= YPIX;
+	if (bl) {
+		fragment(ctx, x, y, &f[BL][!!br], true);
+		closepath(ctx);
+	}
+	if (tl) {
+		fragment(ctx, x, y, &f[TL][!!bl], true);
+		closepath(ctx);
+	}
+	if (tr) {
+		fragment(ctx, x, y, &f[TR][!!tl], true);
+		closepath(ctx);
+	}
+	if (br) {
+		fragment(ctx, x, y, &f[BR][!!tr], true);
+		closepath(ctx);
+	}
+}
+
+/*
+ * Corner classification.  Each pixel's corners are decided by its
+ * eight neighbours, and the rules are simple enough to apply to every
+ * pixel in a row at once using shifts and boolean operations.  A row
+ * is held with its leftmost pixel in the most significant bit, as in
+ * glyph data, so the pixel to the left of each one is found by
+ * shifting right.  Rows from several glyphs can be handled together by
+ * putting each in its own lane of a 64-bit word: as long as there is a
+ * spare bit between lanes, masking after each shift stops pixels
+ * leaking from one glyph into the next.
+ */
+#if XSIZE > 7
+#error "Rows must fit in an 8-bit lane with a spare bit"
+#endif
+#define ROWMASK ((1U << XSIZE) - 1)
+#define LANES 8
+#define LANEMASK (ROWMASK * UINT64_C(0x0101010101010101))
+
+/* The rules themselves, given a row and its neighbours in each direction. */
+static inline void
+corner_rules(uint64_t P, uint64_t U, uint64_t D, uint64_t L, uint64_t R,
+    uint64_t UL, uint64_t UR, uint64_t DL, uint64_t DR, uint64_t c[4])
+{
+	uint64_t diag1, diag2;
+
+	/* Black pixels: cut diagonals unless that leaves a gap */
+	diag1 = (UL & ~U & ~L) | (DR & ~D & ~R);
+	diag2 = (UR & ~U & ~R) | (DL & ~D & ~L);
+	c[TL] = P & (~diag2 | L | UL | U);
+	c[TR] = P & (~diag1 | R | UR | U);
+	c[BL] = P & (~diag1 | L | DL | D);
+	c[BR] = P & (~diag2 | R | DR | D);
+	/* White pixels: fill in the inside of diagonals */
+	c[TL] |= ~P & L & U & ~UL;
+	c[TR] |= ~P & R & U & ~UR;
+	c[BL] |= ~P & L & D & ~DL;
+	c[BR] |= ~P & R & D & ~DR;
+}
+
+static void
+classify_rows(uint64_t const rows[YSIZE], uint64_t mask,
+    uint64_t c[4][YSIZE])
+{
+	uint64_t U, D, out[4];
+	int y, k;
+
+	for (y = 0; y < YSIZE; y++) {
+		U = y > 0 ? rows[y - 1] : 0;
+		D = y < YSIZE - 1 ? rows[y + 1] : 0;
+		corner_rules(rows[y], U, D,
+		    rows[y] >> 1 & mask, rows[y] << 1 & mask,
+		    U >> 1 & mask, U << 1 & mask,
+		    D >> 1 & mask, D << 1 & mask, out);
+		for (k = 0; k < 4; k++)
+			c[k][y] = out[k];
+	}
+}
+
+void
+bedstead_classify(char const data[YSIZE], struct bedstead_corners *out)
+{
+	uint64_t rows[YSIZE], c[4][YSIZE];
+	int y;
+
+	for (y = 0; y < YSIZE; y++)
+		rows[y] = (unsigned char)data[y] & ROWMASK;
+	classify_rows(rows, ROWMASK, c);
+	for (y = 0; y < YSIZE; y++) {
+		out->tl[y] = c[TL][y]; out->tr[y] = c[TR][y];
+		out->bl[y] = c[BL][y]; out->br[y] = c[BR][y];
+	}
+}
+
+void
+bedstead_classify_many(int n, char const *const data[],
+    struct bedstead_corners out[])
+{
+	uint64_t rows[YSIZE], c[4][YSIZE];
+	int i, k, y;
+
+	for (i = 0; i < n; i += LANES) {
+		for (y = 0; y < YSIZE; y++) {
+			rows[y] = 0;
+			for (k = 0; k < LANES && i + k < n; k++)
+				rows[y] |= (uint64_t)((unsigned char)
+				    data[i + k][y] & ROWMASK) << 8 * k;
+		}
+		classify_rows(rows, LANEMASK, c);
+		for (k = 0; k < LANES && i + k < n; k++)
+			for (y = 0; y < YSIZE; y++) {
+				out[i + k].tl[y] = c[TL][y] >> 8 * k;
+				out[i + k].tr[y] = c[TR][y] >> 8 * k;
+				out[i + k].bl[y] = c[BL][y] >> 8 * k;
+				out[i + k].br[y] = c[BR][y] >> 8 * k;
+			}
+	}
+}
+
+static double
+stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* The time since *t, which is then moved on to now. */
+static double
+stats_lap(double *t)
+{
+	double t0 = *t;
+
+	*t = stats_now();
+	return *t - t0;
+}
+
+static void
+stats_finish(struct glyphstats *st, struct bedstead_outline const *o,
+    double *t)
+{
+
+	st->finishtime += stats_lap(t);
+	st->contours = o->ncontours;
+	st->points = o->contours[o->ncontours];
+}
+
+/* Draw every pixel of a character, without tidying up the result. */
+static void
+draw_char(struct bedstead_ctx *ctx, char const data[YSIZE])
+{
+	struct bedstead_corners c;
+	int x, y, n, black = 0;
+	unsigned bit;
+
+	bedstead_classify(data, &c);
+	clearpath(ctx);
+	for (x = 0; x < XSIZE; x++) {
+		bit = 1U << (XSIZE - x - 1);
+		for (y = 0; y < YSIZE; y++) {
+			if (data[y] & bit) {
+				n = ctx->nextpoint;
+				blackpixel(ctx, x, YSIZE - y - 1,
+				    c.bl[y] & bit, c.br[y] & bit,
+				    c.tr[y] & bit, c.tl[y] & bit);
+				if (ctx->stats)
+					black += ctx->nextpoint - n;
+			} else
+				whitepixel(ctx, x, YSIZE - y - 1,
+				    c.bl[y] & bit, c.br[y] & bit,
+				    c.tr[y] & bit, c.tl[y] & bit);
+		}
+	}
+	if (ctx->stats) {
+		ctx->stats->blackpoints += black;
+		ctx->stats->whitepoints += ctx->nextpoint - black;
+	}
+}
+
+struct bedstead_outline const *
+bedstead_char(struct bedstead_ctx *ctx, char const data[YSIZE],
+    unsigned flags)
+{
+	struct glyphstats *st = ctx->stats;
+	struct bedstead_outline const *o;
+	double t = st ? stats_now() : 0;
+
+	draw_char(ctx, data);
+	if (st) st->drawtime += stats_lap(&t);
+	clean_path(ctx);
+	if (st) st->cleantime += stats_lap(&t);
+	o = finish_path(ctx, 3 * YPIX);
+	if (st) stats_finish(st, o, &t);
+	return o;
+}
+
+/*
+ * Bitmaps of any size.  Rows are classified a 64-bit word at a time,
+ * with neighbouring pixels carried in from the next word along.
+ */
+static uint64_t
+word_left(uint64_t const *row, int w)
+{
+
+	return row[w] >> 1 | (w > 0 ? row[w - 1] << 63 : 0);
+}
+
+static uint64_t
+word_right(uint64_t const *row, int w, int words)
+{
+
+	return row[w] << 1 | (w + 1 < words ? row[w + 1] >> 63 : 0);
+}
+
+struct bedstead_outline const *
+bedstead_image(struct bedstead_ctx *ctx, int width, int height,
+    int descent, unsigned char const *data, size_t stride)
+{
+	struct glyphstats *st = ctx->stats;
+	struct bedstead_outline const *o;
+	double t = st ? stats_now() : 0;
+	int words, x, y, w, k, n, black = 0;
+	size_t need;
+	uint64_t *rows, *c[4], *up, *down, out[4], bit;
+	uint64_t *p;
+
+	if (width < 0 || height < 0 ||
+	    (width > 0 && height > INT_MAX / PIXELPOINTS / width))
+		return NULL;
+	words = (width + 63) / 64;
+	need = (size_t)5 * height * words;
+	if (need > ctx->scratchsize) {
+		p = realloc(ctx->scratch, need * sizeof(p[0]));
+		if (p == NULL) return NULL;
+		ctx->scratch = p;
+		ctx->scratchsize = need;
+	}
+	if (reserve_points(ctx, width * height * PIXELPOINTS) != 0)
+		return NULL;
+	rows = ctx->scratch;
+	for (k = 0; k < 4; k++)
+		c[k] = rows + (size_t)(k + 1) * height * words;
+	/* Unpack the rows, leftmost pixel in the top bit of a word. */
+	memset(rows, 0, (size_t)height * words * sizeof(rows[0]));
+	for (y = 0; y < height; y++)
+		for (x = 0; x < (width + 7) / 8; x++)
+			rows[y * words + x / 8] |= (uint64_t)data[y * stride + x]
+			    << (56 - 8 * (x % 8));
+	if (width % 64)
+		for (y = 0; y < height; y++)
+			rows[y * words + words - 1] &=
+			    ~(uint64_t)0 << (64 - width % 64);
+	for (y = 0; y < height; y++) {
+		p = rows + y * words;
+		up = y > 0 ? p - words : NULL;
+		down = y < height - 1 ? p + words : NULL;
+		for (w = 0; w < words; w++) {
+			corner_rules(p[w], up ? up[w] : 0, down ? down[w] : 0,
+			    word_left(p, w), word_right(p, w, words),
+			    up ? word_left(up, w) : 0,
+			    up ? word_right(up, w, words) : 0,
+			    down ? word_left(down, w) : 0,
+			    down ? word_right(down, w, words) : 0, out);
+			for (k = 0; k < 4; k++)
+				c[k][y * words + w] = out[k];
+		}
+	}
+	clearpath(ctx);
+	for (x = 0; x < width; x++) {
+		w = x / 64;
+		bit = (uint64_t)1 << (63 - x % 64);
+		for (y = 0; y < height; y++) {
+			k = y * words + w;
+			if (rows[k] & bit) {
+				n = ctx->nextpoint;
+				blackpixel(ctx, x, height - y - 1,
+				    (c[BL][k] & bit) != 0,
+				    (c[BR][k] & bit) != 0,
+				    (c[TR][k] & bit) != 0,
+				    (c[TL][k] & bit) != 0);
+				if (st) black += ctx->nextpoint - n;
+			} else
+				whitepixel(ctx, x, height - y - 1,
+				    (c[BL][k] & bit) != 0,
+				    (c[BR][k] & bit) != 0,
+				    (c[TR][k] & bit) != 0,
+				    (c[TL][k] & bit) != 0);
+		}
+	}
+	if (st) {
+		st->blackpoints += black;
+		st->whitepoints += ctx->nextpoint - black;
+		st->drawtime += stats_lap(&t);
+	}
+	clean_path(ctx);
+	if (st) st->cleantime += stats_lap(&t);
+	o = finish_path(ctx, descent * YPIX);
+	if (st) stats_finish(st, o, &t);
+	return o;
+}
+
+static void
+tile(struct bedstead_ctx *ctx, int x0, int y0, int x1, int y1)
+{
+	x0 *= XPIX; y0 *= YPIX;
+	x1 *= XPIX; y1 *= YPIX;
+	moveto(ctx, x0, y0); lineto(ctx, x0, y1);
+	lineto(ctx, x1, y1); lineto(ctx, x1, y0);
+	closepath(ctx);
+}
+	
+struct bedstead_outline const *
+bedstead_mosaic(struct bedstead_ctx *ctx, unsigned code, bool sep)
+{
+	struct glyphstats *st = ctx->stats;
+	struct bedstead_outline const *o;
+	double t = st ? stats_now() : 0;
+
+	clearpath(ctx);
+	if (code & 1)  tile(ctx, 0 + sep, 8 + sep, 3, 11);
+	if (code & 2)  tile(ctx, 3 + sep, 8 + sep, 6, 11);
+	if (code & 4)  tile(ctx, 0 + sep, 4 + sep, 3, 8);
+	if (code & 8)  tile(ctx, 3 + sep, 4 + sep, 6, 8);
+	if (code & 16) tile(ctx, 0 + sep, 1 + sep, 3, 4);
+	if (code & 64) tile(ctx, 3 + sep, 1 + sep, 6, 4);
+	if (st) {
+		st->tilepoints += ctx->nextpoint;
+		st->drawtime += stats_lap(&t);
+	}
+	clean_path(ctx);
+	if (st) st->cleantime += stats_lap(&t);
+	o = finish_path(ctx, 3 * YPIX);
+	if (st) stats_finish(st, o, &t);
+	return o;
+}
+
+struct bedstead_outline const *
+bedstead_glyph(struct bedstead_ctx *ctx, struct glyph const *g)
+{
+
+	if (g->flags & MOS)
+		return bedstead_mosaic(ctx, g->data[0],
+		    (g->data[0] & 0x20) != 0);
+	return bedstead_char(ctx, g->data, g->flags);
+}
+
+struct bedstead_outline const *
+bedstead_rescale(struct bedstead_ctx *ctx, struct bedstead_outline const *o,
+    int xpix)
+{
+	int i, n = o->contours[o->ncontours];
+
+	if (xpix <= 0 || xpix % 4 != 0 || XPIX % 4 != 0) return NULL;
+	/* o may be this context's own outline, which is already big enough. */
+	if (o != &ctx->outline && reserve_points(ctx, n) != 0) return NULL;
+	for (i = 0; i < n; i++) {
+		ctx->opoints[i].x = o->points[i].x / (xpix / 4) * XQTR;
+		ctx->opoints[i].y = o->points[i].y;
+	}
+	memmove(ctx->contours, o->contours,
+	    (o->ncontours + 1) * sizeof(ctx->contours[0]));
+	ctx->outline.ncontours = o->ncontours;
+	return &ctx->outline;
+}
+
+/*
+ * Bitmaps.  The cell is XSIZE by YSIZE pixels, with the baseline two
+ * pixels from the bottom, which puts the character matrix one row
+ * down from the top.  The rounded form is what the SAA5050 displays:
+ * every pixel is doubled in each direction, and a white pixel that
+ * sits in the inside corner of a diagonal gets that corner filled in.
+ * These are exactly what the outlines rasterise to at 10 and 20
+ * pixels.  The bottom row of glyph data, which no glyph uses, falls
+ * outside the cell.
+ */
+/* Spread the bits of v out to every other bit. */
+static unsigned
+spread(unsigned v)
+{
+	unsigned r = 0;
+	int x;
+
+	for (x = 0; v >> x != 0; x++)
+		if (v & 1U << x) r |= 1U << 2 * x;
+	return r;
+}
+
+static void
+glyph_bitmap(struct glyph const *g, struct bedstead_corners const *c,
+    bool rounded, unsigned rows[2 * YSIZE])
+{
+	int x, y, s = rounded ? 2 : 1;
+	unsigned p;
+
+	memset(rows, 0, 2 * YSIZE * sizeof(rows[0]));
+	if (g->flags & MOS) {
+		unsigned code = g->data[0];
+		int sep = (code & 0x20) != 0;
+		/* The same tiles as in bedstead_mosaic(), upside-down. */
+		static struct { int bit, x0, y0, x1, y1; } const tiles[] = {
+			{ 1, 0, 0, 3, 3 }, { 2, 3, 0, 6, 3 },
+			{ 4, 0, 3, 3, 7 }, { 8, 3, 3, 6, 7 },
+			{ 16, 0, 7, 3, 10 }, { 64, 3, 7, 6, 10 },
+		};
+		int t;
+
+		for (t = 0; t < 6; t++) {
+			if (!(code & tiles[t].bit)) continue;
+			for (y = s * tiles[t].y0; y < s * (tiles[t].y1 - sep);
+			     y++)
+				for (x = s * (tiles[t].x0 + sep);
+				     x < s * tiles[t].x1; x++)
+					rows[y] |= 1U << (s * XSIZE - x - 1);
+		}
+		return;
+	}
+	for (y = 0; y < YSIZE - 1; y++) {
+		p = (unsigned char)g->data[y] & ROWMASK;
+		if (!rounded) {
+			rows[y + 1] = p;
+			continue;
+		}
+		/*
+		 * Black pixels fill all four quarters, so their own
+		 * corner bits make no difference.
+		 */
+		rows[2 * y + 2] = spread(p) * 3 |
+		    spread(c->tl[y]) << 1 | spread(c->tr[y]);
+		rows[2 * y + 3] = spread(p) * 3 |
+		    spread(c->bl[y]) << 1 | spread(c->br[y]);
+	}
+}
+
+void
+bedstead_bitmap(struct glyph const *g, bool rounded,
+    unsigned rows[2 * YSIZE])
+{
+	struct bedstead_corners c;
+
+	bedstead_classify(g->data, &c);
+	glyph_bitmap(g, &c, rounded, rows);
+}
+
+void
+bedstead_bitmaps(int n, struct glyph const *g, bool rounded,
+    unsigned (*rows)[2 * YSIZE])
+{
+	char const *data[LANES];
+	struct bedstead_corners c[LANES];
+	int i, k;
+
+	for (i = 0; i < n; i += LANES) {
+		for (k = 0; k < LANES && i + k < n; k++)
+			data[k] = g[i + k].data;
+		bedstead_classify_many(k, data, c);
+		for (k = 0; k < LANES && i + k < n; k++)
+			glyph_bitmap(&g[i + k], &c[k], rounded, rows[i + k]);
+	}
+}
+
+/*
+ * Teletext pages.  Every character's rounded bitmap is worked out when
+ * the renderer is made, so drawing a page is just following the
+ * spacing attributes along each row and copying bitmaps.  Each
+ * bitmap row is turned into pixels eight or four at a time, using a
+ * table of byte masks to choose between the foreground and background
+ * colours in every byte of a word at once.
+ */
+
+#define CELLW (2 * XSIZE)
+#define CELLH (2 * YSIZE)
+
+struct bedstead_teletext {
+	/* Alphanumerics from 0x20, then contiguous and separated mosaics. */
+	uint16_t alpha[NNATIONAL][96][CELLH];
+	uint16_t mosaic[2][64][CELLH];
+	uint16_t blank[CELLH];
+	uint64_t mask8[256];	/* A byte of 0xff for each bit */
+	uint32_t mask4[16];
+};
+
+/*
+ * The glyph for a character, in the form peculiar to one chip if it has
+ * one, or the replacement character if there isn't one at all.
+ */
+static struct glyph const *
+teletext_glyph(int unicode, char const *suffix)
+{
+	struct glyph const *g = NULL, *replacement = NULL;
+	size_t len;
+	int i;
+
+	for (i = 0; i < nglyphs && g == NULL; i++) {
+		if (glyphs[i].unicode == unicode) g = &glyphs[i];
+		if (glyphs[i].unicode == 0xfffd) replacement = &glyphs[i];
+	}
+	if (g == NULL) {
+		for (; replacement == NULL && i < nglyphs; i++)
+			if (glyphs[i].unicode == 0xfffd)
+				replacement = &glyphs[i];
+		return replacement;
+	}
+	if (suffix == NULL || g->name == NULL) return g;
+	len = strlen(g->name);
+	for (i = 0; i < nglyphs; i++)
+		if (glyphs[i].name != NULL &&
+		    strncmp(glyphs[i].name, g->name, len) == 0 &&
+		    glyphs[i].name[len] == '.' &&
+		    strcmp(glyphs[i].name + len + 1, suffix) == 0)
+			return &glyphs[i];
+	return g;
+}
+
+struct bedstead_teletext *
+bedstead_teletext_new(void)
+{
+	struct bedstead_teletext *tt;
+	struct glyph *g, *m;
+	unsigned (*rows)[CELLH];
+	unsigned char b[8];
+	int n = NNATIONAL * 96 + 2 * 64, i, k, c, y;
+
+	tt = malloc(sizeof(*tt));
+	g = malloc(n * sizeof(g[0]));
+	rows = malloc(n * sizeof(rows[0]));
+	if (tt == NULL || g == NULL || rows == NULL) {
+		free(tt); free(g); free(rows);
+		return NULL;
+	}
+	/* The Latin G0 set is ASCII apart from these. */
+	for (i = 0; i < NNATIONAL; i++)
+		for (c = 0x20; c < 0x80; c++) {
+			k = c == 0x24 ? 0x00a4 : c == 0x7c ? 0x00a6 :
+			    c == 0x7f ? 0x25a0 : c;
+			g[i * 96 + c - 0x20] = *teletext_glyph(k, NULL);
+		}
+	for (i = 0; i < NNATIONAL; i++)
+		for (k = 0; k < 13; k++)
+			g[i * 96 + national_codes[k] - 0x20] =
+			    *teletext_glyph(national_options[i].unicode[k],
+				national_options[i].suffix);
+	/* Some chips have their own forms of ASCII characters, too. */
+	for (i = 0; i < NNATIONAL; i++) {
+		if (national_options[i].suffix == NULL) continue;
+		for (c = 0x20; c < 0x80; c++) {
+			m = &g[i * 96 + c - 0x20];
+			if (m->unicode == c)
+				*m = *teletext_glyph(c,
+				    national_options[i].suffix);
+		}
+	}
+	/*
+	 * Bit 5 of a mosaic code is always set, so glyph_bitmap() takes
+	 * it to mean "separated" instead.
+	 */
+	for (k = 0; k < 2; k++)
+		for (c = 0; c < 64; c++) {
+			m = &g[NNATIONAL * 96 + k * 64 + c];
+			memset(m, 0, sizeof(*m));
+			m->data[0] = (c & 0x1f) | (c & 0x20) << 1 | k << 5;
+			m->flags = MOS;
+		}
+	bedstead_bitmaps(n, g, true, rows);
+	for (i = 0; i < NNATIONAL; i++)
+		for (c = 0; c < 96; c++)
+			for (y = 0; y < CELLH; y++)
+				tt->alpha[i][c][y] = rows[i * 96 + c][y];
+	for (k = 0; k < 2; k++)
+		for (c = 0; c < 64; c++)
+			for (y = 0; y < CELLH; y++)
+				tt->mosaic[k][c][y] =
+				    rows[NNATIONAL * 96 + k * 64 + c][y];
+	memset(tt->blank, 0, sizeof(tt->blank));
+	/* The masks are built bytewise so as not to care about byte order. */
+	for (i = 0; i < 256; i++) {
+		for (k = 0; k < 8; k++)
+			b[k] = i & 0x80 >> k ? 0xff : 0;
+		memcpy(&tt->mask8[i], b, 8);
+		if (i < 16) {
+			for (k = 0; k < 4; k++)
+				b[k] = i & 0x8 >> k ? 0xff : 0;
+			memcpy(&tt->mask4[i], b, 4);
+		}
+	}
+	free(g);
+	free(rows);
+	return tt;
+}
+
+void
+bedstead_teletext_free(struct bedstead_teletext *tt)
+{
+
+	free(tt);
+}
+
+/*
+ * Draw one row of cells.  half is 0 for normal height only, 1 for the
+ * top halves of double-height characters, and 2 for the row below,
+ * which shows their bottom halves and nothing else.  Returns whether
+ * there were any double-height characters.
+ */
+static bool
+teletext_row(struct bedstead_teletext const *tt, unsigned char const *codes,
+    int national, unsigned flags, int half, unsigned char *out,
+    size_t stride)
+{
+	uint16_t const *rows;
+	uint64_t bg8, x8, w8;
+	uint32_t bg4, x4, w4;
+	unsigned char *p;
+	unsigned bits;
+	int c, code, y, fg = 7, bg = 0, held = 0;
+	bool graphics = false, sep = false, heldsep = false, hold = false;
+	bool flash = false, conceal = false, dh = false, any = false;
+
+	for (c = 0; c < PAGE_COLS; c++) {
+		code = codes[c] & 0x7f;
+		/* Set-at attributes take effect in their own cell. */
+		switch (code) {
+		case 0x09: flash = false; break;
+		case 0x0c: if (dh) held = 0; dh = false; break;
+		case 0x18: conceal = true; break;
+		case 0x19: sep = false; break;
+		case 0x1a: sep = true; break;
+		case 0x1c: bg = 0; break;
+		case 0x1d: bg = fg; break;
+		case 0x1e: hold = true; break;
+		}
+		if (code < 0x20)
+			rows = hold && graphics ? tt->mosaic[heldsep][held] :
+			    tt->blank;
+		else if (graphics && (code & 0x20)) {
+			held = (code & 0x1f) | (code & 0x40) >> 1;
+			heldsep = sep;
+			rows = tt->mosaic[sep][held];
+		} else
+			rows = tt->alpha[national][code - 0x20];
+		if ((flash && (flags & PAGE_FLASHOFF)) ||
+		    (conceal && !(flags & PAGE_REVEAL)) ||
+		    (half == 2 && !dh))
+			rows = tt->blank;
+		if (dh && half == 2) rows += YSIZE;
+		any |= dh;
+
+		bg8 = bg * UINT64_C(0x0101010101010101);
+		x8 = (fg ^ bg) * UINT64_C(0x0101010101010101);
+		bg4 = bg8; x4 = x8;
+		p = out + c * CELLW;
+		for (y = 0; y < CELLH; y++, p += stride) {
+			bits = rows[dh && half ? y / 2 : y];
+			/* Set bits turn bg into bg ^ (fg ^ bg) = fg. */
+			w8 = bg8 ^ (x8 & tt->mask8[bits >> 4]);
+			w4 = bg4 ^ (x4 & tt->mask4[bits & 0xf]);
+			memcpy(p, &w8, 8);
+			memcpy(p + 8, &w4, 4);
+		}
+
+		/* Set-after attributes take effect in the next cell. */
+		switch (code) {
+		case 0x01: case 0x02: case 0x03: case 0x04:
+		case 0x05: case 0x06: case 0x07:
+			fg = code;
+			if (graphics) held = 0;
+			graphics = conceal = false;
+			break;
+		case 0x08: flash = true; break;
+		case 0x0d: if (!dh) held = 0; dh = half != 0; break;
+		case 0x11: case 0x12: case 0x13: case 0x14:
+		case 0x15: case 0x16: case 0x17:
+			fg = code & 7;
+			if (!graphics) held = 0;
+			graphics = true;
+			conceal = false;
+			break;
+		case 0x1f: hold = false; break;
+		}
+	}
+	return any;
+}
+
+void
+bedstead_teletext_page(struct bedstead_teletext const *tt,
+    unsigned char const page[PAGE_ROWS][PAGE_COLS], int national,
+    unsigned flags, unsigned char *out, size_t stride)
+{
+	int r;
+
+	if (national < 0 || national >= NNATIONAL)
+		national = NATIONAL_ENGLISH;
+	for (r = 0; r < PAGE_ROWS; r++)
+		/* A double-height row takes over the one below it. */
+		if (teletext_row(tt, page[r], national, flags,
+		    r < PAGE_ROWS - 1, out + r * CELLH * stride, stride)) {
+			r++;
+			teletext_row(tt, page[r - 1], national, flags, 2,
+			    out + r * CELLH * stride, stride);
+		}
+}
+
+/*
+ * DRCS.  Each entry holds a copy of its outline, so it lives for as
+ * long as the entry does.  Entries are found through a hash table of
+ * chains and kept on a list from most to least recently used, and an
+ * entry that someone still holds is never evicted.  Outlines are made
+ * without the lock held, using a context from a small pool, so threads
+ * missing the cache at the same time don't wait for each other.
+ */
+
+#define DRCS_IDLE 8		/* Spare contexts kept in the pool */
+#define DRCS_ROWMASK ((1U << DRCS_WIDTH) - 1)
+
+#if DRCS_HEIGHT != YSIZE
+#error "DRCS rows are classified as a character's are"
+#endif
+
+struct drcs_entry {
+	struct bedstead_drcs_glyph glyph;	/* Must be first */
+	unsigned key[DRCS_HEIGHT];
+	unsigned hash;
+	int refs;
+	struct drcs_entry *chain;		/* In the hash table */
+	struct drcs_entry *prev, *next;		/* In use order */
+};
+
+struct bedstead_drcs {
+	struct param param;			/* For drawing, at width 4 */
+	int xpix;				/* Of the pixels wanted */
+	int max, n;
+	unsigned mask;
+	struct drcs_entry **table;
+	struct drcs_entry *mru, *lru;
+	struct bedstead_ctx *idle[DRCS_IDLE];
+	int nidle;
+	pthread_mutex_t lock;
+};
+
+struct bedstead_drcs *
+bedstead_drcs_new(struct param const *param, int max)
+{
+	struct bedstead_drcs *dc;
+	unsigned size = 16;
+
+	if (max < 1) max = 1;
+	while (size < (unsigned)max && size < 0x10000000U)
+		size *= 2;
+	dc = malloc(sizeof(*dc));
+	if (dc == NULL) return NULL;
+	dc->table = calloc(size, sizeof(dc->table[0]));
+	if (dc->table == NULL) {
+		free(dc);
+		return NULL;
+	}
+	dc->param = *param;
+	dc->param.xpix = 4;
+	dc->xpix = param->xpix / 2;
+	dc->max = max;
+	dc->n = 0;
+	dc->mask = size - 1;
+	dc->mru = dc->lru = NULL;
+	dc->nidle = 0;
+	pthread_mutex_init(&dc->lock, NULL);
+	return dc;
+}
+
+static void
+drcs_free_entry(struct drcs_entry *e)
+{
+
+	free((int *)e->glyph.outline.contours);
+	free((struct bedstead_vec *)e->glyph.outline.points);
+	free(e);
+}
+
+void
+bedstead_drcs_free(struct bedstead_drcs *dc)
+{
+	struct drcs_entry *e, *next;
+	int i;
+
+	for (e = dc->mru; e != NULL; e = next) {
+		next = e->next;
+		drcs_free_entry(e);
+	}
+	for (i = 0; i < dc->nidle; i++)
+		bedstead_free(dc->idle[i]);
+	pthread_mutex_destroy(&dc->lock);
+	free(dc->table);
+	free(dc);
+}
+
+static unsigned
+drcs_hash(unsigned const rows[DRCS_HEIGHT])
+{
+	unsigned h = 2166136261U;
+	int y;
+
+	for (y = 0; y < DRCS_HEIGHT; y++) {
+		h = (h ^ (rows[y] & 0xff)) * 16777619U;
+		h = (h ^ rows[y] >> 8) * 16777619U;
+	}
+	return h;
+}
+
+static struct drcs_entry *
+drcs_find(struct bedstead_drcs *dc, unsigned const key[DRCS_HEIGHT],
+    unsigned hash)
+{
+	struct drcs_entry *e;
+
+	for (e = dc->table[hash & dc->mask]; e != NULL; e = e->chain)
+		if (e->hash == hash &&
+		    memcmp(e->key, key, sizeof(e->key)) == 0)
+			return e;
+	return NULL;
+}
+
+static void
+drcs_unlink(struct bedstead_drcs *dc, struct drcs_entry *e)
+{
+
+	if (e->prev) e->prev->next = e->next;
+	else dc->mru = e->next;
+	if (e->next) e->next->prev = e->prev;
+	else dc->lru = e->prev;
+}
+
+static void
+drcs_touch(struct bedstead_drcs *dc, struct drcs_entry *e)
+{
+
+	drcs_unlink(dc, e);
+	e->prev = NULL;
+	e->next = dc->mru;
+	if (dc->mru) dc->mru->prev = e;
+	else dc->lru = e;
+	dc->mru = e;
+}
+
+/* Throw out unheld entries, least recently used first, down to max. */
 static void
-domosaic(unsigned code, bool sep)
+drcs_evict(struct bedstead_drcs *dc)
+{
+	struct drcs_entry *e, *prev, **pp;
+
+	for (e = dc->lru; e != NULL && dc->n > dc->max; e = prev) {
+		prev = e->prev;
+		if (e->refs > 0) continue;
+		for (pp = &dc->table[e->hash & dc->mask]; *pp != e;
+		     pp = &(*pp)->chain)
+			continue;
+		*pp = e->chain;
+		drcs_unlink(dc, e);
+		drcs_free_entry(e);
+		dc->n--;
+	}
+}
+
+/* Make a new entry, with the lock not held. */
+static struct drcs_entry *
+drcs_make(struct bedstead_ctx *ctx, unsigned const key[DRCS_HEIGHT],
+    int xpix)
+{
+	struct drcs_entry *e;
+	struct bedstead_outline const *o;
+	unsigned char data[DRCS_HEIGHT][2];
+	uint64_t rows[YSIZE], c[4][YSIZE];
+	int *contours;
+	struct bedstead_vec *points;
+	unsigned p;
+	int i, y, n;
+
+	e = malloc(sizeof(*e));
+	if (e == NULL) return NULL;
+	memcpy(e->key, key, sizeof(e->key));
+	for (y = 0; y < DRCS_HEIGHT; y++) {
+		data[y][0] = key[y] >> 4;
+		data[y][1] = key[y] << 4;
+	}
+	/* The whole cell is the bitmap, and its baseline is two up. */
+	o = bedstead_image(ctx, DRCS_WIDTH, DRCS_HEIGHT, 2, data[0], 2);
+	if (o == NULL) {
+		free(e);
+		return NULL;
+	}
+	n = o->contours[o->ncontours];
+	contours = malloc((o->ncontours + 1) * sizeof(contours[0]));
+	points = malloc((n + 1) * sizeof(points[0]));
+	if (contours == NULL || points == NULL) {
+		free(contours);
+		free(points);
+		free(e);
+		return NULL;
+	}
+	memcpy(contours, o->contours, (o->ncontours + 1) * sizeof(contours[0]));
+	/*
+	 * Half a character's pixel isn't usually a multiple of 4 wide,
+	 * so drawing at that width would put the diagonals out of line.
+	 * Instead they're drawn at width 4, where every point is a whole
+	 * number of quarter pixels across, and rounded once scaled.
+	 */
+	for (i = 0; i < n; i++) {
+		points[i].x = (o->points[i].x * xpix + 2) / 4;
+		points[i].y = o->points[i].y;
+	}
+	e->glyph.outline.ncontours = o->ncontours;
+	e->glyph.outline.contours = contours;
+	e->glyph.outline.points = points;
+
+	/* Rounded just as glyph_bitmap() rounds characters. */
+	for (y = 0; y < YSIZE; y++)
+		rows[y] = key[y];
+	classify_rows(rows, DRCS_ROWMASK, c);
+	for (y = 0; y < DRCS_HEIGHT; y++) {
+		p = spread(key[y]) * 3;
+		e->glyph.rows[2 * y] = p |
+		    spread(c[TL][y]) << 1 | spread(c[TR][y]);
+		e->glyph.rows[2 * y + 1] = p |
+		    spread(c[BL][y]) << 1 | spread(c[BR][y]);
+	}
+	return e;
+}
+
+struct bedstead_drcs_glyph const *
+bedstead_drcs_get(struct bedstead_drcs *dc, unsigned const rows[DRCS_HEIGHT])
+{
+	unsigned key[DRCS_HEIGHT], hash;
+	struct drcs_entry *e, *made;
+	struct bedstead_ctx *ctx;
+	int y;
+
+	for (y = 0; y < DRCS_HEIGHT; y++)
+		key[y] = rows[y] & DRCS_ROWMASK;
+	hash = drcs_hash(key);
+	pthread_mutex_lock(&dc->lock);
+	e = drcs_find(dc, key, hash);
+	if (e == NULL) {
+		ctx = dc->nidle > 0 ? dc->idle[--dc->nidle] : NULL;
+		pthread_mutex_unlock(&dc->lock);
+		if (ctx == NULL) ctx = bedstead_new(&dc->param);
+		made = ctx ? drcs_make(ctx, key, dc->xpix) : NULL;
+		pthread_mutex_lock(&dc->lock);
+		if (ctx != NULL && dc->nidle < DRCS_IDLE)
+			dc->idle[dc->nidle++] = ctx;
+		else if (ctx != NULL)
+			bedstead_free(ctx);
+		if (made == NULL) {
+			pthread_mutex_unlock(&dc->lock);
+			return NULL;
+		}
+		/* Someone else may have made it in the meantime. */
+		e = drcs_find(dc, key, hash);
+		if (e != NULL)
+			drcs_free_entry(made);
+		else {
+			e = made;
+			e->hash = hash;
+			e->refs = 0;
+			e->chain = dc->table[hash & dc->mask];
+			dc->table[hash & dc->mask] = e;
+			e->prev = NULL;
+			e->next = dc->mru;
+			if (dc->mru) dc->mru->prev = e;
+			else dc->lru = e;
+			dc->mru = e;
+			dc->n++;
+		}
+	} else
+		drcs_touch(dc, e);
+	e->refs++;
+	drcs_evict(dc);
+	pthread_mutex_unlock(&dc->lock);
+	return &e->glyph;
+}
+
+void
+bedstead_drcs_put(struct bedstead_drcs *dc,
+    struct bedstead_drcs_glyph const *g)
 {
+	struct drcs_entry *e = (struct drcs_entry *)g;
 
-	clearpath();
-	if (code & 1)  tile(0 + sep, 8 + sep, 3, 11);
-	if (code & 2)  tile(3 + sep, 8 + sep, 6, 11);
-	if (code & 4)  tile(0 + sep, 4 + sep, 3, 8);
-	if (code & 8)  tile(3 + sep, 4 + sep, 6, 8);
-	if (code & 16) tile(0 + sep, 1 + sep, 3, 4);
-	if (code & 64) tile(3 + sep, 1 + sep, 6, 4);
-	clean_path();
-	emit_path();
+	pthread_mutex_lock(&dc->lock);
+	e->refs--;
+	drcs_evict(dc);
+	pthread_mutex_unlock(&dc->lock);
 }
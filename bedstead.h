@@ -0,0 +1,196 @@
+/*
+ * Interface to the Bedstead outline engine.
+ *
+ * Written by Ben Harris <bjh21@bjh21.me.uk> and Simon Tatham
+ * <anakin@pobox.com>.
+ *
+ * To the extent possible under law, Ben Harris and Simon Tatham have
+ * dedicated all copyright and related and neighboring rights to this
+ * software to the public domain worldwide.  This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+/*
+ * The outline engine turns a bitmap into a set of closed contours.
+ * All of its working state lives in a struct bedstead_ctx, so separate
+ * contexts can be used from separate threads at the same time.  A
+ * context is not itself thread-safe.
+ *
+ * The outline returned by bedstead_char() and friends belongs to the
+ * context and remains valid until the next call on that context.
+ * Coordinates are in font design units with the baseline at y = 0.
+ * Each contour is closed: its last point joins back to its first.
+ */
+
+#ifndef BEDSTEAD_H
+#define BEDSTEAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define XSIZE 6
+#define YSIZE 10
+
+/* Design parameters.  See bedstead.c for what they mean. */
+struct param {
+	char const * fontname;
+	char const * fullname;
+	int xpix;
+	int ttfwidth;
+};
+
+extern struct param const default_param;
+extern struct param const extended_param;
+
+struct glyph {
+	char data[YSIZE];
+	int unicode;
+	char const *name;
+	unsigned int flags;
+#define SC  0x01 /* Character has a small-caps variant. */
+#define MOS 0x02 /* Mosaic graphics character */
+};
+
+extern struct glyph const glyphs[];
+extern int const nglyphs;
+
+struct bedstead_vec {
+	int x, y;
+};
+
+struct bedstead_outline {
+	int ncontours;
+	/* Contour i is points[contours[i]] to points[contours[i+1] - 1]. */
+	int const *contours;
+	struct bedstead_vec const *points;
+};
+
+struct bedstead_ctx;
+
+struct bedstead_ctx *bedstead_new(struct param const *);
+void bedstead_free(struct bedstead_ctx *);
+struct bedstead_outline const *bedstead_char(struct bedstead_ctx *,
+    char const data[YSIZE], unsigned flags);
+struct bedstead_outline const *bedstead_mosaic(struct bedstead_ctx *,
+    unsigned code, bool sep);
+struct bedstead_outline const *bedstead_glyph(struct bedstead_ctx *,
+    struct glyph const *);
+
+/*
+ * The outline of a bitmap of any size, such as a DRCS character or a
+ * whole tile.  Row y starts at data + y * stride, with the leftmost
+ * pixel in the most significant bit of its first byte, as in BDF and
+ * PBM files.  The bottom descent rows are below the baseline.  Returns
+ * NULL if there isn't enough memory.
+ */
+struct bedstead_outline const *bedstead_image(struct bedstead_ctx *,
+    int width, int height, int descent, unsigned char const *data,
+    size_t stride);
+
+/*
+ * The outline that o, made by a context whose pixels are xpix units
+ * wide, would have been if this context had made it.  Which corners
+ * are cut and which edges merge doesn't depend on the width of the
+ * pixels, only on which points are in line, and so long as both
+ * widths are multiples of 4 every point is a whole number of quarter
+ * pixels across and only the x coordinates change.  Returns NULL if
+ * either width isn't a multiple of 4 or there isn't enough memory.
+ */
+struct bedstead_outline const *bedstead_rescale(struct bedstead_ctx *,
+    struct bedstead_outline const *o, int xpix);
+
+/*
+ * A glyph's bitmap as the SAA5050 would show it, either XSIZE by YSIZE
+ * or, with character rounding, twice that in each direction.  Row 0 is
+ * the top of the cell, and the leftmost pixel is the most significant
+ * bit of an XSIZE- or 2*XSIZE-bit number.
+ */
+void bedstead_bitmap(struct glyph const *, bool rounded,
+    unsigned rows[2 * YSIZE]);
+void bedstead_bitmaps(int n, struct glyph const *, bool rounded,
+    unsigned (*rows)[2 * YSIZE]);
+
+/*
+ * How each pixel's corners are drawn.  Bit (XSIZE - x - 1) of tl[y]
+ * is set if the top-left corner of pixel (x, y) is filled: for a black
+ * pixel, if it keeps that corner, and for a white pixel, if it gains
+ * it to fill in a diagonal.  bedstead_classify_many() gives the same
+ * answers for n glyphs, but handles several at a time.
+ */
+struct bedstead_corners {
+	unsigned char tl[YSIZE], tr[YSIZE], bl[YSIZE], br[YSIZE];
+};
+
+void bedstead_classify(char const data[YSIZE], struct bedstead_corners *);
+void bedstead_classify_many(int n, char const *const data[],
+    struct bedstead_corners[]);
+
+/*
+ * Teletext pages, drawn exactly as an SAA5050 would draw them.  A page
+ * is PAGE_ROWS rows of PAGE_COLS 7-bit codes, with parity removed,
+ * using the level 1 spacing attributes for colour, flashing,
+ * concealment, double height and contiguous, separated and held
+ * mosaics.  Each cell is the 2*XSIZE by 2*YSIZE rounded bitmap, and
+ * each pixel of the result is one byte holding a colour number from
+ * 0 (black) to 7 (white), with red, green and blue in bits 0, 1 and 2.
+ *
+ * A struct bedstead_teletext holds every character's bitmap.  It's
+ * never changed after bedstead_teletext_new() returns, so it can be
+ * shared between threads.
+ */
+#define PAGE_COLS 40
+#define PAGE_ROWS 25
+#define PAGE_WIDTH (PAGE_COLS * 2 * XSIZE)
+#define PAGE_HEIGHT (PAGE_ROWS * 2 * YSIZE)
+
+/* National option subsets, numbered as by bits C12-C14 in Europe. */
+enum { NATIONAL_ENGLISH, NATIONAL_GERMAN, NATIONAL_SWEDISH,
+       NATIONAL_ITALIAN, NATIONAL_FRENCH, NATIONAL_SPANISH,
+       NATIONAL_CZECH, NNATIONAL };
+
+#define PAGE_REVEAL	0x01 /* Show concealed characters */
+#define PAGE_FLASHOFF	0x02 /* Draw flashing characters as hidden */
+
+struct bedstead_teletext;
+
+struct bedstead_teletext *bedstead_teletext_new(void);
+void bedstead_teletext_free(struct bedstead_teletext *);
+void bedstead_teletext_page(struct bedstead_teletext const *,
+    unsigned char const page[PAGE_ROWS][PAGE_COLS], int national,
+    unsigned flags, unsigned char *out, size_t stride);
+
+/*
+ * Dynamically redefinable characters, as sent by level 2.5 and 3.5
+ * services.  Each is DRCS_WIDTH by DRCS_HEIGHT pixels filling the
+ * whole cell, so its pixels are half as wide as a character's.  Rows
+ * are as for bedstead_bitmap(), and the rounded bitmap is what that
+ * would make of them.  The outline is bedstead_image()'s, with points
+ * that fall between design units rounded to the nearest one.
+ *
+ * A struct bedstead_drcs caches the most recently used max of them,
+ * keyed by their pixels, and can be used from several threads at once.
+ * bedstead_drcs_get() returns NULL if there isn't enough memory.
+ * Otherwise what it returns stays valid until passed to
+ * bedstead_drcs_put(), after which it may be evicted.
+ */
+#define DRCS_WIDTH 12
+#define DRCS_HEIGHT 10
+
+struct bedstead_drcs_glyph {
+	struct bedstead_outline outline;
+	unsigned rows[2 * DRCS_HEIGHT];		/* Rounded */
+};
+
+struct bedstead_drcs;
+
+struct bedstead_drcs *bedstead_drcs_new(struct param const *, int max);
+void bedstead_drcs_free(struct bedstead_drcs *);
+struct bedstead_drcs_glyph const *bedstead_drcs_get(struct bedstead_drcs *,
+    unsigned const rows[DRCS_HEIGHT]);
+void bedstead_drcs_put(struct bedstead_drcs *,
+    struct bedstead_drcs_glyph const *);
+
+#endif
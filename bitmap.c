@@ -0,0 +1,488 @@
+/*
+ * Bitmap font output for Bedstead: BDF, PCF, and Linux console PSF2.
+ *
+ * Written by Ben Harris <bjh21@bjh21.me.uk> and Simon Tatham
+ * <anakin@pobox.com>.
+ *
+ * To the extent possible under law, Ben Harris and Simon Tatham have
+ * dedicated all copyright and related and neighboring rights to this
+ * software to the public domain worldwide.  This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+/*
+ * The references are the X Logical Font Description Conventions, the
+ * Glyph Bitmap Distribution Format (BDF) Specification version 2.1,
+ * the description of PCF in the FontForge documentation, and the PSF
+ * documentation in the kbd package.
+ *
+ * All of our glyphs fill their cells exactly, so the bitmaps are
+ * written without any cropping, and every glyph has the same metrics.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "font.h"
+
+/* Resolution of the strikes.  At 72dpi, pixels and points coincide. */
+#define RES 72
+
+static char const *const setwidths[] = {
+	"UltraCondensed", "ExtraCondensed", "Condensed", "SemiCondensed",
+	"Normal", "SemiExpanded", "Expanded", "ExtraExpanded",
+	"UltraExpanded",
+};
+
+/* A font property, with a string value if s is non-NULL. */
+struct prop {
+	char const *name;
+	char const *s;
+	long v;
+};
+
+#define MAXPROPS 24
+
+/* The glyph that stands in for missing ones, or -1. */
+static int
+default_glyph(struct strike const *s)
+{
+	int i, space = -1;
+
+	for (i = 0; i < s->nglyphs; i++) {
+		if (s->glyphs[i].unicode == 0xfffd) return i;
+		if (s->glyphs[i].unicode == ' ' && space == -1) space = i;
+	}
+	return space;
+}
+
+/*
+ * Work out the XLFD name and properties of a strike.  The FONT
+ * property is only included if withfont is set, since BDF has its own
+ * FONT line.
+ */
+static int
+getprops(struct prop *p, char *xlfd, size_t len, struct font const *font,
+    struct strike const *s, bool withfont)
+{
+	char const *setwidth = "Normal";
+	int n = 0, d;
+
+	if (font->widthclass >= 1 && font->widthclass <= 9)
+		setwidth = setwidths[font->widthclass - 1];
+	snprintf(xlfd, len, "-misc-%s-%s-R-%s--%d-%d-%d-%d-C-%d-ISO10646-1",
+	    font->familyname, font->weight, setwidth, s->height,
+	    10 * s->height, RES, RES, 10 * s->width);
+#define STRPROP(n_, s_) (p[n].name = (n_), p[n].s = (s_), n++)
+#define INTPROP(n_, v_) (p[n].name = (n_), p[n].s = NULL, p[n].v = (v_), n++)
+	if (withfont) STRPROP("FONT", xlfd);
+	STRPROP("FOUNDRY", "misc");
+	STRPROP("FAMILY_NAME", font->familyname);
+	STRPROP("WEIGHT_NAME", font->weight);
+	STRPROP("SLANT", "R");
+	STRPROP("SETWIDTH_NAME", setwidth);
+	STRPROP("ADD_STYLE_NAME", "");
+	INTPROP("PIXEL_SIZE", s->height);
+	INTPROP("POINT_SIZE", 10 * s->height);
+	INTPROP("RESOLUTION_X", RES);
+	INTPROP("RESOLUTION_Y", RES);
+	STRPROP("SPACING", "C");
+	INTPROP("AVERAGE_WIDTH", 10 * s->width);
+	STRPROP("CHARSET_REGISTRY", "ISO10646");
+	STRPROP("CHARSET_ENCODING", "1");
+	INTPROP("FONT_ASCENT", s->ascent);
+	INTPROP("FONT_DESCENT", s->height - s->ascent);
+	d = default_glyph(s);
+	if (d >= 0) INTPROP("DEFAULT_CHAR", s->glyphs[d].unicode);
+	STRPROP("COPYRIGHT", font->copyright);
+	STRPROP("FONT_VERSION", font->version);
+#undef STRPROP
+#undef INTPROP
+	return n;
+}
+
+/* Bytes in each row of a glyph's bitmap, padded to a multiple of pad. */
+static int
+stride(struct strike const *s, int pad)
+{
+
+	return (s->width + 8 * pad - 1) / (8 * pad) * pad;
+}
+
+/* Put one row of a bitmap, most significant bit first. */
+static void
+put_row(struct buf *b, struct strike const *s, unsigned row, int pad)
+{
+	int i, n = stride(s, pad);
+
+	row <<= 8 * n - s->width;
+	for (i = n - 1; i >= 0; i--)
+		buf_put8(b, i < 4 ? row >> (8 * i) : 0);
+}
+
+int
+write_bdf(FILE *f, struct font const *font, struct strike const *s)
+{
+	struct prop props[MAXPROPS];
+	char xlfd[256];
+	char const *c;
+	int i, y, n, nbytes = stride(s, 1);
+	int descent = s->height - s->ascent;
+
+	n = getprops(props, xlfd, sizeof(xlfd), font, s, false);
+	fprintf(f, "STARTFONT 2.1\n");
+	fprintf(f, "FONT %s\n", xlfd);
+	fprintf(f, "SIZE %d %d %d\n", s->height, RES, RES);
+	fprintf(f, "FONTBOUNDINGBOX %d %d 0 %d\n",
+	    s->width, s->height, -descent);
+	fprintf(f, "STARTPROPERTIES %d\n", n);
+	for (i = 0; i < n; i++) {
+		if (props[i].s == NULL) {
+			fprintf(f, "%s %ld\n", props[i].name, props[i].v);
+			continue;
+		}
+		/* Quotes in strings are doubled. */
+		fprintf(f, "%s \"", props[i].name);
+		for (c = props[i].s; *c; c++)
+			fprintf(f, *c == '"' ? "\"\"" : "%c", *c);
+		fprintf(f, "\"\n");
+	}
+	fprintf(f, "ENDPROPERTIES\n");
+	fprintf(f, "CHARS %d\n", s->nglyphs);
+	for (i = 0; i < s->nglyphs; i++) {
+		struct bitmapglyph const *g = &s->glyphs[i];
+
+		fprintf(f, "STARTCHAR %s\n", g->name);
+		fprintf(f, "ENCODING %d\n", g->unicode);
+		fprintf(f, "SWIDTH %d 0\n", 1000 * s->width / s->height);
+		fprintf(f, "DWIDTH %d 0\n", s->width);
+		fprintf(f, "BBX %d %d 0 %d\n", s->width, s->height, -descent);
+		fprintf(f, "BITMAP\n");
+		for (y = 0; y < s->height; y++)
+			fprintf(f, "%0*X\n", 2 * nbytes,
+			    g->rows[y] << (8 * nbytes - s->width));
+		fprintf(f, "ENDCHAR\n");
+	}
+	fprintf(f, "ENDFONT\n");
+	return ferror(f) ? -1 : 0;
+}
+
+/*
+ * PCF.  The table formats all say that the data are big-endian with
+ * the most significant bit first, and that bitmap rows are padded to
+ * whole bytes.  The format words themselves, and the table of
+ * contents, are always little-endian.
+ */
+#define PCF_PROPERTIES		(1 << 0)
+#define PCF_ACCELERATORS	(1 << 1)
+#define PCF_METRICS		(1 << 2)
+#define PCF_BITMAPS		(1 << 3)
+#define PCF_BDF_ENCODINGS	(1 << 5)
+#define PCF_SWIDTHS		(1 << 6)
+#define PCF_GLYPH_NAMES		(1 << 7)
+#define PCF_BDF_ACCELERATORS	(1 << 8)
+
+#define PCF_BYTE_MASK		(1 << 2)
+#define PCF_BIT_MASK		(1 << 3)
+#define PCF_FORMAT		(PCF_BYTE_MASK | PCF_BIT_MASK)
+
+static void
+put32le(struct buf *b, unsigned long v)
+{
+	unsigned char c[4];
+
+	c[0] = v; c[1] = v >> 8; c[2] = v >> 16; c[3] = v >> 24;
+	buf_put(b, c, 4);
+}
+
+/* Uncompressed metrics for a glyph that fills the cell. */
+static void
+put_metrics(struct buf *b, struct strike const *s)
+{
+
+	buf_put16(b, 0);			/* left_side_bearing */
+	buf_put16(b, s->width);			/* right_side_bearing */
+	buf_put16(b, s->width);			/* character_width */
+	buf_put16(b, s->ascent);
+	buf_put16(b, s->height - s->ascent);	/* descent */
+	buf_put16(b, 0);			/* attributes */
+}
+
+static void
+pcf_properties(struct buf *b, struct font const *font,
+    struct strike const *s)
+{
+	struct prop props[MAXPROPS];
+	struct buf strings;
+	char xlfd[256];
+	int i, n;
+
+	buf_init(&strings);
+	n = getprops(props, xlfd, sizeof(xlfd), font, s, true);
+	put32le(b, PCF_FORMAT);
+	buf_put32(b, n);
+	for (i = 0; i < n; i++) {
+		buf_put32(b, strings.len);
+		buf_put(&strings, props[i].name, strlen(props[i].name) + 1);
+		buf_put8(b, props[i].s != NULL);
+		if (props[i].s != NULL) {
+			buf_put32(b, strings.len);
+			buf_put(&strings, props[i].s, strlen(props[i].s) + 1);
+		} else
+			buf_put32(b, props[i].v);
+	}
+	buf_zero(b, -n & 3);
+	buf_put32(b, strings.len);
+	buf_put(b, strings.data, strings.len);
+	if (strings.failed) b->failed = true;
+	buf_free(&strings);
+}
+
+static void
+pcf_accelerators(struct buf *b, struct strike const *s)
+{
+
+	put32le(b, PCF_FORMAT);
+	buf_put8(b, 1);				/* noOverlap */
+	buf_put8(b, 1);				/* constantMetrics */
+	buf_put8(b, 1);				/* terminalFont */
+	buf_put8(b, 1);				/* constantWidth */
+	buf_put8(b, 1);				/* inkInside */
+	buf_put8(b, 0);				/* inkMetrics */
+	buf_put8(b, 0);				/* drawDirection */
+	buf_put8(b, 0);
+	buf_put32(b, s->ascent);
+	buf_put32(b, s->height - s->ascent);
+	buf_put32(b, 0);			/* maxOverlap */
+	put_metrics(b, s);			/* minbounds */
+	put_metrics(b, s);			/* maxbounds */
+}
+
+static void
+pcf_metrics(struct buf *b, struct strike const *s)
+{
+	int i;
+
+	put32le(b, PCF_FORMAT);
+	buf_put32(b, s->nglyphs);
+	for (i = 0; i < s->nglyphs; i++)
+		put_metrics(b, s);
+}
+
+static void
+pcf_bitmaps(struct buf *b, struct strike const *s)
+{
+	int i, y;
+
+	put32le(b, PCF_FORMAT);
+	buf_put32(b, s->nglyphs);
+	for (i = 0; i < s->nglyphs; i++)
+		buf_put32(b, i * s->height * stride(s, 1));
+	/* Sizes of the bitmap data for each possible padding. */
+	for (i = 0; i < 4; i++)
+		buf_put32(b, s->nglyphs * s->height * stride(s, 1 << i));
+	for (i = 0; i < s->nglyphs; i++)
+		for (y = 0; y < s->height; y++)
+			put_row(b, s, s->glyphs[i].rows[y], 1);
+}
+
+/* Only the BMP can be encoded in PCF. */
+static int
+pcf_encodings(struct buf *b, struct strike const *s)
+{
+	int min1 = 0xff, max1 = 0, min2 = 0xff, max2 = 0;
+	int i, u, d, n, ncols, *index;
+
+	for (i = 0; i < s->nglyphs; i++) {
+		u = s->glyphs[i].unicode;
+		if (u < 0 || u > 0xffff) continue;
+		if (u >> 8 < min1) min1 = u >> 8;
+		if (u >> 8 > max1) max1 = u >> 8;
+		if ((u & 0xff) < min2) min2 = u & 0xff;
+		if ((u & 0xff) > max2) max2 = u & 0xff;
+	}
+	if (min1 > max1) min1 = max1 = min2 = max2 = 0;
+	ncols = max2 - min2 + 1;
+	n = (max1 - min1 + 1) * ncols;
+	index = malloc(n * sizeof(index[0]));
+	if (index == NULL) return -1;
+	for (i = 0; i < n; i++)
+		index[i] = 0xffff;
+	for (i = s->nglyphs - 1; i >= 0; i--) {
+		u = s->glyphs[i].unicode;
+		if (u < 0 || u > 0xffff) continue;
+		index[((u >> 8) - min1) * ncols + (u & 0xff) - min2] = i;
+	}
+	d = default_glyph(s);
+	put32le(b, PCF_FORMAT);
+	buf_put16(b, min2); buf_put16(b, max2);
+	buf_put16(b, min1); buf_put16(b, max1);
+	buf_put16(b, d >= 0 && s->glyphs[d].unicode <= 0xffff ?
+	    s->glyphs[d].unicode : 0xffff);	/* default_char */
+	for (i = 0; i < n; i++)
+		buf_put16(b, index[i]);
+	free(index);
+	return 0;
+}
+
+static void
+pcf_swidths(struct buf *b, struct strike const *s)
+{
+	int i;
+
+	put32le(b, PCF_FORMAT);
+	buf_put32(b, s->nglyphs);
+	for (i = 0; i < s->nglyphs; i++)
+		buf_put32(b, 1000 * s->width / s->height);
+}
+
+static void
+pcf_glyph_names(struct buf *b, struct strike const *s)
+{
+	size_t off = 0;
+	int i;
+
+	put32le(b, PCF_FORMAT);
+	buf_put32(b, s->nglyphs);
+	for (i = 0; i < s->nglyphs; i++) {
+		buf_put32(b, off);
+		off += strlen(s->glyphs[i].name) + 1;
+	}
+	buf_put32(b, off);
+	for (i = 0; i < s->nglyphs; i++)
+		buf_put(b, s->glyphs[i].name, strlen(s->glyphs[i].name) + 1);
+}
+
+#define PCF_NTABLES 8
+
+int
+write_pcf(FILE *f, struct font const *font, struct strike const *s)
+{
+	static int const types[PCF_NTABLES] = {
+		PCF_PROPERTIES, PCF_ACCELERATORS, PCF_METRICS, PCF_BITMAPS,
+		PCF_BDF_ENCODINGS, PCF_SWIDTHS, PCF_GLYPH_NAMES,
+		PCF_BDF_ACCELERATORS,
+	};
+	struct buf tables[PCF_NTABLES], out;
+	size_t off;
+	int t, ret = -1;
+
+	for (t = 0; t < PCF_NTABLES; t++)
+		buf_init(&tables[t]);
+	buf_init(&out);
+	pcf_properties(&tables[0], font, s);
+	pcf_accelerators(&tables[1], s);
+	pcf_metrics(&tables[2], s);
+	pcf_bitmaps(&tables[3], s);
+	if (pcf_encodings(&tables[4], s) != 0) goto out;
+	pcf_swidths(&tables[5], s);
+	pcf_glyph_names(&tables[6], s);
+	pcf_accelerators(&tables[7], s);
+
+	buf_put(&out, "\1fcp", 4);
+	put32le(&out, PCF_NTABLES);
+	off = 8 + 16 * PCF_NTABLES;
+	for (t = 0; t < PCF_NTABLES; t++) {
+		buf_zero(&tables[t], -tables[t].len & 3);
+		if (tables[t].failed) goto out;
+		put32le(&out, types[t]);
+		put32le(&out, PCF_FORMAT);
+		put32le(&out, tables[t].len);
+		put32le(&out, off);
+		off += tables[t].len;
+	}
+	for (t = 0; t < PCF_NTABLES; t++)
+		buf_put(&out, tables[t].data, tables[t].len);
+	if (!out.failed && fwrite(out.data, 1, out.len, f) == out.len)
+		ret = 0;
+out:
+	for (t = 0; t < PCF_NTABLES; t++)
+		buf_free(&tables[t]);
+	buf_free(&out);
+	return ret;
+}
+
+/*
+ * PSF2, for the Linux console, which can only take 256 or 512 glyphs.
+ * The first 256 slots hold ISO 8859-1, so that the font is still
+ * useful without a Unicode map, and the rest are filled with other
+ * glyphs in table order until there's no more room.
+ */
+#define PSF2_MAXGLYPHS 512
+
+static void
+put_utf8(struct buf *b, unsigned long c)
+{
+
+	if (c < 0x80)
+		buf_put8(b, c);
+	else if (c < 0x800) {
+		buf_put8(b, 0xc0 | c >> 6);
+		buf_put8(b, 0x80 | (c & 0x3f));
+	} else if (c < 0x10000) {
+		buf_put8(b, 0xe0 | c >> 12);
+		buf_put8(b, 0x80 | (c >> 6 & 0x3f));
+		buf_put8(b, 0x80 | (c & 0x3f));
+	} else {
+		buf_put8(b, 0xf0 | c >> 18);
+		buf_put8(b, 0x80 | (c >> 12 & 0x3f));
+		buf_put8(b, 0x80 | (c >> 6 & 0x3f));
+		buf_put8(b, 0x80 | (c & 0x3f));
+	}
+}
+
+int
+write_psf2(FILE *f, struct font const *font, struct strike const *s)
+{
+	int slot[PSF2_MAXGLYPHS];
+	struct buf out;
+	int i, n, y, u;
+	int ret = -1;
+
+	(void)font;
+	for (i = 0; i < PSF2_MAXGLYPHS; i++)
+		slot[i] = -1;
+	/* ISO 8859-1 first, taking the first glyph for each character. */
+	for (i = 0; i < s->nglyphs; i++) {
+		u = s->glyphs[i].unicode;
+		if (u >= 0 && u < 256 && slot[u] == -1)
+			slot[u] = i;
+	}
+	n = 256;
+	for (i = 0; i < s->nglyphs && n < PSF2_MAXGLYPHS; i++) {
+		u = s->glyphs[i].unicode;
+		if (u < 256) continue;
+		slot[n++] = i;
+	}
+
+	buf_init(&out);
+	buf_put(&out, "\x72\xb5\x4a\x86", 4);	/* magic */
+	put32le(&out, 0);			/* version */
+	put32le(&out, 32);			/* headersize */
+	put32le(&out, 1);			/* flags: has Unicode table */
+	put32le(&out, n);			/* length */
+	put32le(&out, s->height * stride(s, 1)); /* charsize */
+	put32le(&out, s->height);
+	put32le(&out, s->width);
+	for (i = 0; i < n; i++)
+		for (y = 0; y < s->height; y++)
+			put_row(&out, s, slot[i] >= 0 ?
+			    s->glyphs[slot[i]].rows[y] : 0, 1);
+	/*
+	 * Each glyph's entry in the Unicode table is its character
+	 * followed by 0xff.  Unused slots, and glyphs with no
+	 * character, have just the terminator.
+	 */
+	for (i = 0; i < n; i++) {
+		if (slot[i] >= 0 && s->glyphs[slot[i]].unicode >= 0)
+			put_utf8(&out, s->glyphs[slot[i]].unicode);
+		buf_put8(&out, 0xff);
+	}
+	if (!out.failed && fwrite(out.data, 1, out.len, f) == out.len)
+		ret = 0;
+	buf_free(&out);
+	return ret;
+}
@@ -0,0 +1,220 @@
+/*
+ * Growable byte buffers for building binary output.
+ *
+ * Written by Ben Harris <bjh21@bjh21.me.uk> and Simon Tatham
+ * <anakin@pobox.com>.
+ *
+ * To the extent possible under law, Ben Harris and Simon Tatham have
+ * dedicated all copyright and related and neighboring rights to this
+ * software to the public domain worldwide.  This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include <sys/uio.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "font.h"
+
+void
+buf_init(struct buf *b)
+{
+
+	b->data = NULL;
+	b->len = b->size = 0;
+	b->failed = false;
+}
+
+void
+buf_free(struct buf *b)
+{
+
+	free(b->data);
+	buf_init(b);
+}
+
+/* Make room for n more bytes, returning false if we can't. */
+static bool
+buf_reserve(struct buf *b, size_t n)
+{
+	size_t size;
+	unsigned char *data;
+
+	if (b->failed) return false;
+	if (b->len + n <= b->size) return true;
+	size = b->size ? b->size : 256;
+	while (size < b->len + n)
+		size *= 2;
+	data = realloc(b->data, size);
+	if (data == NULL) {
+		b->failed = true;
+		return false;
+	}
+	b->data = data;
+	b->size = size;
+	return true;
+}
+
+void
+buf_put(struct buf *b, void const *p, size_t n)
+{
+
+	if (!buf_reserve(b, n)) return;
+	memcpy(b->data + b->len, p, n);
+	b->len += n;
+}
+
+void
+buf_zero(struct buf *b, size_t n)
+{
+
+	if (!buf_reserve(b, n)) return;
+	memset(b->data + b->len, 0, n);
+	b->len += n;
+}
+
+void
+buf_put8(struct buf *b, unsigned v)
+{
+	unsigned char c = v;
+
+	buf_put(b, &c, 1);
+}
+
+/* Multi-byte values are big-endian, as in every format we write. */
+void
+buf_put16(struct buf *b, unsigned v)
+{
+	unsigned char c[2];
+
+	c[0] = v >> 8; c[1] = v;
+	buf_put(b, c, 2);
+}
+
+void
+buf_put32(struct buf *b, unsigned long v)
+{
+	unsigned char c[4];
+
+	c[0] = v >> 24; c[1] = v >> 16; c[2] = v >> 8; c[3] = v;
+	buf_put(b, c, 4);
+}
+
+void
+buf_patch16(struct buf *b, size_t off, unsigned v)
+{
+
+	if (b->failed) return;
+	b->data[off] = v >> 8; b->data[off + 1] = v;
+}
+
+void
+buf_patch32(struct buf *b, size_t off, unsigned long v)
+{
+
+	if (b->failed) return;
+	b->data[off] = v >> 24; b->data[off + 1] = v >> 16;
+	b->data[off + 2] = v >> 8; b->data[off + 3] = v;
+}
+
+void
+buf_puts(struct buf *b, char const *s)
+{
+
+	buf_put(b, s, strlen(s));
+}
+
+void
+buf_putdec(struct buf *b, long v)
+{
+	char tmp[24], *p = tmp + sizeof(tmp);
+	unsigned long u = v < 0 ? -(unsigned long)v : v;
+
+	do *--p = '0' + u % 10; while ((u /= 10) != 0);
+	if (v < 0) *--p = '-';
+	buf_put(b, p, tmp + sizeof(tmp) - p);
+}
+
+void
+buf_printf(struct buf *b, char const *fmt, ...)
+{
+	va_list ap;
+	size_t n;
+
+	va_start(ap, fmt);
+	while (*fmt) {
+		n = strcspn(fmt, "%");
+		buf_put(b, fmt, n);
+		fmt += n;
+		if (*fmt == '\0') break;
+		switch (fmt[1]) {
+		case 's': buf_puts(b, va_arg(ap, char const *)); break;
+		case 'd': buf_putdec(b, va_arg(ap, int)); break;
+		case 'u': buf_putdec(b, va_arg(ap, unsigned)); break;
+		case 'c': buf_put8(b, va_arg(ap, int)); break;
+		case '%': buf_put8(b, '%'); break;
+		default: assert(!"unsupported conversion");
+		}
+		fmt += 2;
+	}
+	va_end(ap);
+}
+
+int
+buf_write(struct buf *b, int fd)
+{
+
+	return buf_writev(b, 1, fd);
+}
+
+/* Write n buffers in order with as few system calls as possible. */
+int
+buf_writev(struct buf *b, int n, int fd)
+{
+	struct iovec iov[64];
+	int i, j, niov;
+	size_t done = 0;
+	ssize_t w;
+
+	for (i = 0; i < n; i++)
+		if (b[i].failed) {
+			errno = ENOMEM;
+			return -1;
+		}
+	for (i = 0; i < n; ) {
+		/* Gather buffers from b[i], skipping what's been written. */
+		niov = 0;
+		for (j = i; j < n && niov < 64; j++) {
+			if (b[j].len == 0) continue;
+			iov[niov].iov_base = b[j].data + (j == i ? done : 0);
+			iov[niov].iov_len = b[j].len - (j == i ? done : 0);
+			niov++;
+		}
+		if (niov == 0) break;
+		w = writev(fd, iov, niov);
+		if (w == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		/* Account for what was written. */
+		while (i < n && (size_t)w >= b[i].len - done) {
+			w -= b[i].len - done;
+			b[i].len = 0;
+			done = 0;
+			i++;
+		}
+		done += w;
+	}
+	for (i = 0; i < n; i++)
+		b[i].len = 0;
+	return 0;
+}
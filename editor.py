@@ -37,6 +37,19 @@ for y in range(YSIZE+1):
 
 dragging = None
 
+# A single long-running bedstead process answers all our requests, so
+# that we don't pay for starting a new one on every mouse movement.
+cont.server = subprocess.Popen(["./bedstead", "--serve"],
+                               stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+
+def outline(bitmap):
+    cont.server.stdin.write(" ".join(map(str, bitmap)) + "\n")
+    cont.server.stdin.flush()
+    reply = cont.server.stdout.readline().split(None, 1)
+    if reply[0] != "OK":
+        raise Exception("bedstead: " + " ".join(reply[1:]))
+    return cont.server.stdout.read(int(reply[1]))
+
 def getpixel(x, y):
     assert x >= 0 and x < XSIZE and y >= 0 and y < YSIZE
     bit = 1 << (XSIZE-1 - x)
@@ -66,7 +79,7 @@ def regenerate():
         cont.canvas.delete(pg)
     cont.polygons = []
 
-    data = subprocess.check_output(["./bedstead"] + map(str, cont.bitmap))
+    data = outline(cont.bitmap)
     paths = []
     path = None
     for line in data.splitlines():
@@ -0,0 +1,129 @@
+/*
+ * Interfaces between the parts of the bedstead program.
+ *
+ * Written by Ben Harris <bjh21@bjh21.me.uk> and Simon Tatham
+ * <anakin@pobox.com>.
+ *
+ * To the extent possible under law, Ben Harris and Simon Tatham have
+ * dedicated all copyright and related and neighboring rights to this
+ * software to the public domain worldwide.  This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifndef FONT_H
+#define FONT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "bedstead.h"
+
+/*
+ * A growable byte buffer.  Rather than checking every write, callers
+ * check 'failed' once they've finished.
+ */
+struct buf {
+	unsigned char *data;
+	size_t len, size;
+	bool failed;
+};
+
+void buf_init(struct buf *);
+void buf_free(struct buf *);
+void buf_put(struct buf *, void const *, size_t);
+void buf_put8(struct buf *, unsigned);
+void buf_put16(struct buf *, unsigned);
+void buf_put32(struct buf *, unsigned long);
+void buf_zero(struct buf *, size_t);
+void buf_patch16(struct buf *, size_t, unsigned);
+void buf_patch32(struct buf *, size_t, unsigned long);
+
+/*
+ * Text output.  buf_printf() understands only %s, %d, %u, %c and %%,
+ * which is all the SFD writer needs, and doesn't go through stdio.
+ * buf_write() and buf_writev() write whole buffers to a file
+ * descriptor and empty them, keeping their memory for reuse.
+ */
+void buf_puts(struct buf *, char const *);
+void buf_putdec(struct buf *, long);
+void buf_printf(struct buf *, char const *, ...);
+int buf_write(struct buf *, int);
+int buf_writev(struct buf *, int, int);
+
+/*
+ * Single substitutions that a glyph can take part in, in the order
+ * that their lookups appear in the font.
+ */
+enum { SUBST_SALT, SUBST_SS01, SUBST_SS02, SUBST_SS04, SUBST_SMCP,
+       SUBST_C2SC, NSUBST };
+
+/*
+ * A complete description of a font, from which each of the output
+ * formats can be written.  Glyph references are indices into glyphs[],
+ * or -1 for none.
+ */
+struct fontglyph {
+	char const *name;
+	int unicode;
+	int advance;
+	int palt_dx, palt_dh;		/* "palt" adjustments */
+	int subst[NSUBST];
+	int nalts;			/* "aalt" alternates */
+	int *alts;
+	int ncontours;
+	int *contours;
+	struct bedstead_vec *points;
+};
+
+struct font {
+	char const *fontname, *fullname, *familyname;
+	char const *weight, *copyright, *version;
+	int weightclass, widthclass;
+	int ascent, descent;
+	int underlinepos, underlinewidth;
+	int strikepos, strikesize;
+	int subxsize, subysize, subxoff, subyoff;
+	int supxsize, supysize, supxoff, supyoff;
+	int stdhw, stdvw;
+	int ngasp;
+	struct { int ppem, flags; } gasp[8];
+	int nglyphs;
+	struct fontglyph *glyphs;
+	/* Embedded bitmaps, with glyph i of each strike being glyph i here */
+	int nstrikes;
+	struct strike const *strikes;
+};
+
+/*
+ * A bitmap strike, for the bitmap font formats.  Every glyph fills the
+ * whole cell, and so has the same metrics.
+ */
+struct bitmapglyph {
+	char const *name;
+	int unicode;
+	unsigned rows[2 * YSIZE];	/* As from bedstead_bitmap() */
+};
+
+struct strike {
+	int width, height, ascent;	/* In pixels */
+	int nglyphs;
+	struct bitmapglyph *glyphs;
+};
+
+int write_otf(FILE *, struct font const *);
+int write_woff2(FILE *, struct font const *);
+int write_bdf(FILE *, struct font const *, struct strike const *);
+int write_pcf(FILE *, struct font const *, struct strike const *);
+int write_psf2(FILE *, struct font const *, struct strike const *);
+
+extern char const *const cp437_names[256];
+int write_tileset(FILE *, struct font const *, int const [256], int);
+
+int write_png(FILE *, int, int, unsigned char const *);
+
+#endif
@@ -0,0 +1,1701 @@
+/*
+ * OpenType (CFF) output for Bedstead.
+ *
+ * Written by Ben Harris <bjh21@bjh21.me.uk> and Simon Tatham
+ * <anakin@pobox.com>.
+ *
+ * To the extent possible under law, Ben Harris and Simon Tatham have
+ * dedicated all copyright and related and neighboring rights to this
+ * software to the public domain worldwide.  This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+/*
+ * This writes the same font that FontForge would make from our SFD,
+ * but without the cost of starting FontForge.  The references are the
+ * OpenType specification and Adobe Technical Notes #5176 (The Compact
+ * Font Format Specification) and #5177 (The Type 2 Charstring Format).
+ *
+ * Since every glyph is assembled from the same few pixel shapes, many
+ * contours turn up again and again across the font: every full stop,
+ * every mosaic cell, and most dots and short strokes.  Each contour's
+ * line segments are position-independent once its initial moveto is
+ * taken out, so any such sequence that's used often enough to pay its
+ * way becomes a global subroutine.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <brotli/encode.h>
+
+#include "font.h"
+
+/* CFF standard strings (TN #5176 Appendix A) */
+static char const *const stdstrings[] = {
+	".notdef", "space", "exclam", "quotedbl", "numbersign", "dollar",
+	"percent", "ampersand", "quoteright", "parenleft", "parenright",
+	"asterisk", "plus", "comma", "hyphen", "period", "slash", "zero",
+	"one", "two", "three", "four", "five", "six", "seven", "eight",
+	"nine", "colon", "semicolon", "less", "equal", "greater", "question",
+	"at", "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M",
+	"N", "O", "P", "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z",
+	"bracketleft", "backslash", "bracketright", "asciicircum",
+	"underscore", "quoteleft", "a", "b", "c", "d", "e", "f", "g", "h",
+	"i", "j", "k", "l", "m", "n", "o", "p", "q", "r", "s", "t", "u", "v",
+	"w", "x", "y", "z", "braceleft", "bar", "braceright", "asciitilde",
+	"exclamdown", "cent", "sterling", "fraction", "yen", "florin",
+	"section", "currency", "quotesingle", "quotedblleft", "guillemotleft",
+	"guilsinglleft", "guilsinglright", "fi", "fl", "endash", "dagger",
+	"daggerdbl", "periodcentered", "paragraph", "bullet",
+	"quotesinglbase", "quotedblbase", "quotedblright", "guillemotright",
+	"ellipsis", "perthousand", "questiondown", "grave", "acute",
+	"circumflex", "tilde", "macron", "breve", "dotaccent", "dieresis",
+	"ring", "cedilla", "hungarumlaut", "ogonek", "caron", "emdash", "AE",
+	"ordfeminine", "Lslash", "Oslash", "OE", "ordmasculine", "ae",
+	"dotlessi", "lslash", "oslash", "oe", "germandbls", "onesuperior",
+	"logicalnot", "mu", "trademark", "Eth", "onehalf", "plusminus",
+	"Thorn", "onequarter", "divide", "brokenbar", "degree", "thorn",
+	"threequarters", "twosuperior", "registered", "minus", "eth",
+	"multiply", "threesuperior", "copyright", "Aacute", "Acircumflex",
+	"Adieresis", "Agrave", "Aring", "Atilde", "Ccedilla", "Eacute",
+	"Ecircumflex", "Edieresis", "Egrave", "Iacute", "Icircumflex",
+	"Idieresis", "Igrave", "Ntilde", "Oacute", "Ocircumflex", "Odieresis",
+	"Ograve", "Otilde", "Scaron", "Uacute", "Ucircumflex", "Udieresis",
+	"Ugrave", "Yacute", "Ydieresis", "Zcaron", "aacute", "acircumflex",
+	"adieresis", "agrave", "aring", "atilde", "ccedilla", "eacute",
+	"ecircumflex", "edieresis", "egrave", "iacute", "icircumflex",
+	"idieresis", "igrave", "ntilde", "oacute", "ocircumflex", "odieresis",
+	"ograve", "otilde", "scaron", "uacute", "ucircumflex", "udieresis",
+	"ugrave", "yacute", "ydieresis", "zcaron", "exclamsmall",
+	"Hungarumlautsmall", "dollaroldstyle", "dollarsuperior",
+	"ampersandsmall", "Acutesmall", "parenleftsuperior",
+	"parenrightsuperior", "twodotenleader", "onedotenleader",
+	"zerooldstyle", "oneoldstyle", "twooldstyle", "threeoldstyle",
+	"fouroldstyle", "fiveoldstyle", "sixoldstyle", "sevenoldstyle",
+	"eightoldstyle", "nineoldstyle", "commasuperior",
+	"threequartersemdash", "periodsuperior", "questionsmall", "asuperior",
+	"bsuperior", "centsuperior", "dsuperior", "esuperior", "isuperior",
+	"lsuperior", "msuperior", "nsuperior", "osuperior", "rsuperior",
+	"ssuperior", "tsuperior", "ff", "ffi", "ffl", "parenleftinferior",
+	"parenrightinferior", "Circumflexsmall", "hyphensuperior",
+	"Gravesmall", "Asmall", "Bsmall", "Csmall", "Dsmall", "Esmall",
+	"Fsmall", "Gsmall", "Hsmall", "Ismall", "Jsmall", "Ksmall", "Lsmall",
+	"Msmall", "Nsmall", "Osmall", "Psmall", "Qsmall", "Rsmall", "Ssmall",
+	"Tsmall", "Usmall", "Vsmall", "Wsmall", "Xsmall", "Ysmall", "Zsmall",
+	"colonmonetary", "onefitted", "rupiah", "Tildesmall",
+	"exclamdownsmall", "centoldstyle", "Lslashsmall", "Scaronsmall",
+	"Zcaronsmall", "Dieresissmall", "Brevesmall", "Caronsmall",
+	"Dotaccentsmall", "Macronsmall", "figuredash", "hypheninferior",
+	"Ogoneksmall", "Ringsmall", "Cedillasmall", "questiondownsmall",
+	"oneeighth", "threeeighths", "fiveeighths", "seveneighths",
+	"onethird", "twothirds", "zerosuperior", "foursuperior",
+	"fivesuperior", "sixsuperior", "sevensuperior", "eightsuperior",
+	"ninesuperior", "zeroinferior", "oneinferior", "twoinferior",
+	"threeinferior", "fourinferior", "fiveinferior", "sixinferior",
+	"seveninferior", "eightinferior", "nineinferior", "centinferior",
+	"dollarinferior", "periodinferior", "commainferior", "Agravesmall",
+	"Aacutesmall", "Acircumflexsmall", "Atildesmall", "Adieresissmall",
+	"Aringsmall", "AEsmall", "Ccedillasmall", "Egravesmall",
+	"Eacutesmall", "Ecircumflexsmall", "Edieresissmall", "Igravesmall",
+	"Iacutesmall", "Icircumflexsmall", "Idieresissmall", "Ethsmall",
+	"Ntildesmall", "Ogravesmall", "Oacutesmall", "Ocircumflexsmall",
+	"Otildesmall", "Odieresissmall", "OEsmall", "Oslashsmall",
+	"Ugravesmall", "Uacutesmall", "Ucircumflexsmall", "Udieresissmall",
+	"Yacutesmall", "Thornsmall", "Ydieresissmall", "001.000", "001.001",
+	"001.002", "001.003", "Black", "Bold", "Book", "Light", "Medium",
+	"Regular", "Roman", "Semibold",
+};
+#define NSTDSTRINGS (sizeof(stdstrings) / sizeof(stdstrings[0]))
+
+/* Type 2 charstring operators */
+#define CS_RLINETO	5
+#define CS_HLINETO	6
+#define CS_VLINETO	7
+#define CS_RETURN	11
+#define CS_ENDCHAR	14
+#define CS_RMOVETO	21
+#define CS_CALLGSUBR	29
+
+/* Maximum number of arguments on the Type 2 argument stack */
+#define CS_MAXARGS	48
+
+/* An integer operand, for either a DICT or a charstring. */
+static void
+cff_int(struct buf *b, int v)
+{
+
+	if (v >= -107 && v <= 107)
+		buf_put8(b, v + 139);
+	else if (v >= 108 && v <= 1131) {
+		v -= 108;
+		buf_put8(b, (v >> 8) + 247); buf_put8(b, v);
+	} else if (v >= -1131 && v <= -108) {
+		v = -v - 108;
+		buf_put8(b, (v >> 8) + 251); buf_put8(b, v);
+	} else {
+		assert(v >= -32768 && v <= 32767);
+		buf_put8(b, 28); buf_put16(b, v);
+	}
+}
+
+/* A DICT operand that always takes five bytes, for offsets. */
+static void
+cff_long(struct buf *b, long v)
+{
+
+	buf_put8(b, 29); buf_put32(b, v);
+}
+
+/* A real DICT operand, as packed decimal. */
+static void
+cff_real(struct buf *b, double v)
+{
+	char s[32], *p;
+	unsigned char nib[64];
+	int n = 0, i;
+
+	snprintf(s, sizeof(s), "%.6g", v);
+	for (p = s; *p; p++)
+		if (*p >= '0' && *p <= '9')
+			nib[n++] = *p - '0';
+		else if (*p == '.')
+			nib[n++] = 0xa;
+		else if (*p == '-')
+			nib[n++] = 0xe;
+		else if (*p == 'e' && p[1] == '-') {
+			nib[n++] = 0xc; p++;
+		} else if (*p == 'e') {
+			nib[n++] = 0xb;
+			if (p[1] == '+') p++;
+		}
+	nib[n++] = 0xf;
+	if (n % 2) nib[n++] = 0xf;
+	buf_put8(b, 30);
+	for (i = 0; i < n; i += 2)
+		buf_put8(b, nib[i] << 4 | nib[i + 1]);
+}
+
+static void
+cff_op(struct buf *b, int op)
+{
+
+	if (op >= 0x100) buf_put8(b, 12);
+	buf_put8(b, op);
+}
+
+#define TOP_NOTICE		0
+#define TOP_FULLNAME		2
+#define TOP_FAMILYNAME		3
+#define TOP_WEIGHT		4
+#define TOP_FONTBBOX		5
+#define TOP_CHARSET		15
+#define TOP_CHARSTRINGS		17
+#define TOP_PRIVATE		18
+#define TOP_ISFIXEDPITCH	0x101
+#define TOP_UNDERLINEPOSITION	0x103
+#define TOP_UNDERLINETHICKNESS	0x104
+#define TOP_FONTMATRIX		0x107
+#define PRIV_STDHW		10
+#define PRIV_STDVW		11
+#define PRIV_DEFAULTWIDTHX	20
+#define PRIV_NOMINALWIDTHX	21
+
+/*
+ * An INDEX structure.  The items are stored one after another in
+ * 'data', and ends[i] is the offset just past the end of item i.
+ */
+struct cffindex {
+	struct buf data;
+	size_t *ends;
+	int count, size;
+	bool failed;
+};
+
+static void
+index_init(struct cffindex *x)
+{
+
+	buf_init(&x->data);
+	x->ends = NULL;
+	x->count = x->size = 0;
+	x->failed = false;
+}
+
+static void
+index_free(struct cffindex *x)
+{
+
+	buf_free(&x->data);
+	free(x->ends);
+}
+
+/* Mark the end of the item whose bytes have just been put in x->data. */
+static void
+index_next(struct cffindex *x)
+{
+	size_t *ends;
+
+	if (x->count == x->size) {
+		x->size = x->size ? x->size * 2 : 64;
+		ends = realloc(x->ends, x->size * sizeof(ends[0]));
+		if (ends == NULL) {
+			x->failed = true;
+			x->count = 0;
+			return;
+		}
+		x->ends = ends;
+	}
+	x->ends[x->count++] = x->data.len;
+}
+
+static void
+index_add(struct cffindex *x, void const *p, size_t len)
+{
+
+	buf_put(&x->data, p, len);
+	index_next(x);
+}
+
+static void
+put_index(struct buf *b, struct cffindex const *x)
+{
+	int offsize, i, j;
+	unsigned long off;
+
+	buf_put16(b, x->count);
+	if (x->count == 0) return;
+	for (offsize = 1; x->data.len + 1 >= 1UL << (8 * offsize); offsize++)
+		continue;
+	buf_put8(b, offsize);
+	for (i = -1; i < x->count; i++) {
+		off = (i < 0 ? 0 : x->ends[i]) + 1;
+		for (j = offsize - 1; j >= 0; j--)
+			buf_put8(b, off >> (8 * j));
+	}
+	buf_put(b, x->data.data, x->data.len);
+}
+
+static unsigned
+bytehash(unsigned char const *p, size_t len)
+{
+	unsigned h = 2166136261U;
+
+	while (len--)
+		h = (h ^ *p++) * 16777619U;
+	return h;
+}
+
+/*
+ * The String INDEX, with a hash table of SIDs covering both it and the
+ * standard strings so that a font with thousands of glyph names
+ * doesn't need a search for each one.  max is the most strings that
+ * will be added.
+ */
+struct strings {
+	struct cffindex index;
+	int *table;
+	unsigned mask;
+};
+
+static int
+strings_init(struct strings *s, int max)
+{
+	unsigned h;
+	size_t i;
+
+	index_init(&s->index);
+	for (s->mask = 1; s->mask < 2 * (NSTDSTRINGS + (unsigned)max);
+	     s->mask <<= 1)
+		continue;
+	s->table = malloc(s->mask * sizeof(s->table[0]));
+	if (s->table == NULL) return -1;
+	s->mask--;
+	for (h = 0; h <= s->mask; h++)
+		s->table[h] = -1;
+	for (i = 0; i < NSTDSTRINGS; i++) {
+		for (h = bytehash((unsigned char const *)stdstrings[i],
+			 strlen(stdstrings[i])) & s->mask;
+		     s->table[h] != -1; h = (h + 1) & s->mask)
+			continue;
+		s->table[h] = i;
+	}
+	return 0;
+}
+
+static void
+strings_free(struct strings *s)
+{
+
+	index_free(&s->index);
+	free(s->table);
+}
+
+/* Find or make the SID for a string. */
+static int
+sid(struct strings *strings, char const *s)
+{
+	struct cffindex *x = &strings->index;
+	size_t len = strlen(s), start, i;
+	unsigned h;
+	int n;
+
+	for (h = bytehash((unsigned char const *)s, len) & strings->mask;
+	     (n = strings->table[h]) != -1; h = (h + 1) & strings->mask) {
+		if (n < (int)NSTDSTRINGS) {
+			if (strcmp(stdstrings[n], s) == 0)
+				return n;
+			continue;
+		}
+		i = n - NSTDSTRINGS;
+		start = i ? x->ends[i - 1] : 0;
+		if (x->ends[i] - start == len &&
+		    memcmp(x->data.data + start, s, len) == 0)
+			return n;
+	}
+	index_add(x, s, len);
+	if (x->failed) return 0;
+	return strings->table[h] = NSTDSTRINGS + x->count - 1;
+}
+
+/*
+ * Append charstring operators drawing lines through the points in p,
+ * relative to p[0].  Runs of alternating horizontal and vertical
+ * lines use hlineto and vlineto; everything else uses rlineto.
+ */
+static void
+cs_lines(struct buf *b, struct bedstead_vec const *p, int n)
+{
+	int i = 1, nargs, dx, dy;
+	bool horiz, h;
+
+	while (i < n) {
+		dx = p[i].x - p[i-1].x; dy = p[i].y - p[i-1].y;
+		if (dx == 0 || dy == 0) {
+			horiz = dy == 0;
+			nargs = 0;
+			while (i < n && nargs < CS_MAXARGS) {
+				/* Is this line meant to be horizontal? */
+				h = (nargs % 2 == 0) == horiz;
+				dx = p[i].x - p[i-1].x; dy = p[i].y - p[i-1].y;
+				if (h ? dy != 0 : dx != 0) break;
+				cff_int(b, h ? dx : dy);
+				nargs++; i++;
+			}
+			cff_op(b, horiz ? CS_HLINETO : CS_VLINETO);
+		} else {
+			nargs = 0;
+			while (i < n && nargs < CS_MAXARGS) {
+				dx = p[i].x - p[i-1].x; dy = p[i].y - p[i-1].y;
+				if (dx == 0 || dy == 0) break;
+				cff_int(b, dx); cff_int(b, dy);
+				nargs += 2; i++;
+			}
+			cff_op(b, CS_RLINETO);
+		}
+	}
+}
+
+/* A distinct sequence of line operators, found in one or more contours. */
+struct body {
+	size_t off, len;
+	int uses;
+	int subr;	/* subroutine number, or -1 if it's used inline */
+};
+
+struct bodies {
+	struct buf data;
+	struct body *body;
+	int count;
+	int *table;	/* hash table of indices into body[] */
+	unsigned mask;
+	int *contour;	/* body used by each contour in the font */
+};
+
+/* Most uses first, and equally popular bodies in font order. */
+static int
+body_cmp(void const *va, void const *vb)
+{
+	struct body const *a = *(struct body *const *)va;
+	struct body const *b = *(struct body *const *)vb;
+
+	if (a->uses != b->uses) return a->uses > b->uses ? -1 : 1;
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Work out the line operators for every contour in the font, merging
+ * identical ones, and decide which are worth making into
+ * subroutines.  A call costs about three bytes, and a subroutine
+ * costs its body, a return, and an INDEX offset.
+ */
+static int
+find_bodies(struct bodies *bs, struct font const *font,
+    int const *order, int nglyphs)
+{
+	struct fontglyph const *g;
+	struct body *b, **bysize;
+	int i, c, n, total = 0, nsubrs;
+	unsigned h;
+	size_t off;
+
+	for (i = 0; i < nglyphs; i++)
+		if (order[i] >= 0)
+			total += font->glyphs[order[i]].ncontours;
+	buf_init(&bs->data);
+	for (bs->mask = 1; bs->mask < 2 * (unsigned)total; bs->mask <<= 1)
+		continue;
+	bs->body = malloc((total + 1) * sizeof(bs->body[0]));
+	bs->table = malloc(bs->mask * sizeof(bs->table[0]));
+	bs->contour = malloc((total + 1) * sizeof(bs->contour[0]));
+	if (bs->body == NULL || bs->table == NULL || bs->contour == NULL)
+		return -1;
+	bs->mask--;
+	for (h = 0; h <= bs->mask; h++)
+		bs->table[h] = -1;
+	bs->count = 0;
+	n = 0;
+	for (i = 0; i < nglyphs; i++) {
+		if (order[i] < 0) continue;
+		g = &font->glyphs[order[i]];
+		for (c = 0; c < g->ncontours; c++) {
+			off = bs->data.len;
+			cs_lines(&bs->data, g->points + g->contours[c],
+			    g->contours[c + 1] - g->contours[c]);
+			if (bs->data.failed) return -1;
+			for (h = bytehash(bs->data.data + off,
+				 bs->data.len - off) & bs->mask;
+			     bs->table[h] != -1; h = (h + 1) & bs->mask) {
+				b = &bs->body[bs->table[h]];
+				if (b->len == bs->data.len - off &&
+				    memcmp(bs->data.data + b->off,
+					bs->data.data + off, b->len) == 0)
+					break;
+			}
+			if (bs->table[h] == -1) {
+				b = &bs->body[bs->count];
+				b->off = off;
+				b->len = bs->data.len - off;
+				b->uses = 0;
+				bs->table[h] = bs->count++;
+			} else
+				bs->data.len = off;
+			bs->body[bs->table[h]].uses++;
+			bs->contour[n++] = bs->table[h];
+		}
+	}
+
+	/* Give the most popular subroutines the shortest numbers. */
+	bysize = malloc((bs->count + 1) * sizeof(bysize[0]));
+	if (bysize == NULL) return -1;
+	nsubrs = 0;
+	for (i = 0; i < bs->count; i++) {
+		b = &bs->body[i];
+		b->subr = -1;
+		if ((size_t)b->uses * b->len > (size_t)b->uses * 3 + b->len + 3)
+			bysize[nsubrs++] = b;
+	}
+	qsort(bysize, nsubrs, sizeof(bysize[0]), body_cmp);
+	for (i = 0; i < nsubrs; i++)
+		bysize[i]->subr = i;
+	free(bysize);
+	return nsubrs;
+}
+
+static void
+bodies_free(struct bodies *bs)
+{
+
+	buf_free(&bs->data);
+	free(bs->body);
+	free(bs->table);
+	free(bs->contour);
+}
+
+static int
+subr_bias(int nsubrs)
+{
+
+	return nsubrs < 1240 ? 107 : nsubrs < 33900 ? 1131 : 32768;
+}
+
+/* The bounding box of a glyph, which is all zeros if it's empty. */
+static void
+glyph_bbox(struct fontglyph const *g, int bbox[4])
+{
+	int i;
+
+	bbox[0] = bbox[1] = bbox[2] = bbox[3] = 0;
+	for (i = 0; i < g->contours[g->ncontours]; i++) {
+		if (i == 0 || g->points[i].x < bbox[0]) bbox[0] = g->points[i].x;
+		if (i == 0 || g->points[i].y < bbox[1]) bbox[1] = g->points[i].y;
+		if (i == 0 || g->points[i].x > bbox[2]) bbox[2] = g->points[i].x;
+		if (i == 0 || g->points[i].y > bbox[3]) bbox[3] = g->points[i].y;
+	}
+}
+
+/*
+ * The width that glyphs get without saying so: that of .notdef if
+ * there is one, or else of the first glyph.
+ */
+static int
+font_nominal_width(struct font const *font, int const *order)
+{
+
+	if (order[0] >= 0) return font->glyphs[order[0]].advance;
+	if (font->nglyphs > 0) return font->glyphs[0].advance;
+	return 0;
+}
+
+/* Write a glyph's charstring, given the first of its contours' bodies. */
+static void
+cs_glyph(struct buf *b, struct fontglyph const *g, int nominal,
+    struct bodies const *bs, int const *body, int bias)
+{
+	struct body const *bd;
+	struct bedstead_vec cur = { 0, 0 }, p;
+	int c;
+
+	if (g != NULL && g->advance != nominal)
+		cff_int(b, g->advance - nominal);
+	for (c = 0; g != NULL && c < g->ncontours; c++) {
+		p = g->points[g->contours[c]];
+		cff_int(b, p.x - cur.x); cff_int(b, p.y - cur.y);
+		cff_op(b, CS_RMOVETO);
+		bd = &bs->body[body[c]];
+		if (bd->subr >= 0) {
+			cff_int(b, bd->subr - bias);
+			cff_op(b, CS_CALLGSUBR);
+		} else
+			buf_put(b, bs->data.data + bd->off, bd->len);
+		cur = g->points[g->contours[c + 1] - 1];
+	}
+	cff_op(b, CS_ENDCHAR);
+}
+
+/* Whether every glyph has the same advance width. */
+static bool
+font_fixed_pitch(struct font const *font)
+{
+	int i;
+
+	for (i = 1; i < font->nglyphs; i++)
+		if (font->glyphs[i].advance != font->glyphs[0].advance)
+			return false;
+	return true;
+}
+
+/*
+ * Top DICT, with fixed-size offsets so that its length is known.  The
+ * default FontMatrix assumes 1000 units per em, which is what
+ * Bedstead itself has, so it's only given for other fonts.
+ */
+static void
+put_topdict(struct buf *b, struct font const *font,
+    int const sids[4], int const bbox[4], long charset, long charstrings,
+    long privsize, long private)
+{
+	int i, em = font->ascent + font->descent;
+
+	cff_int(b, sids[0]); cff_op(b, TOP_NOTICE);
+	cff_int(b, sids[1]); cff_op(b, TOP_FULLNAME);
+	cff_int(b, sids[2]); cff_op(b, TOP_FAMILYNAME);
+	cff_int(b, sids[3]); cff_op(b, TOP_WEIGHT);
+	if (font_fixed_pitch(font)) {
+		cff_int(b, 1); cff_op(b, TOP_ISFIXEDPITCH);
+	}
+	if (em != 1000) {
+		cff_real(b, 1.0 / em); cff_int(b, 0);
+		cff_int(b, 0); cff_real(b, 1.0 / em);
+		cff_int(b, 0); cff_int(b, 0);
+		cff_op(b, TOP_FONTMATRIX);
+	}
+	cff_int(b, font->underlinepos); cff_op(b, TOP_UNDERLINEPOSITION);
+	cff_int(b, font->underlinewidth); cff_op(b, TOP_UNDERLINETHICKNESS);
+	for (i = 0; i < 4; i++)
+		cff_int(b, bbox[i]);
+	cff_op(b, TOP_FONTBBOX);
+	cff_long(b, charset); cff_op(b, TOP_CHARSET);
+	cff_long(b, charstrings); cff_op(b, TOP_CHARSTRINGS);
+	cff_long(b, privsize); cff_long(b, private); cff_op(b, TOP_PRIVATE);
+}
+
+static int
+write_cff(struct buf *out, struct font const *font, int const *order,
+    int nglyphs, int const fbbox[4])
+{
+	struct cffindex names, top, gsubrs, charstrings;
+	struct strings strings;
+	struct bodies bs;
+	struct buf charset, priv, tmp;
+	int sids[4], i, c, nsubrs, bias, nominal, *body;
+	struct fontglyph const *g;
+	long off;
+	int ret = -1;
+
+	index_init(&names); index_init(&top);
+	index_init(&gsubrs); index_init(&charstrings);
+	buf_init(&charset); buf_init(&priv); buf_init(&tmp);
+	memset(&bs, 0, sizeof(bs));
+	if (strings_init(&strings, nglyphs + 4) != 0) goto out;
+
+	index_add(&names, font->fontname, strlen(font->fontname));
+	sids[0] = sid(&strings, font->copyright);
+	sids[1] = sid(&strings, font->fullname);
+	sids[2] = sid(&strings, font->familyname);
+	sids[3] = sid(&strings, font->weight);
+	buf_put8(&charset, 0);
+	for (i = 1; i < nglyphs; i++)
+		buf_put16(&charset, sid(&strings, font->glyphs[order[i]].name));
+
+	nsubrs = find_bodies(&bs, font, order, nglyphs);
+	if (nsubrs < 0) goto out;
+	bias = subr_bias(nsubrs);
+	for (c = 0; c < nsubrs; c++)
+		for (i = 0; i < bs.count; i++)
+			if (bs.body[i].subr == c) {
+				buf_put(&gsubrs.data,
+				    bs.data.data + bs.body[i].off,
+				    bs.body[i].len);
+				cff_op(&gsubrs.data, CS_RETURN);
+				index_next(&gsubrs);
+				break;
+			}
+
+	/* Our glyphs are all the same width, at least so far. */
+	nominal = font_nominal_width(font, order);
+	body = bs.contour;
+	for (i = 0; i < nglyphs; i++) {
+		g = order[i] >= 0 ? &font->glyphs[order[i]] : NULL;
+		cs_glyph(&charstrings.data, g, nominal, &bs, body, bias);
+		index_next(&charstrings);
+		if (g) body += g->ncontours;
+	}
+
+	cff_int(&priv, font->stdhw); cff_op(&priv, PRIV_STDHW);
+	cff_int(&priv, font->stdvw); cff_op(&priv, PRIV_STDVW);
+	cff_int(&priv, nominal); cff_op(&priv, PRIV_DEFAULTWIDTHX);
+	cff_int(&priv, nominal); cff_op(&priv, PRIV_NOMINALWIDTHX);
+
+	/*
+	 * The layout is: header, Name INDEX, Top DICT INDEX, String
+	 * INDEX, Global Subr INDEX, charset, CharStrings INDEX, and
+	 * Private DICT.  The Top DICT is the same size whatever its
+	 * offsets are, so build it once to measure it and then again
+	 * with the offsets filled in.
+	 */
+	put_topdict(&top.data, font, sids, fbbox, 0, 0, 0, 0);
+	index_next(&top);
+	put_index(&tmp, &top);
+	off = 4;
+	put_index(&tmp, &names);
+	put_index(&tmp, &strings.index);
+	put_index(&tmp, &gsubrs);
+	off += tmp.len;
+	tmp.len = 0;
+	put_index(&tmp, &charstrings);
+	top.data.len = 0; top.count = 0;
+	put_topdict(&top.data, font, sids, fbbox, off, off + charset.len,
+	    priv.len, off + charset.len + tmp.len);
+	index_next(&top);
+
+	buf_put8(out, 1); buf_put8(out, 0);	/* version 1.0 */
+	buf_put8(out, 4);			/* hdrSize */
+	buf_put8(out, 4);			/* offSize */
+	put_index(out, &names);
+	put_index(out, &top);
+	put_index(out, &strings.index);
+	put_index(out, &gsubrs);
+	buf_put(out, charset.data, charset.len);
+	buf_put(out, tmp.data, tmp.len);
+	buf_put(out, priv.data, priv.len);
+	ret = 0;
+out:
+	if (names.failed || top.failed || strings.index.failed ||
+	    gsubrs.failed || charstrings.failed || names.data.failed ||
+	    top.data.failed || strings.index.data.failed || gsubrs.data.failed ||
+	    charstrings.data.failed || charset.failed || priv.failed ||
+	    tmp.failed)
+		ret = -1;
+	index_free(&names); index_free(&top); strings_free(&strings);
+	index_free(&gsubrs); index_free(&charstrings);
+	buf_free(&charset); buf_free(&priv); buf_free(&tmp);
+	bodies_free(&bs);
+	return ret;
+}
+
+/*
+ * OpenType layout tables.  Each feature uses one lookup, and is
+ * registered either for both the DFLT and latn scripts or for latn
+ * alone.  Features must be given in tag order.
+ */
+struct feature {
+	char tag[5];
+	bool dflt;
+	int nameid;	/* For stylistic sets, or 0 */
+	int lookup;
+};
+
+/*
+ * Something to be sorted by key, usually a glyph ID.  In the cmap,
+ * the key is a character code.
+ */
+struct pair {
+	int key, value, value2;
+};
+
+static int
+pair_cmp(void const *va, void const *vb)
+{
+	struct pair const *a = va, *b = vb;
+
+	return a->key < b->key ? -1 : a->key > b->key;
+}
+
+static void
+put_coverage(struct buf *b, struct pair const *p, int n)
+{
+	int i;
+
+	buf_put16(b, 1);			/* CoverageFormat1 */
+	buf_put16(b, n);
+	for (i = 0; i < n; i++)
+		buf_put16(b, p[i].key);
+}
+
+/* Lookup header for a lookup with a single subtable. */
+static void
+put_lookup_header(struct buf *b, int type)
+{
+
+	buf_put16(b, type);
+	buf_put16(b, 0);			/* lookupFlag */
+	buf_put16(b, 1);			/* subTableCount */
+	buf_put16(b, 8);			/* subtable offset */
+}
+
+/* SingleSubstFormat2 */
+static void
+put_single_subst(struct buf *b, struct pair *p, int n)
+{
+	int i;
+
+	qsort(p, n, sizeof(p[0]), pair_cmp);
+	put_lookup_header(b, 1);
+	buf_put16(b, 2);
+	buf_put16(b, 6 + 2 * n);		/* coverageOffset */
+	buf_put16(b, n);
+	for (i = 0; i < n; i++)
+		buf_put16(b, p[i].value);
+	put_coverage(b, p, n);
+}
+
+/* SinglePosFormat2 with XPlacement and XAdvance */
+static void
+put_single_pos(struct buf *b, struct pair *p, int n)
+{
+	int i;
+
+	qsort(p, n, sizeof(p[0]), pair_cmp);
+	put_lookup_header(b, 1);
+	buf_put16(b, 2);
+	buf_put16(b, 8 + 4 * n);		/* coverageOffset */
+	buf_put16(b, 0x0005);			/* valueFormat */
+	buf_put16(b, n);
+	for (i = 0; i < n; i++) {
+		buf_put16(b, p[i].value & 0xffff);
+		buf_put16(b, p[i].value2 & 0xffff);
+	}
+	put_coverage(b, p, n);
+}
+
+/*
+ * AlternateSubstFormat1.  p[i].value is the index of glyph i's first
+ * alternate in alts[] and p[i].value2 is how many it has.
+ */
+static void
+put_alternate_subst(struct buf *b, struct pair *p, int n, int const *alts)
+{
+	int i, j, off;
+
+	qsort(p, n, sizeof(p[0]), pair_cmp);
+	put_lookup_header(b, 3);
+	off = 6 + 2 * n;
+	for (i = 0; i < n; i++)
+		off += 2 + 2 * p[i].value2;
+	buf_put16(b, 1);
+	buf_put16(b, off);			/* coverageOffset */
+	buf_put16(b, n);
+	off = 6 + 2 * n;
+	for (i = 0; i < n; i++) {
+		buf_put16(b, off);
+		off += 2 + 2 * p[i].value2;
+	}
+	for (i = 0; i < n; i++) {
+		buf_put16(b, p[i].value2);
+		for (j = 0; j < p[i].value2; j++)
+			buf_put16(b, alts[p[i].value + j]);
+	}
+	put_coverage(b, p, n);
+}
+
+static void
+put_tag(struct buf *b, char const *tag)
+{
+
+	buf_put(b, tag, 4);
+}
+
+/* GSUB or GPOS header, ScriptList, FeatureList, and LookupList. */
+static void
+put_layout(struct buf *b, struct feature const *f, int nf,
+    struct buf const *lookups, int nlookups)
+{
+	size_t start = b->len, scripts, features, lookuplist, off;
+	int i, n, s;
+
+	buf_put16(b, 1); buf_put16(b, 0);	/* version 1.0 */
+	buf_put16(b, 0); buf_put16(b, 0); buf_put16(b, 0);
+
+	/* ScriptList, with DFLT and latn each having a default LangSys. */
+	scripts = b->len;
+	buf_patch16(b, start + 4, scripts - start);
+	buf_put16(b, 2);
+	buf_put(b, "DFLT", 4); buf_put16(b, 0);
+	buf_put(b, "latn", 4); buf_put16(b, 0);
+	for (s = 0; s < 2; s++) {
+		buf_patch16(b, scripts + 2 + 6 * s + 4, b->len - scripts);
+		buf_put16(b, 4);		/* defaultLangSysOffset */
+		buf_put16(b, 0);		/* langSysCount */
+		buf_put16(b, 0);		/* lookupOrderOffset */
+		buf_put16(b, 0xffff);		/* requiredFeatureIndex */
+		for (i = n = 0; i < nf; i++)
+			if (s == 1 || f[i].dflt) n++;
+		buf_put16(b, n);
+		for (i = 0; i < nf; i++)
+			if (s == 1 || f[i].dflt) buf_put16(b, i);
+	}
+
+	/* FeatureList */
+	features = b->len;
+	buf_patch16(b, start + 6, features - start);
+	buf_put16(b, nf);
+	for (i = 0; i < nf; i++) {
+		put_tag(b, f[i].tag); buf_put16(b, 0);
+	}
+	for (i = 0; i < nf; i++) {
+		off = b->len;
+		buf_patch16(b, features + 2 + 6 * i + 4, off - features);
+		buf_put16(b, f[i].nameid ? 6 : 0); /* featureParamsOffset */
+		buf_put16(b, 1);
+		buf_put16(b, f[i].lookup);
+		if (f[i].nameid) {
+			/* FeatureParams for stylistic sets */
+			buf_put16(b, 0);
+			buf_put16(b, f[i].nameid);
+		}
+	}
+
+	/* LookupList */
+	lookuplist = b->len;
+	buf_patch16(b, start + 8, lookuplist - start);
+	buf_put16(b, nlookups);
+	for (i = 0; i < nlookups; i++)
+		buf_put16(b, 0);
+	for (i = 0; i < nlookups; i++) {
+		buf_patch16(b, lookuplist + 2 + 2 * i, b->len - lookuplist);
+		buf_put(b, lookups[i].data, lookups[i].len);
+		if (lookups[i].failed) b->failed = true;
+	}
+}
+
+#define NAME_SS01 256
+
+static int
+write_gsub(struct buf *b, struct font const *font, int const *gid,
+    int nglyphs, int const *order)
+{
+	static struct feature const features[] = {
+		{ "aalt", true,  0,		4 },
+		{ "c2sc", false, 0,		6 },
+		{ "salt", true,  0,		0 },
+		{ "smcp", false, 0,		5 },
+		{ "ss01", true,  NAME_SS01,	1 },
+		{ "ss02", true,  NAME_SS01 + 1,	2 },
+		{ "ss04", true,  NAME_SS01 + 2,	3 },
+	};
+	/* Which substitution each of the single lookups uses. */
+	static int const single[] = { SUBST_SALT, SUBST_SS01, SUBST_SS02,
+	    SUBST_SS04, -1, SUBST_SMCP, SUBST_C2SC };
+	struct buf lookups[7];
+	struct pair *p;
+	int *alts, nalts;
+	struct fontglyph const *g;
+	int l, i, j, n, ret = 0;
+
+	p = malloc((nglyphs + 1) * sizeof(p[0]));
+	for (i = nalts = 0; i < font->nglyphs; i++)
+		nalts += font->glyphs[i].nalts;
+	alts = malloc((nalts + 1) * sizeof(alts[0]));
+	if (p == NULL || alts == NULL) {
+		free(p);
+		free(alts);
+		return -1;
+	}
+	for (l = 0; l < 7; l++) {
+		buf_init(&lookups[l]);
+		n = nalts = 0;
+		for (i = 0; i < nglyphs; i++) {
+			if (order[i] < 0) continue;
+			g = &font->glyphs[order[i]];
+			if (single[l] >= 0) {
+				if (g->subst[single[l]] < 0) continue;
+				p[n].key = i;
+				p[n++].value = gid[g->subst[single[l]]];
+			} else if (g->nalts) {
+				p[n].key = i;
+				p[n].value = nalts;
+				p[n++].value2 = g->nalts;
+				for (j = 0; j < g->nalts; j++)
+					alts[nalts++] = gid[g->alts[j]];
+			}
+		}
+		if (single[l] >= 0)
+			put_single_subst(&lookups[l], p, n);
+		else
+			put_alternate_subst(&lookups[l], p, n, alts);
+	}
+	put_layout(b, features, 7, lookups, 7);
+	for (l = 0; l < 7; l++)
+		buf_free(&lookups[l]);
+	free(p);
+	free(alts);
+	return ret;
+}
+
+static int
+write_gpos(struct buf *b, struct font const *font, int nglyphs,
+    int const *order)
+{
+	static struct feature const features[] = {
+		{ "palt", true, 0, 0 },
+	};
+	struct buf lookup;
+	struct pair *p;
+	struct fontglyph const *g;
+	int i, n;
+
+	p = malloc((nglyphs + 1) * sizeof(p[0]));
+	if (p == NULL) return -1;
+	for (i = n = 0; i < nglyphs; i++) {
+		if (order[i] < 0) continue;
+		g = &font->glyphs[order[i]];
+		if (g->palt_dx == 0 && g->palt_dh == 0) continue;
+		p[n].key = i;
+		p[n].value = g->palt_dx;
+		p[n++].value2 = g->palt_dh;
+	}
+	buf_init(&lookup);
+	put_single_pos(&lookup, p, n);
+	put_layout(b, features, 1, &lookup, 1);
+	buf_free(&lookup);
+	free(p);
+	return 0;
+}
+
+/*
+ * cmap, with a format 4 subtable for the BMP and a format 12 subtable
+ * for everything.  Each is made of runs of consecutive characters
+ * mapped to consecutive glyphs.
+ */
+static int
+write_cmap(struct buf *b, struct pair *map, int n)
+{
+	int i, j, nseg, ngroups;
+	size_t f4, f12;
+
+	qsort(map, n, sizeof(map[0]), pair_cmp);
+	/* Drop duplicate code points, keeping the first glyph. */
+	for (i = j = 0; i < n; i++)
+		if (j == 0 || map[i].key != map[j - 1].key)
+			map[j++] = map[i];
+	n = j;
+	for (i = nseg = ngroups = 0; i < n; i++)
+		if (i == 0 || map[i].key != map[i-1].key + 1 ||
+		    map[i].value != map[i-1].value + 1) {
+			ngroups++;
+			if (map[i].key < 0xffff) nseg++;
+		}
+	nseg++;					/* for 0xFFFF */
+
+	buf_put16(b, 0);			/* version */
+	buf_put16(b, 4);			/* numTables */
+	buf_put16(b, 0); buf_put16(b, 3); buf_put32(b, 36);
+	buf_put16(b, 0); buf_put16(b, 4); buf_put32(b, 0);
+	buf_put16(b, 3); buf_put16(b, 1); buf_put32(b, 36);
+	buf_put16(b, 3); buf_put16(b, 10); buf_put32(b, 0);
+
+	/* Format 4 */
+	f4 = b->len;
+	assert(f4 == 36);
+	buf_put16(b, 4);
+	buf_put16(b, 16 + 8 * nseg);		/* length */
+	buf_put16(b, 0);			/* language */
+	buf_put16(b, 2 * nseg);
+	for (i = 1; 2 * i <= nseg; i *= 2)
+		continue;
+	buf_put16(b, 2 * i);			/* searchRange */
+	for (j = 0; (1 << (j + 1)) <= i; j++)
+		continue;
+	buf_put16(b, j);			/* entrySelector */
+	buf_put16(b, 2 * nseg - 2 * i);		/* rangeShift */
+	/* endCode, reservedPad, startCode, idDelta, idRangeOffset */
+	for (i = 0; i < n; i++)
+		if (map[i].key < 0xffff &&
+		    (i == n - 1 || map[i+1].key >= 0xffff ||
+			map[i+1].key != map[i].key + 1 ||
+			map[i+1].value != map[i].value + 1))
+			buf_put16(b, map[i].key);
+	buf_put16(b, 0xffff);
+	buf_put16(b, 0);
+	for (i = 0; i < n; i++)
+		if (map[i].key < 0xffff &&
+		    (i == 0 || map[i].key != map[i-1].key + 1 ||
+			map[i].value != map[i-1].value + 1))
+			buf_put16(b, map[i].key);
+	buf_put16(b, 0xffff);
+	for (i = 0; i < n; i++)
+		if (map[i].key < 0xffff &&
+		    (i == 0 || map[i].key != map[i-1].key + 1 ||
+			map[i].value != map[i-1].value + 1))
+			buf_put16(b, (map[i].value - map[i].key) & 0xffff);
+	buf_put16(b, 1);
+	for (i = 0; i < nseg; i++)
+		buf_put16(b, 0);
+
+	/* Format 12 */
+	f12 = b->len;
+	buf_patch32(b, 16, f12);
+	buf_patch32(b, 32, f12);
+	buf_put16(b, 12); buf_put16(b, 0);
+	buf_put32(b, 16 + 12 * ngroups);
+	buf_put32(b, 0);			/* language */
+	buf_put32(b, ngroups);
+	for (i = 0; i < n; i++)
+		if (i == 0 || map[i].key != map[i-1].key + 1 ||
+		    map[i].value != map[i-1].value + 1) {
+			for (j = i + 1; j < n &&
+				 map[j].key == map[j-1].key + 1 &&
+				 map[j].value == map[j-1].value + 1; j++)
+				continue;
+			buf_put32(b, map[i].key);
+			buf_put32(b, map[j-1].key);
+			buf_put32(b, map[i].value);
+		}
+	return 0;
+}
+
+struct name {
+	int id;
+	char const *s;
+};
+
+/* name table, with Windows Unicode strings only. */
+static void
+write_name(struct buf *b, struct name const *names, int n)
+{
+	int i;
+	size_t off = 0;
+	char const *s;
+
+	buf_put16(b, 0);			/* version */
+	buf_put16(b, n);
+	buf_put16(b, 6 + 12 * n);		/* storageOffset */
+	for (i = 0; i < n; i++) {
+		buf_put16(b, 3); buf_put16(b, 1); buf_put16(b, 0x409);
+		buf_put16(b, names[i].id);
+		buf_put16(b, 2 * strlen(names[i].s));
+		buf_put16(b, off);
+		off += 2 * strlen(names[i].s);
+	}
+	/* All our strings are ASCII, which makes UTF-16 easy. */
+	for (i = 0; i < n; i++)
+		for (s = names[i].s; *s; s++)
+			buf_put16(b, (unsigned char)*s);
+}
+
+/* OS/2 ulUnicodeRange bits for the blocks we're likely to have. */
+static struct {
+	unsigned long first, last;
+	int bit;
+} const unicoderanges[] = {
+	{ 0x0000, 0x007f, 0 },	{ 0x0080, 0x00ff, 1 },
+	{ 0x0100, 0x017f, 2 },	{ 0x0180, 0x024f, 3 },
+	{ 0x0250, 0x02af, 4 },	{ 0x02b0, 0x02ff, 5 },
+	{ 0x0300, 0x036f, 6 },	{ 0x0370, 0x03ff, 7 },
+	{ 0x0400, 0x04ff, 9 },	{ 0x0530, 0x058f, 10 },
+	{ 0x0590, 0x05ff, 11 },	{ 0x0600, 0x06ff, 13 },
+	{ 0x1e00, 0x1eff, 29 },	{ 0x2000, 0x206f, 31 },
+	{ 0x2070, 0x209f, 32 },	{ 0x20a0, 0x20cf, 33 },
+	{ 0x2100, 0x214f, 35 },	{ 0x2150, 0x218f, 36 },
+	{ 0x2190, 0x21ff, 37 },	{ 0x2200, 0x22ff, 38 },
+	{ 0x2300, 0x23ff, 39 },	{ 0x2400, 0x243f, 40 },
+	{ 0x2460, 0x24ff, 42 },	{ 0x2500, 0x257f, 43 },
+	{ 0x2580, 0x259f, 44 },	{ 0x25a0, 0x25ff, 45 },
+	{ 0x2600, 0x26ff, 46 },	{ 0x2700, 0x27bf, 47 },
+	{ 0x2900, 0x297f, 37 },	{ 0x2b00, 0x2bff, 37 },
+	{ 0xe000, 0xf8ff, 60 },	{ 0xfb50, 0xfdff, 63 },
+	{ 0xfe70, 0xfeff, 67 },	{ 0xfff0, 0xffff, 69 },
+	{ 0x10000, 0x10ffff, 57 },
+};
+
+/* ulCodePageRange1 bits, each indicated by a character from it. */
+static struct {
+	unsigned long c;
+	int bit;
+} const codepages[] = {
+	{ 0x00e9, 0 },	/* Latin 1 */
+	{ 0x010d, 1 },	/* Latin 2 */
+	{ 0x0436, 2 },	/* Cyrillic */
+	{ 0x03b1, 3 },	/* Greek */
+	{ 0x05d0, 5 },	/* Hebrew */
+};
+
+static int
+font_char_height(struct font const *font, int c)
+{
+	int i, bbox[4];
+
+	for (i = 0; i < font->nglyphs; i++)
+		if (font->glyphs[i].unicode == c) {
+			glyph_bbox(&font->glyphs[i], bbox);
+			return bbox[3];
+		}
+	return 0;
+}
+
+static void
+write_os2(struct buf *b, struct font const *font, int const fbbox[4])
+{
+	unsigned long ranges[4] = { 0, 0, 0, 0 }, cp = 0;
+	long total = 0;
+	int i, j, n = 0, first = 0xffff, last = 0, u;
+
+	for (i = 0; i < font->nglyphs; i++) {
+		if (font->glyphs[i].advance) {
+			total += font->glyphs[i].advance;
+			n++;
+		}
+		u = font->glyphs[i].unicode;
+		if (u < 0) continue;
+		if (u < first) first = u;
+		if (u > last) last = u;
+		for (j = 0; j < (int)(sizeof(unicoderanges) /
+			 sizeof(unicoderanges[0])); j++)
+			if (u >= (long)unicoderanges[j].first &&
+			    u <= (long)unicoderanges[j].last)
+				ranges[unicoderanges[j].bit / 32] |=
+				    1UL << (unicoderanges[j].bit % 32);
+		for (j = 0; j < (int)(sizeof(codepages) /
+			 sizeof(codepages[0])); j++)
+			if (u == (long)codepages[j].c)
+				cp |= 1UL << codepages[j].bit;
+	}
+	buf_put16(b, 4);			/* version */
+	buf_put16(b, n ? total / n : 0);	/* xAvgCharWidth */
+	buf_put16(b, font->weightclass);
+	buf_put16(b, font->widthclass);
+	buf_put16(b, 0);			/* fsType: installable */
+	buf_put16(b, font->subxsize); buf_put16(b, font->subysize);
+	buf_put16(b, font->subxoff); buf_put16(b, font->subyoff);
+	buf_put16(b, font->supxsize); buf_put16(b, font->supysize);
+	buf_put16(b, font->supxoff); buf_put16(b, font->supyoff);
+	buf_put16(b, font->strikesize); buf_put16(b, font->strikepos);
+	buf_put16(b, 0);			/* sFamilyClass */
+	buf_zero(b, 10);			/* panose */
+	for (i = 0; i < 4; i++)
+		buf_put32(b, ranges[i]);
+	buf_put(b, "    ", 4);			/* achVendID */
+	buf_put16(b, 0x0040);			/* fsSelection: REGULAR */
+	buf_put16(b, first > 0xffff ? 0xffff : first);
+	buf_put16(b, last > 0xffff ? 0xffff : last);
+	buf_put16(b, font->ascent);		/* sTypoAscender */
+	buf_put16(b, -font->descent & 0xffff);	/* sTypoDescender */
+	buf_put16(b, 0);			/* sTypoLineGap */
+	buf_put16(b, fbbox[3] > font->ascent ? fbbox[3] : font->ascent);
+	buf_put16(b, -fbbox[1] > font->descent ? -fbbox[1] : font->descent);
+	buf_put32(b, cp);
+	buf_put32(b, 0);
+	buf_put16(b, font_char_height(font, 'x'));
+	buf_put16(b, font_char_height(font, 'H'));
+	buf_put16(b, 0);			/* usDefaultChar */
+	buf_put16(b, ' ');			/* usBreakChar */
+	buf_put16(b, 1);			/* usMaxContext */
+}
+
+/*
+ * Embedded bitmaps.  Every glyph in a strike fills the same cell, so
+ * each strike has a single index subtable, in format 2, which gives
+ * the metrics once and then the glyphs' images in format 5, packed
+ * together bit by bit.  The strikes cover every glyph except a
+ * made-up .notdef.
+ */
+static void
+put_line_metrics(struct buf *b, int ascent, int descent, int width)
+{
+
+	buf_put8(b, ascent & 0xff);
+	buf_put8(b, -descent & 0xff);
+	buf_put8(b, width);
+	buf_put8(b, 1);				/* caretSlopeNumerator */
+	buf_put8(b, 0);				/* caretSlopeDenominator */
+	buf_put8(b, 0);				/* caretOffset */
+	buf_put8(b, 0);				/* minOriginSB */
+	buf_put8(b, 0);				/* minAdvanceSB */
+	buf_put8(b, ascent & 0xff);		/* maxBeforeBL */
+	buf_put8(b, -descent & 0xff);		/* minAfterBL */
+	buf_zero(b, 2);
+}
+
+static void
+write_ebdt(struct buf *ebdt, struct buf *eblc, struct font const *font,
+    int const *order, int nglyphs)
+{
+	struct strike const *s;
+	unsigned acc;
+	int i, k, y, bits, first = order[0] < 0, size;
+
+	buf_put32(ebdt, 0x00020000);
+	buf_put32(eblc, 0x00020000);
+	buf_put32(eblc, font->nstrikes);
+	for (k = 0; k < font->nstrikes; k++) {
+		s = &font->strikes[k];
+		/* indexSubTableArrayOffset, indexTablesSize */
+		buf_put32(eblc, 8 + 48 * font->nstrikes + 28 * k);
+		buf_put32(eblc, 28);
+		buf_put32(eblc, 1);		/* numberOfIndexSubTables */
+		buf_put32(eblc, 0);		/* colorRef */
+		put_line_metrics(eblc, s->ascent, s->height - s->ascent,
+		    s->width);
+		put_line_metrics(eblc, s->width / 2, s->width - s->width / 2,
+		    s->height);
+		buf_put16(eblc, first);
+		buf_put16(eblc, nglyphs - 1);
+		buf_put8(eblc, s->height);	/* ppemX */
+		buf_put8(eblc, s->height);	/* ppemY */
+		buf_put8(eblc, 1);		/* bitDepth */
+		buf_put8(eblc, 1);		/* flags: horizontal */
+	}
+	for (k = 0; k < font->nstrikes; k++) {
+		s = &font->strikes[k];
+		size = (s->width * s->height + 7) / 8;
+		buf_put16(eblc, first);
+		buf_put16(eblc, nglyphs - 1);
+		buf_put32(eblc, 8);		/* additionalOffset */
+		buf_put16(eblc, 2);		/* indexFormat */
+		buf_put16(eblc, 5);		/* imageFormat */
+		buf_put32(eblc, ebdt->len);	/* imageDataOffset */
+		buf_put32(eblc, size);		/* imageSize */
+		buf_put8(eblc, s->height);
+		buf_put8(eblc, s->width);
+		buf_put8(eblc, 0);		/* horiBearingX */
+		buf_put8(eblc, s->ascent);	/* horiBearingY */
+		buf_put8(eblc, s->width);	/* horiAdvance */
+		buf_put8(eblc, -(s->width / 2) & 0xff); /* vertBearingX */
+		buf_put8(eblc, 0);		/* vertBearingY */
+		buf_put8(eblc, s->height);	/* vertAdvance */
+		for (i = first; i < nglyphs; i++) {
+			acc = 0;
+			bits = 0;
+			for (y = 0; y < s->height; y++) {
+				acc = acc << s->width |
+				    s->glyphs[order[i]].rows[y];
+				bits += s->width;
+				while (bits >= 8) {
+					bits -= 8;
+					buf_put8(ebdt, acc >> bits & 0xff);
+				}
+			}
+			if (bits > 0)
+				buf_put8(ebdt, acc << (8 - bits) & 0xff);
+		}
+	}
+}
+
+static unsigned long
+checksum(unsigned char const *p, size_t len)
+{
+	unsigned long sum = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		sum += (unsigned long)p[i] << (24 - 8 * (i % 4));
+	return sum & 0xffffffff;
+}
+
+struct table {
+	char tag[5];
+	struct buf b;
+};
+
+static int
+table_cmp(void const *va, void const *vb)
+{
+	struct table const *a = va, *b = vb;
+
+	return memcmp(a->tag, b->tag, 4);
+}
+
+enum { T_CFF, T_EBDT, T_EBLC, T_GPOS, T_GSUB, T_OS2, T_CMAP, T_GASP,
+       T_HEAD, T_HHEA, T_HMTX, T_MAXP, T_NAME, T_POST, NTABLES };
+
+static struct table const table_tags[NTABLES] = {
+	{ "CFF " }, { "EBDT" }, { "EBLC" }, { "GPOS" }, { "GSUB" },
+	{ "OS/2" }, { "cmap" }, { "gasp" }, { "head" }, { "hhea" },
+	{ "hmtx" }, { "maxp" }, { "name" }, { "post" },
+};
+
+/*
+ * Make every table of the font, sorted by tag.  Only the bitmap tables
+ * can be empty, and then they're left out of the font.
+ */
+static int
+make_tables(struct table tables[NTABLES], struct font const *font)
+{
+	struct name names[10];
+	struct pair *map;
+	int *order, *gid;
+	int nglyphs, i, n, t, bbox[4], fbbox[4], gbbox[4];
+	int advmax = 0, minlsb = 0, minrsb = 0, maxext = 0;
+	char const *style;
+	char unique[256], version[64];
+	long long when;
+	int ret = -1;
+
+	/* .notdef must be glyph 0, so move it there if we have one. */
+	nglyphs = font->nglyphs + 1;
+	order = malloc(nglyphs * sizeof(order[0]));
+	gid = malloc((font->nglyphs + 1) * sizeof(gid[0]));
+	map = malloc((font->nglyphs + 1) * sizeof(map[0]));
+	if (order == NULL || gid == NULL || map == NULL)
+		goto out;
+	order[0] = -1;
+	for (i = 0; i < font->nglyphs; i++)
+		if (strcmp(font->glyphs[i].name, ".notdef") == 0) {
+			order[0] = i;
+			break;
+		}
+	if (order[0] >= 0) nglyphs--;
+	for (i = 0, n = 1; i < font->nglyphs; i++)
+		if (i != order[0])
+			order[n++] = i;
+	for (i = 0; i < nglyphs; i++)
+		if (order[i] >= 0)
+			gid[order[i]] = i;
+
+	fbbox[0] = fbbox[1] = fbbox[2] = fbbox[3] = 0;
+	for (i = n = 0; i < font->nglyphs; i++) {
+		struct fontglyph const *g = &font->glyphs[i];
+
+		glyph_bbox(g, bbox);
+		if (g->advance > advmax) advmax = g->advance;
+		if (g->unicode >= 0) {
+			map[n].key = g->unicode;
+			map[n++].value = gid[i];
+		}
+		if (g->ncontours == 0) continue;
+		if (bbox[0] < fbbox[0]) fbbox[0] = bbox[0];
+		if (bbox[1] < fbbox[1]) fbbox[1] = bbox[1];
+		if (bbox[2] > fbbox[2]) fbbox[2] = bbox[2];
+		if (bbox[3] > fbbox[3]) fbbox[3] = bbox[3];
+		if (bbox[0] < minlsb) minlsb = bbox[0];
+		if (g->advance - bbox[2] < minrsb)
+			minrsb = g->advance - bbox[2];
+		if (bbox[2] > maxext) maxext = bbox[2];
+	}
+
+	if (write_cff(&tables[T_CFF].b, font, order, nglyphs, fbbox) != 0 ||
+	    write_gpos(&tables[T_GPOS].b, font, nglyphs, order) != 0 ||
+	    write_gsub(&tables[T_GSUB].b, font, gid, nglyphs, order) != 0 ||
+	    write_cmap(&tables[T_CMAP].b, map, n) != 0)
+		goto out;
+	write_os2(&tables[T_OS2].b, font, fbbox);
+	if (font->nstrikes > 0)
+		write_ebdt(&tables[T_EBDT].b, &tables[T_EBLC].b, font, order,
+		    nglyphs);
+
+	buf_put16(&tables[T_GASP].b, 0);
+	buf_put16(&tables[T_GASP].b, font->ngasp);
+	for (i = 0; i < font->ngasp; i++) {
+		buf_put16(&tables[T_GASP].b, font->gasp[i].ppem);
+		buf_put16(&tables[T_GASP].b, font->gasp[i].flags);
+	}
+
+	/*
+	 * Dates are seconds since 1904.  Respect SOURCE_DATE_EPOCH so
+	 * that builds can be reproducible.
+	 */
+	when = getenv("SOURCE_DATE_EPOCH") ?
+	    strtoll(getenv("SOURCE_DATE_EPOCH"), NULL, 10) : (long long)time(NULL);
+	when += 2082844800LL;
+	{
+		struct buf *b = &tables[T_HEAD].b;
+
+		buf_put32(b, 0x00010000);	/* version */
+		buf_put32(b, (unsigned long)(strtod(font->version, NULL) *
+		    65536 + 0.5));		/* fontRevision */
+		buf_put32(b, 0);		/* checkSumAdjustment */
+		buf_put32(b, 0x5f0f3cf5);	/* magicNumber */
+		buf_put16(b, 0x0003);		/* flags */
+		buf_put16(b, font->ascent + font->descent); /* unitsPerEm */
+		buf_put32(b, when >> 32); buf_put32(b, when);
+		buf_put32(b, when >> 32); buf_put32(b, when);
+		for (i = 0; i < 4; i++)
+			buf_put16(b, fbbox[i] & 0xffff);
+		buf_put16(b, 0);		/* macStyle */
+		buf_put16(b, 8);		/* lowestRecPPEM */
+		buf_put16(b, 2);		/* fontDirectionHint */
+		buf_put16(b, 0);		/* indexToLocFormat */
+		buf_put16(b, 0);		/* glyphDataFormat */
+	}
+	{
+		struct buf *b = &tables[T_HHEA].b;
+
+		buf_put32(b, 0x00010000);
+		buf_put16(b, font->ascent);
+		buf_put16(b, -font->descent & 0xffff);
+		buf_put16(b, 0);		/* lineGap */
+		buf_put16(b, advmax);
+		buf_put16(b, minlsb & 0xffff);
+		buf_put16(b, minrsb & 0xffff);
+		buf_put16(b, maxext);
+		buf_put16(b, 1);		/* caretSlopeRise */
+		buf_put16(b, 0);		/* caretSlopeRun */
+		buf_put16(b, 0);		/* caretOffset */
+		buf_zero(b, 8);
+		buf_put16(b, 0);		/* metricDataFormat */
+		buf_put16(b, nglyphs);		/* numberOfHMetrics */
+	}
+	for (i = 0; i < nglyphs; i++) {
+		struct buf *b = &tables[T_HMTX].b;
+
+		if (order[i] >= 0) {
+			glyph_bbox(&font->glyphs[order[i]], gbbox);
+			buf_put16(b, font->glyphs[order[i]].advance);
+			buf_put16(b, gbbox[0] & 0xffff);
+		} else {
+			buf_put16(b, font_nominal_width(font, order));
+			buf_put16(b, 0);
+		}
+	}
+	buf_put32(&tables[T_MAXP].b, 0x00005000);
+	buf_put16(&tables[T_MAXP].b, nglyphs);
+	{
+		struct buf *b = &tables[T_POST].b;
+
+		buf_put32(b, 0x00030000);
+		buf_put32(b, 0);		/* italicAngle */
+		/* The top of the underline, where CFF has its centre. */
+		buf_put16(b, (font->underlinepos +
+		    font->underlinewidth / 2) & 0xffff);
+		buf_put16(b, font->underlinewidth);
+		buf_put32(b, font_fixed_pitch(font)); /* isFixedPitch */
+		buf_zero(b, 16);
+	}
+
+	style = strchr(font->fontname, '-');
+	style = style ? style + 1 : "Regular";
+	snprintf(version, sizeof(version), "Version %s", font->version);
+	snprintf(unique, sizeof(unique), "%s;%s", font->version,
+	    font->fontname);
+	n = 0;
+	names[n].id = 0; names[n++].s = font->copyright;
+	names[n].id = 1; names[n++].s = font->familyname;
+	names[n].id = 2; names[n++].s = style;
+	names[n].id = 3; names[n++].s = unique;
+	names[n].id = 4; names[n++].s = font->fullname;
+	names[n].id = 5; names[n++].s = version;
+	names[n].id = 6; names[n++].s = font->fontname;
+	names[n].id = NAME_SS01; names[n++].s = "SAA5051";
+	names[n].id = NAME_SS01 + 1; names[n++].s = "SAA5052";
+	names[n].id = NAME_SS01 + 2; names[n++].s = "SAA5054";
+	write_name(&tables[T_NAME].b, names, n);
+	qsort(tables, NTABLES, sizeof(tables[0]), table_cmp);
+	for (t = 0; t < NTABLES; t++)
+		if (tables[t].b.failed) goto out;
+	ret = 0;
+out:
+	free(order);
+	free(gid);
+	free(map);
+	return ret;
+}
+
+/*
+ * The table directory, then the tables, each padded to four bytes.
+ * The head table's checkSumAdjustment is filled in both in the output
+ * and in the table itself.
+ */
+static void
+put_sfnt(struct buf *out, struct table tables[NTABLES])
+{
+	unsigned long sum;
+	size_t off, head = 0;
+	int i, n, t, ntables, headt = 0;
+
+	for (t = ntables = 0; t < NTABLES; t++)
+		if (tables[t].b.len > 0) ntables++;
+	buf_put(out, "OTTO", 4);
+	buf_put16(out, ntables);
+	for (i = 1; 2 * i <= ntables; i *= 2)
+		continue;
+	buf_put16(out, 16 * i);			/* searchRange */
+	for (n = 0; (1 << (n + 1)) <= i; n++)
+		continue;
+	buf_put16(out, n);			/* entrySelector */
+	buf_put16(out, 16 * ntables - 16 * i);	/* rangeShift */
+	off = 12 + 16 * ntables;
+	for (t = 0; t < NTABLES; t++) {
+		if (tables[t].b.len == 0) continue;
+		if (memcmp(tables[t].tag, "head", 4) == 0) {
+			head = off;
+			headt = t;
+		}
+		buf_put(out, tables[t].tag, 4);
+		buf_put32(out, checksum(tables[t].b.data, tables[t].b.len));
+		buf_put32(out, off);
+		buf_put32(out, tables[t].b.len);
+		off += (tables[t].b.len + 3) & ~3;
+	}
+	for (t = 0; t < NTABLES; t++) {
+		buf_put(out, tables[t].b.data, tables[t].b.len);
+		buf_zero(out, -tables[t].b.len & 3);
+	}
+	if (out->failed) return;
+	sum = (0xb1b0afbaUL - checksum(out->data, out->len)) & 0xffffffff;
+	buf_patch32(out, head + 8, sum);
+	buf_patch32(&tables[headt].b, 8, sum);
+}
+
+int
+write_otf(FILE *f, struct font const *font)
+{
+	struct table tables[NTABLES];
+	struct buf out;
+	int t, ret = -1;
+
+	memcpy(tables, table_tags, sizeof(tables));
+	for (t = 0; t < NTABLES; t++)
+		buf_init(&tables[t].b);
+	buf_init(&out);
+	if (make_tables(tables, font) != 0) goto out;
+	put_sfnt(&out, tables);
+	if (!out.failed && fwrite(out.data, 1, out.len, f) == out.len)
+		ret = 0;
+out:
+	for (t = 0; t < NTABLES; t++)
+		buf_free(&tables[t].b);
+	buf_free(&out);
+	return ret;
+}
+
+/*
+ * WOFF2 (W3C Recommendation, WOFF File Format 2.0).  Its transforms
+ * are all for TrueType outlines, so a CFF font's tables go in as they
+ * are, one after another in a single Brotli stream.
+ */
+static char const *const woff2_tags[] = {
+	"cmap", "head", "hhea", "hmtx", "maxp", "name", "OS/2", "post",
+	"cvt ", "fpgm", "glyf", "loca", "prep", "CFF ", "VORG", "EBDT",
+	"EBLC", "gasp", "hdmx", "kern", "LTSH", "PCLT", "VDMX", "vhea",
+	"vmtx", "BASE", "GDEF", "GPOS", "GSUB",
+};
+
+static void
+put_base128(struct buf *b, unsigned long v)
+{
+	int i;
+
+	for (i = 28; i > 0 && (v >> i) == 0; i -= 7)
+		continue;
+	for (; i > 0; i -= 7)
+		buf_put8(b, 0x80 | (v >> i & 0x7f));
+	buf_put8(b, v & 0x7f);
+}
+
+int
+write_woff2(FILE *f, struct font const *font)
+{
+	struct table tables[NTABLES];
+	struct buf sfnt, raw, out;
+	unsigned char *packed = NULL;
+	size_t packedlen;
+	int i, t, ntables = 0, ret = -1;
+
+	memcpy(tables, table_tags, sizeof(tables));
+	for (t = 0; t < NTABLES; t++)
+		buf_init(&tables[t].b);
+	buf_init(&sfnt);
+	buf_init(&raw);
+	buf_init(&out);
+	if (make_tables(tables, font) != 0) goto out;
+	/* The sfnt is only wanted for its size and checksum. */
+	put_sfnt(&sfnt, tables);
+	for (t = 0; t < NTABLES; t++)
+		if (tables[t].b.len > 0) {
+			buf_put(&raw, tables[t].b.data, tables[t].b.len);
+			ntables++;
+		}
+	if (sfnt.failed || raw.failed) goto out;
+	packedlen = BrotliEncoderMaxCompressedSize(raw.len);
+	packed = malloc(packedlen);
+	if (packed == NULL ||
+	    !BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW,
+		BROTLI_MODE_FONT, raw.len, raw.data, &packedlen, packed))
+		goto out;
+
+	buf_put(&out, "wOF2", 4);
+	buf_put(&out, "OTTO", 4);		/* flavor */
+	buf_put32(&out, 0);			/* length, for now */
+	buf_put16(&out, ntables);
+	buf_put16(&out, 0);			/* reserved */
+	buf_put32(&out, sfnt.len);		/* totalSfntSize */
+	buf_put32(&out, packedlen);		/* totalCompressedSize */
+	buf_put16(&out, 1);			/* majorVersion */
+	buf_put16(&out, 0);			/* minorVersion */
+	buf_zero(&out, 20);			/* No metadata or private */
+	for (t = 0; t < NTABLES; t++) {
+		if (tables[t].b.len == 0) continue;
+		for (i = 0; i < (int)(sizeof(woff2_tags) /
+			 sizeof(woff2_tags[0])); i++)
+			if (memcmp(woff2_tags[i], tables[t].tag, 4) == 0)
+				break;
+		/* Transform 0 is the null transform for these tables. */
+		if (i < (int)(sizeof(woff2_tags) / sizeof(woff2_tags[0])))
+			buf_put8(&out, i);
+		else {
+			buf_put8(&out, 63);
+			buf_put(&out, tables[t].tag, 4);
+		}
+		put_base128(&out, tables[t].b.len);
+	}
+	buf_put(&out, packed, packedlen);
+	buf_zero(&out, -out.len & 3);
+	if (out.failed) goto out;
+	buf_patch32(&out, 8, out.len);
+	if (fwrite(out.data, 1, out.len, f) == out.len)
+		ret = 0;
+out:
+	for (t = 0; t < NTABLES; t++)
+		buf_free(&tables[t].b);
+	buf_free(&sfnt);
+	buf_free(&raw);
+	buf_free(&out);
+	free(packed);
+	return ret;
+}
@@ -0,0 +1,84 @@
+/*
+ * PNG output for Bedstead.
+ *
+ * Written by Ben Harris <bjh21@bjh21.me.uk> and Simon Tatham
+ * <anakin@pobox.com>.
+ *
+ * To the extent possible under law, Ben Harris and Simon Tatham have
+ * dedicated all copyright and related and neighboring rights to this
+ * software to the public domain worldwide.  This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+/*
+ * This writes 8-bit RGB images without interlacing, with zlib doing
+ * the compression.  Every row uses the Up filter, which suits images
+ * made of rows of character cells.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "font.h"
+
+static void
+put_chunk(struct buf *b, char const *type, struct buf const *data)
+{
+	uLong crc;
+
+	buf_put32(b, data->len);
+	buf_put(b, type, 4);
+	buf_put(b, data->data, data->len);
+	crc = crc32(0, (Bytef const *)type, 4);
+	crc = crc32(crc, data->data, data->len);
+	buf_put32(b, crc);
+	if (data->failed) b->failed = true;
+}
+
+int
+write_png(FILE *f, int width, int height, unsigned char const *rgb)
+{
+	struct buf out, chunk, raw;
+	size_t stride = 3 * (size_t)width;
+	uLongf zlen;
+	int x, y, ret = -1;
+
+	buf_init(&out); buf_init(&chunk); buf_init(&raw);
+	buf_put(&out, "\x89PNG\r\n\x1a\n", 8);
+	buf_put32(&chunk, width);
+	buf_put32(&chunk, height);
+	buf_put8(&chunk, 8);			/* bit depth */
+	buf_put8(&chunk, 2);			/* colour type: RGB */
+	buf_put8(&chunk, 0);			/* compression */
+	buf_put8(&chunk, 0);			/* filter */
+	buf_put8(&chunk, 0);			/* interlace */
+	put_chunk(&out, "IHDR", &chunk);
+
+	for (y = 0; y < height; y++) {
+		unsigned char const *row = rgb + y * stride;
+
+		buf_put8(&raw, 2);		/* Up filter */
+		if (raw.failed) goto out;
+		for (x = 0; x < (int)stride; x++)
+			buf_put8(&raw, y ? row[x] - row[x - stride] : row[x]);
+	}
+	chunk.len = 0;
+	zlen = compressBound(raw.len);
+	buf_zero(&chunk, zlen);
+	if (raw.failed || chunk.failed ||
+	    compress2(chunk.data, &zlen, raw.data, raw.len, 9) != Z_OK)
+		goto out;
+	chunk.len = zlen;
+	put_chunk(&out, "IDAT", &chunk);
+	chunk.len = 0;
+	put_chunk(&out, "IEND", &chunk);
+	if (!out.failed && fwrite(out.data, 1, out.len, f) == out.len)
+		ret = 0;
+out:
+	buf_free(&out); buf_free(&chunk); buf_free(&raw);
+	return ret;
+}
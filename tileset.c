@@ -0,0 +1,219 @@
+/*
+ * Tilesets for Dwarf Fortress.
+ *
+ * Written by Ben Harris <bjh21@bjh21.me.uk> and Simon Tatham
+ * <anakin@pobox.com>.
+ *
+ * To the extent possible under law, Ben Harris and Simon Tatham have
+ * dedicated all copyright and related and neighboring rights to this
+ * software to the public domain worldwide.  This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+/*
+ * A tileset is an image with 256 glyphs in a 16x16 square, in white
+ * on magenta.  The character set is (roughly) IBM Code Page 437.
+ * Each cell is one em high and one advance wide, with the baseline
+ * at the font's ascent below its top.  This is the layout that the
+ * PostScript program df.ps used to produce with Ghostscript.
+ *
+ * The outlines are rasterised by filling each pixel whose centre is
+ * inside the glyph, which at 10 and 20 pixels gives exactly the
+ * SAA5050's input and output bitmaps.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "font.h"
+
+char const *const cp437_names[256] = {
+	/* 0x00 */
+	"space", "smileface", "invsmileface", "heart", "diamond",
+	"club", "spade", "bullet", "invbullet", "circle", "invcircle",
+	"male", "female", "musicalnote", "musicalnotedbl", "sun",
+	/* 0x10 */
+	"triagrt", "triaglf", "arrowupdn", "exclamdbl", "paragraph",
+	"section", "filledrect", "arrowupdnbse", "arrowup",
+	"arrowdown", "arrowright", "arrowleft", "orthogonal",
+	"arrowboth", "triagup", "triagdn",
+	/* 0x20 */
+	"space", "exclam", "quotedbl", "numbersign", "dollar",
+	"percent", "ampersand", "quotesingle", "parenleft",
+	"parenright", "asterisk", "plus", "comma", "hyphen", "period",
+	"slash",
+	/* 0x30 */
+	"zero", "one", "two", "three", "four", "five", "six", "seven",
+	"eight", "nine", "colon", "semicolon", "less", "equal",
+	"greater", "question",
+	/* 0x40 */
+	"at", "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K",
+	"L", "M", "N", "O",
+	/* 0x50 */
+	"P", "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z",
+	"bracketleft", "backslash", "bracketright", "asciicircum",
+	"underscore",
+	/* 0x60 */
+	"grave", "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k",
+	"l", "m", "n", "o",
+	/* 0x70 */
+	"p", "q", "r", "s", "t", "u", "v", "w", "x", "y", "z",
+	"braceleft", "bar", "braceright", "asciitilde", "house",
+	/* 0x80 */
+	"Ccedilla", "udieresis", "eacute", "acircumflex", "adieresis",
+	"agrave", "aring", "ccedilla", "ecircumflex", "edieresis",
+	"egrave", "idieresis", "icircumflex", "igrave", "Adieresis",
+	"Aring",
+	/* 0x90 */
+	"Eacute", "ae", "AE", "ocircumflex", "odieresis", "ograve",
+	"ucircumflex", "ugrave", "ydieresis", "Odieresis", "Udieresis",
+	"cent", "sterling", "yen", "peseta", "florin",
+	/* 0xA0 */
+	"aacute", "iacute", "oacute", "uacute", "ntilde", "Ntilde",
+	"ordfemenine", "ordmasculine", "questiondown", "revlogicalnot",
+	"logicalnot", "onehalf", "onequarter", "exclamdown",
+	"guillemotleft", "guillemotright",
+	/* 0xB0 */
+	"ltshade", "shade", "dkshade", "SF110000", "SF090000",
+	"SF190000", "SF200000", "SF210000", "SF220000", "SF230000",
+	"SF240000", "SF250000", "SF260000", "SF270000", "SF280000",
+	"SF030000",
+	/* 0xC0 */
+	"SF020000", "SF070000", "SF060000", "SF080000", "SF100000",
+	"SF050000", "SF360000", "SF370000", "SF380000", "SF390000",
+	"SF400000", "SF410000", "SF420000", "SF430000", "SF440000",
+	"SF450000",
+	/* 0xD0 */
+	"SF460000", "SF470000", "SF480000", "SF490000", "SF500000",
+	"SF510000", "SF520000", "SF530000", "SF540000", "SF040000",
+	"SF010000", "block", "dnblock", "lfblock", "rtblock",
+	"upblock",
+	/* 0xE0 */
+	"alpha", "germandbls", "Gamma", "pi", "Sigma", "sigma", "mu",
+	"tau", "Phi", "Theta", "uni03A9", "delta", "infinity", "phi1",
+	"epsilon", "intersection",
+	/* 0xF0 */
+	"equivalence", "plusminus", "greaterequal", "lessequal",
+	"integraltp", "integralbt", "divide", "approxequal", "degree",
+	"uni2219", "periodcentered", "radical", "uni207F",
+	"twosuperior", "filledbox", "space",
+};
+
+struct crossing {
+	double x;
+	int dir;
+};
+
+static int
+crossing_cmp(void const *va, void const *vb)
+{
+	struct crossing const *a = va, *b = vb;
+
+	return a->x < b->x ? -1 : a->x > b->x;
+}
+
+/*
+ * Fill in white the pixels whose centres are inside a glyph, using the
+ * non-zero winding rule.  (ox, oy) is the glyph's origin in pixels,
+ * and scale is pixels per design unit.  xc is space for as many
+ * crossings as the glyph has points.
+ */
+static void
+raster_glyph(unsigned char *img, int width, int height,
+    struct fontglyph const *g, double ox, double oy, double scale,
+    struct crossing *xc)
+{
+	struct bedstead_vec const *p0, *p1;
+	int c, i, n, px, py, x0, x1, ymin, ymax, w;
+	double y;
+
+	if (g->ncontours == 0) return;
+	ymin = g->points[0].y; ymax = ymin;
+	for (i = 0; i < g->contours[g->ncontours]; i++) {
+		if (g->points[i].y < ymin) ymin = g->points[i].y;
+		if (g->points[i].y > ymax) ymax = g->points[i].y;
+	}
+	for (py = floor(oy - ymax * scale); py <= ceil(oy - ymin * scale);
+	     py++) {
+		if (py < 0 || py >= height) continue;
+		y = (oy - (py + 0.5)) / scale;
+		n = 0;
+		for (c = 0; c < g->ncontours; c++)
+			for (i = g->contours[c]; i < g->contours[c + 1]; i++) {
+				p0 = &g->points[i];
+				p1 = &g->points[i + 1 < g->contours[c + 1] ?
+				    i + 1 : g->contours[c]];
+				if ((p0->y <= y && y < p1->y) ||
+				    (p1->y <= y && y < p0->y)) {
+					xc[n].x = p0->x + (y - p0->y) *
+					    (p1->x - p0->x) / (p1->y - p0->y);
+					xc[n++].dir = p1->y > p0->y ? 1 : -1;
+				}
+			}
+		qsort(xc, n, sizeof(xc[0]), crossing_cmp);
+		for (i = w = 0; i + 1 < n; i++) {
+			w += xc[i].dir;
+			if (w == 0) continue;
+			/* Pixels with centres in [xc[i].x, xc[i + 1].x) */
+			x0 = ceil(xc[i].x * scale + ox - 0.5);
+			x1 = ceil(xc[i + 1].x * scale + ox - 0.5);
+			for (px = x0 < 0 ? 0 : x0; px < x1 && px < width; px++)
+				memset(img + 3 * ((size_t)py * width + px),
+				    0xff, 3);
+		}
+	}
+}
+
+int
+write_tileset(FILE *f, struct font const *font, int const gids[256],
+    int size)
+{
+	double scale = (double)size / (font->ascent + font->descent);
+	double ox, oy;
+	struct crossing *xc;
+	unsigned char *img;
+	int advance = 0, width, height, maxpoints = 0;
+	int i, c, ret;
+
+	for (i = 0; i < 256; i++)
+		if (gids[i] >= 0) {
+			struct fontglyph const *g = &font->glyphs[gids[i]];
+
+			if (advance == 0) advance = g->advance;
+			if (g->contours[g->ncontours] > maxpoints)
+				maxpoints = g->contours[g->ncontours];
+		}
+	width = floor(16 * advance * scale + 0.5);
+	height = 16 * size;
+	img = malloc((size_t)width * height * 3);
+	xc = malloc((maxpoints + 1) * sizeof(xc[0]));
+	if (img == NULL || xc == NULL) {
+		free(img);
+		free(xc);
+		return -1;
+	}
+	/* Magenta background */
+	for (i = 0; i < width * height; i++) {
+		img[3 * i] = 0xff; img[3 * i + 1] = 0; img[3 * i + 2] = 0xff;
+	}
+	for (i = 0; i < 16; i++) {
+		oy = i * size + font->ascent * scale;
+		ox = 0;
+		for (c = 0; c < 16; c++) {
+			struct fontglyph const *g;
+
+			if (gids[16 * i + c] < 0) continue;
+			g = &font->glyphs[gids[16 * i + c]];
+			raster_glyph(img, width, height, g, ox, oy, scale, xc);
+			ox += g->advance * scale;
+		}
+	}
+	ret = write_png(f, width, height, img);
+	free(img);
+	free(xc);
+	return ret;
+}